@@ -151,6 +151,10 @@ void demoDetector<TVocabulary, TDetector, TDescriptor>::run
   //         recall as well.
   //         Here, L stands for the depth levels of the vocabulary tree.
   //      di_levels = L -> the same as the exhaustive technique.
+  // GEOM_LSH: as GEOM_FLANN, but for binary descriptors: the features are
+  //    indexed by hashing their bytes and compared with the Hamming
+  //    distance (only with Brief256LoopDetector; other descriptors are
+  //    compared exhaustively).
   // GEOM_NONE: no geometrical checking is done.
   //
   // In general, with a 10^6 vocabulary, GEOM_DI with 2 <= di_levels <= 4 
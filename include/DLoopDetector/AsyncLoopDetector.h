@@ -0,0 +1,311 @@
+/**
+ * File: AsyncLoopDetector.h
+ * Date: October 2026
+ * Author: agent
+ * Description: asynchronous front of a loop detector that processes the
+ *   frames in a pipeline of background threads
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_ASYNC_LOOP_DETECTOR__
+#define __D_T_ASYNC_LOOP_DETECTOR__
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <future>
+#include <functional>
+#include <exception>
+
+#include "TemplatedLoopDetector.h"
+#include "SpscQueue.h"
+
+namespace DLoopDetector {
+
+/// Runs a loop detector on background threads, so that adding a frame
+/// does not wait for its detection. Frames go through two stages that
+/// overlap: a thread transforms them with the vocabulary, and another one
+/// queries the database, checks the temporal window and verifies them in
+/// the order they were pushed. The frames are pushed by a single thread
+/// into a lock-free queue, and their results are delivered in the same
+/// order by a callback and by futures
+template<class TDescriptor, class F,
+  class TGeomCheck = RuntimeGeometricalCheck>
+class AsyncLoopDetector
+{
+public:
+
+  /// Detector that processes the frames
+  typedef TemplatedLoopDetector<TDescriptor, F, TGeomCheck> Detector;
+
+  /// Function called with the result of each frame
+  typedef std::function<void(const DetectionResult &)> Callback;
+
+  /**
+   * Starts the threads of the pipeline
+   * @param detector detector to add the frames to. It must not be used
+   *   until this object is destroyed
+   * @param capacity max number of frames waiting in each stage
+   * @param callback function called with the result of each frame, in
+   *   order, from the thread of the detection (it should return soon). It
+   *   is not called for frames whose detection throws
+   */
+  AsyncLoopDetector(Detector &detector, size_t capacity = 8,
+    const Callback &callback = Callback());
+
+  /**
+   * Processes the frames already pushed and stops the threads
+   */
+  ~AsyncLoopDetector();
+
+  /**
+   * Pushes a frame, waiting for room if the queue is full. Only one thread
+   * may push frames
+   * @param keys keypoints of the image
+   * @param descriptors descriptors associated to the given keypoints
+   * @return result of the detection of the frame
+   */
+  std::future<DetectionResult> push(std::vector<cv::KeyPoint> &&keys,
+    std::vector<TDescriptor> &&descriptors);
+
+  /**
+   * Pushes a frame, unless the queue is full. Only one thread may push
+   * frames
+   * @param keys keypoints of the image (left untouched if not pushed)
+   * @param descriptors descriptors associated to the given keypoints (left
+   *   untouched if not pushed)
+   * @param result (out) if given, result of the detection of the frame
+   * @return true iff the frame was pushed
+   */
+  bool tryPush(std::vector<cv::KeyPoint> &&keys,
+    std::vector<TDescriptor> &&descriptors,
+    std::future<DetectionResult> *result = NULL);
+
+  /**
+   * Waits until all the frames pushed have been processed. It must be
+   * called by the thread that pushes them
+   */
+  void flush();
+
+  /**
+   * Returns the number of frames pushed that have not been processed yet
+   * @return number of frames
+   */
+  inline size_t pending() const
+  {
+    return m_pushed - m_processed.load();
+  }
+
+protected:
+
+  /// Frame going through the pipeline
+  struct tFrame
+  {
+    /// Keypoints
+    std::vector<cv::KeyPoint> keys;
+    /// Descriptors
+    std::vector<TDescriptor> descriptors;
+    /// Vectors computed by the first stage
+    BowVector bowvec;
+    FeatureVector featvec;
+    /// Whether the vectors were computed
+    bool transformed;
+    /// Result of the detection
+    std::promise<DetectionResult> result;
+
+    /**
+     * Creates an empty frame
+     */
+    tFrame(): transformed(false) {}
+  };
+
+protected:
+
+  /**
+   * Main loop of the first stage: transformation
+   */
+  void transformLoop();
+
+  /**
+   * Main loop of the second stage: detection
+   */
+  void detectionLoop();
+
+protected:
+
+  /// Detector
+  Detector &m_detector;
+  /// Callback of the results
+  Callback m_callback;
+  /// Frames pushed
+  SpscQueue<tFrame> m_input;
+  /// Frames transformed
+  SpscQueue<tFrame> m_transformed;
+  /// Wakes up the thread that pushes frames (room or progress)
+  Doorbell m_bell_caller;
+  /// Wakes up the first stage (frames or room)
+  Doorbell m_bell_transform;
+  /// Wakes up the second stage (frames)
+  Doorbell m_bell_detection;
+  /// Number of frames pushed (pushing thread)
+  size_t m_pushed;
+  /// Number of frames processed
+  std::atomic<size_t> m_processed;
+  /// Whether no more frames are pushed
+  std::atomic<bool> m_closing;
+  /// Whether the first stage has finished
+  std::atomic<bool> m_transform_done;
+  /// Threads of the stages
+  std::thread m_transform_thread, m_detection_thread;
+};
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TGeomCheck>
+AsyncLoopDetector<TDescriptor, F, TGeomCheck>::AsyncLoopDetector(
+  Detector &detector, size_t capacity, const Callback &callback)
+  : m_detector(detector), m_callback(callback), m_input(capacity),
+    m_transformed(capacity), m_pushed(0), m_processed(0), m_closing(false),
+    m_transform_done(false)
+{
+  m_transform_thread =
+    std::thread(&AsyncLoopDetector::transformLoop, this);
+  m_detection_thread =
+    std::thread(&AsyncLoopDetector::detectionLoop, this);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TGeomCheck>
+AsyncLoopDetector<TDescriptor, F, TGeomCheck>::~AsyncLoopDetector()
+{
+  m_closing = true;
+  m_bell_transform.ring();
+  m_transform_thread.join();
+  m_detection_thread.join();
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TGeomCheck>
+std::future<DetectionResult>
+AsyncLoopDetector<TDescriptor, F, TGeomCheck>::push(
+  std::vector<cv::KeyPoint> &&keys, std::vector<TDescriptor> &&descriptors)
+{
+  std::future<DetectionResult> result;
+  while(!tryPush(std::move(keys), std::move(descriptors), &result))
+    m_bell_caller.wait([this]() { return !m_input.full(); });
+  return result;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TGeomCheck>
+bool AsyncLoopDetector<TDescriptor, F, TGeomCheck>::tryPush(
+  std::vector<cv::KeyPoint> &&keys, std::vector<TDescriptor> &&descriptors,
+  std::future<DetectionResult> *result)
+{
+  if(m_input.full()) return false;
+
+  tFrame frame;
+  frame.keys.swap(keys);
+  frame.descriptors.swap(descriptors);
+  if(result) *result = frame.result.get_future();
+
+  // (there is room, since this is the only producer)
+  m_input.tryPush(frame);
+  ++m_pushed;
+  m_bell_transform.ring();
+  return true;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TGeomCheck>
+void AsyncLoopDetector<TDescriptor, F, TGeomCheck>::flush()
+{
+  m_bell_caller.wait([this]() { return m_processed.load() == m_pushed; });
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TGeomCheck>
+void AsyncLoopDetector<TDescriptor, F, TGeomCheck>::transformLoop()
+{
+  tFrame frame;
+
+  for(;;)
+  {
+    m_bell_transform.wait([this]()
+      { return !m_input.empty() || m_closing.load(); });
+
+    // the last frames may arrive just before closing
+    if(!m_input.tryPop(frame) &&
+      (!m_closing.load() || !m_input.tryPop(frame)))
+    {
+      if(m_closing.load()) break;
+      continue;
+    }
+    m_bell_caller.ring();
+
+    frame.transformed = m_detector.transform(frame.keys, frame.descriptors,
+      frame.bowvec, frame.featvec);
+
+    m_bell_transform.wait([this]() { return !m_transformed.full(); });
+    m_transformed.tryPush(frame);
+    m_bell_detection.ring();
+  }
+
+  m_transform_done = true;
+  m_bell_detection.ring();
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TGeomCheck>
+void AsyncLoopDetector<TDescriptor, F, TGeomCheck>::detectionLoop()
+{
+  tFrame frame;
+  const int di_levels = m_detector.getParameters().di_levels;
+
+  for(;;)
+  {
+    m_bell_detection.wait([this]()
+      { return !m_transformed.empty() || m_transform_done.load(); });
+
+    if(!m_transformed.tryPop(frame) &&
+      (!m_transform_done.load() || !m_transformed.tryPop(frame)))
+    {
+      if(m_transform_done.load()) break;
+      continue;
+    }
+    m_bell_transform.ring();
+
+    try
+    {
+      DetectionResult match;
+      if(frame.transformed)
+        m_detector.detectLoop(frame.keys, frame.descriptors, frame.bowvec,
+          &frame.featvec, di_levels, match);
+      else
+        m_detector.detectLoop(frame.keys, frame.descriptors, match);
+
+      if(m_callback) m_callback(match);
+      frame.result.set_value(match);
+    }
+    catch(...)
+    {
+      frame.result.set_exception(std::current_exception());
+    }
+
+    ++m_processed;
+    m_bell_caller.ring();
+  }
+}
+
+// --------------------------------------------------------------------------
+
+} // namespace DLoopDetector
+
+#endif
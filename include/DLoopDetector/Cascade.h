@@ -0,0 +1,154 @@
+/**
+ * File: Cascade.h
+ * Date: October 2026
+ * Author: agent
+ * Description: cheap tests of a set of correspondences that reject wrong
+ *   candidates before the robust estimation of their model
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_CASCADE__
+#define __D_T_CASCADE__
+
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+#include <stdint.h>
+
+#include "Linear.h"
+
+namespace DLoopDetector {
+
+/// Tests of correspondences x1 <-> x2 much cheaper than the estimation of
+/// a fundamental matrix. They only look for strong evidence against a
+/// common model, so that a true loop is seldom rejected
+namespace Cascade {
+
+/**
+ * Counts the correspondences whose changes of orientation and scale agree
+ * with the dominant ones: the changes are accumulated in two histograms,
+ * and a correspondence is counted if it falls in the peak bin or next to
+ * it in both of them
+ * @param dangle n orientation changes (degrees)
+ * @param dscale n scale changes (log2 of the size ratios)
+ * @param n number of correspondences
+ * @param bins number of bins of each histogram (>= 3)
+ * @param hist buffer of 2 * bins ints
+ * @return number of consistent correspondences
+ */
+inline int consistentChanges(const float *dangle, const float *dscale,
+  int n, int bins, int *hist)
+{
+  // scale changes beyond 2^-4 or 2^4 fall in the extreme bins
+  const float smax = 4;
+  int *ha = hist, *hs = hist + bins;
+  std::fill(hist, hist + 2 * bins, 0);
+
+  auto bin = [bins, smax](float a, float s, int &ia, int &is)
+  {
+    a = std::fmod(a, 360.f);
+    if(a < 0) a += 360;
+    ia = std::min((int)(a * bins / 360), bins - 1);
+    is = std::min((int)((std::min(std::max(s, -smax), smax) + smax) * 
+      bins / (2 * smax)), bins - 1);
+  };
+
+  for(int k = 0; k < n; ++k)
+  {
+    int ia, is;
+    bin(dangle[k], dscale[k], ia, is);
+    ++ha[ia];
+    ++hs[is];
+  }
+
+  const int pa = (int)(std::max_element(ha, ha + bins) - ha);
+  const int ps = (int)(std::max_element(hs, hs + bins) - hs);
+
+  int count = 0;
+  for(int k = 0; k < n; ++k)
+  {
+    int ia, is;
+    bin(dangle[k], dscale[k], ia, is);
+
+    // orientations wrap around
+    const int da = std::abs(ia - pa);
+    count += (std::min(da, bins - da) <= 1 && std::abs(is - ps) <= 1);
+  }
+
+  return count;
+}
+
+// --------------------------------------------------------------------------
+
+/**
+ * Looks for an affine transformation x2 = A * x1 + b supported by enough
+ * correspondences, with RANSAC over samples of 3 correspondences. It stops
+ * as soon as one is found
+ * @param p1 n points (x, y) of image 1
+ * @param p2 n points (x, y) of image 2
+ * @param n number of correspondences
+ * @param iterations number of samples
+ * @param max_error max distance (pixels) of the inliers to the
+ *   transformed points
+ * @param enough number of inliers to accept a transformation
+ * @return largest number of inliers found (>= enough if accepted)
+ */
+inline int affineConsensus(const float *p1, const float *p2, int n,
+  int iterations, double max_error, int enough)
+{
+  if(n < 3) return 0;
+
+  const double e2 = max_error * max_error;
+  uint64_t seed = 0x9E3779B97F4A7C15ULL; // repeatable results
+  int best = 0;
+
+  for(int it = 0; it < iterations && best < enough; ++it)
+  {
+    int s[3];
+    int m = 0;
+    while(m < 3)
+    {
+      // xorshift64*
+      seed ^= seed >> 12;
+      seed ^= seed << 25;
+      seed ^= seed >> 27;
+      const int i = (int)((seed * 2685821657736338717ULL) % n);
+      if(std::find(s, s + m, i) == s + m) s[m++] = i;
+    }
+
+    // [x1 y1 1] * [a b c]' = x2, and the same for y2
+    double A[9], Ay[9], bx[3], by[3];
+    for(int k = 0; k < 3; ++k)
+    {
+      A[3 * k] = p1[2 * s[k]]; A[3 * k + 1] = p1[2 * s[k] + 1];
+      A[3 * k + 2] = 1;
+      bx[k] = p2[2 * s[k]]; by[k] = p2[2 * s[k] + 1];
+    }
+    std::copy(A, A + 9, Ay);
+
+    if(!Linear::solve(A, bx, 3) || !Linear::solve(Ay, by, 3)) continue;
+
+    int count = 0;
+    for(int k = 0; k < n; ++k)
+    {
+      const double dx = bx[0] * p1[2 * k] + bx[1] * p1[2 * k + 1] + bx[2] -
+        p2[2 * k];
+      const double dy = by[0] * p1[2 * k] + by[1] * p1[2 * k + 1] + by[2] -
+        p2[2 * k + 1];
+      count += (dx * dx + dy * dy <= e2);
+    }
+
+    if(count > best) best = count;
+  }
+
+  return best;
+}
+
+// --------------------------------------------------------------------------
+
+} // namespace Cascade
+
+} // namespace DLoopDetector
+
+#endif
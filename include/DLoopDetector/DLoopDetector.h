@@ -67,13 +67,257 @@ namespace DLoopDetector
 #include <DBoW2/FSurf64.h>
 #include <DBoW2/FBrief.h>
 
+#include "FBrief256.h"
+#include "FSurf64Fixed.h"
+#include "L2Kernel.h"
+#include "HammingKernel.h"
+
+namespace DLoopDetector
+{
+
+/// Nearest neighbour search of FSurf64 descriptors with the vectorized L2
+/// kernel with early abandoning. Descriptors of other lengths than
+/// FSurf64::L are compared with FSurf64::distance instead
+template<>
+class DistanceKernel<FSurf64::TDescriptor, FSurf64>:
+  public L2DistanceKernel<FSurf64::L>
+{
+public:
+
+  /**
+   * Creates a kernel without candidates
+   */
+  DistanceKernel(): m_B(NULL), m_i_B(NULL), m_fixed(true) {}
+
+  /**
+   * Sets the candidates B[i_B] to search in. B and i_B must stay alive 
+   * until the next call, in case some descriptor is not of length 
+   * FSurf64::L
+   * @param B array of descriptors
+   * @param i_B indices of the candidates in B
+   */
+  inline void setCandidates(const FSurf64::TDescriptor *B,
+    const std::vector<unsigned int> &i_B)
+  {
+    m_B = B;
+    m_i_B = &i_B;
+
+    m_fixed = true;
+    m_train.resize(i_B.size());
+    for(unsigned int j = 0; j < i_B.size() && m_fixed; ++j)
+    {
+      const FSurf64::TDescriptor &b = B[i_B[j]];
+      m_fixed = (b.size() == (size_t)FSurf64::L);
+      if(m_fixed) m_train[j] = &b[0];
+    }
+  }
+
+  /**
+   * Finds the two nearest candidates of a descriptor
+   * @param a descriptor
+   * @param best_j (out) position in i_B of the nearest candidate, or -1
+   * @param best_d1 (out) distance to the nearest candidate (1e9 if none)
+   * @param best_d2 (out) distance to the second nearest candidate
+   *   (1e9 if none)
+   */
+  inline void nearest2(const FSurf64::TDescriptor &a, int &best_j,
+    double &best_d1, double &best_d2) const
+  {
+    if(m_fixed && a.size() == (size_t)FSurf64::L)
+    {
+      L2DistanceKernel<FSurf64::L>::nearest2(&a[0], best_j, best_d1, 
+        best_d2);
+      return;
+    }
+
+    const int n = (m_i_B ? (int)m_i_B->size() : 0);
+    best_j = -1;
+    best_d1 = best_d2 = 1e9;
+    for(int j = 0; j < n; ++j)
+    {
+      const double d = FSurf64::distance(a, m_B[(*m_i_B)[j]]);
+      if(d < best_d1)
+      {
+        best_j = j;
+        best_d2 = best_d1;
+        best_d1 = d;
+      }
+      else if(d < best_d2)
+      {
+        best_d2 = d;
+      }
+    }
+  }
+
+protected:
+
+  /// Array of descriptors
+  const FSurf64::TDescriptor *m_B;
+  /// Candidate indices
+  const std::vector<unsigned int> *m_i_B;
+  /// Whether all the candidates are of length FSurf64::L
+  bool m_fixed;
+};
+
+// --------------------------------------------------------------------------
+
+/// Nearest neighbour search of FBrief descriptors with the SIMD Hamming
+/// kernel. Bitsets of FBrief256::L bits are packed into the word layout of
+/// FBrief256 once per set; bitsets of other lengths are compared with
+/// FBrief::distance instead
+template<>
+class DistanceKernel<FBrief::TDescriptor, FBrief>
+{
+public:
+
+  /**
+   * Creates a kernel without candidates
+   */
+  DistanceKernel(): m_B(NULL), m_i_B(NULL), m_packed(true) {}
+
+  /**
+   * Sets the candidates B[i_B] to search in, copying them into a
+   * contiguous buffer. B and i_B must stay alive until the next call, in
+   * case some descriptor cannot be packed
+   * @param B array of descriptors
+   * @param i_B indices of the candidates in B
+   */
+  inline void setCandidates(const FBrief::TDescriptor *B,
+    const std::vector<unsigned int> &i_B)
+  {
+    const int n = (int)i_B.size();
+    m_B = B;
+    m_i_B = &i_B;
+    m_train.resize(n * W);
+    m_dist.resize(n);
+
+    m_packed = true;
+    for(int j = 0; j < n && m_packed; ++j)
+      m_packed = pack(B[i_B[j]], &m_train[j * W]);
+  }
+
+  /**
+   * Finds the two nearest candidates of a descriptor. Ties are resolved
+   * in favour of the first candidate
+   * @param a descriptor
+   * @param best_j (out) position in i_B of the nearest candidate, or -1
+   * @param best_d1 (out) distance to the nearest candidate (1e9 if none)
+   * @param best_d2 (out) distance to the second nearest candidate
+   *   (1e9 if none)
+   */
+  inline void nearest2(const FBrief::TDescriptor &a, int &best_j,
+    double &best_d1, double &best_d2)
+  {
+    const int n = (int)m_dist.size();
+
+    uint64_t q[W];
+    if(m_packed && pack(a, q))
+    {
+      HammingKernel::nearest2(q, n ? &m_train[0] : NULL, n,
+        n ? &m_dist[0] : NULL, best_j, best_d1, best_d2);
+      return;
+    }
+
+    best_j = -1;
+    best_d1 = best_d2 = 1e9;
+    for(int j = 0; j < n; ++j)
+    {
+      const double d = FBrief::distance(a, m_B[(*m_i_B)[j]]);
+      if(d < best_d1)
+      {
+        best_j = j;
+        best_d2 = best_d1;
+        best_d1 = d;
+      }
+      else if(d < best_d2)
+      {
+        best_d2 = d;
+      }
+    }
+  }
+
+  /**
+   * Returns the memory held by the buffers of the kernel
+   * @return bytes
+   */
+  inline size_t capacity() const
+  {
+    return m_train.capacity() * sizeof(uint64_t) +
+      m_dist.capacity() * sizeof(int);
+  }
+
+protected:
+
+  /// Number of 64-bit words of a packed descriptor
+  static const int W = FBrief256::W;
+
+  /**
+   * Packs a descriptor in the layout of FBrief256: bit i is bit (i % 64)
+   * of word i / 64
+   * @param a descriptor
+   * @param w (out) W words
+   * @return false if the descriptor does not have FBrief256::L bits
+   */
+  static inline bool pack(const FBrief::TDescriptor &a, uint64_t *w)
+  {
+    if(a.size() != (size_t)FBrief256::L) return false;
+
+    std::fill(w, w + W, 0);
+    for(size_t i = a.find_first(); i != FBrief::TDescriptor::npos;
+      i = a.find_next(i))
+    {
+      w[i >> 6] |= (uint64_t)1 << (i & 63);
+    }
+    return true;
+  }
+
+protected:
+
+  /// Array of descriptors
+  const FBrief::TDescriptor *m_B;
+  /// Candidate indices
+  const std::vector<unsigned int> *m_i_B;
+  /// Whether all the candidates were packed
+  bool m_packed;
+  /// Packed candidate words
+  std::vector<uint64_t> m_train;
+  /// Distance buffer
+  std::vector<int> m_dist;
+};
+
+}
+
 /// SURF64 Loop Detector
 typedef DLoopDetector::TemplatedLoopDetector
   <FSurf64::TDescriptor, FSurf64> Surf64LoopDetector;
 
+/// Vocabulary of SURF64 descriptors stored inline. It can be loaded
+/// from the same files as Surf64Vocabulary
+typedef DBoW2::TemplatedVocabulary
+  <DLoopDetector::FSurf64Fixed::TDescriptor, DLoopDetector::FSurf64Fixed>
+  Surf64FixedVocabulary;
+
+/// SURF64 Loop Detector with descriptors stored inline (one aligned block
+/// of 64 floats per descriptor)
+typedef DLoopDetector::TemplatedLoopDetector
+  <DLoopDetector::FSurf64Fixed::TDescriptor, DLoopDetector::FSurf64Fixed>
+  Surf64FixedLoopDetector;
+
 /// BRIEF Loop Detector
 typedef DLoopDetector::TemplatedLoopDetector
   <FBrief::TDescriptor, FBrief> BriefLoopDetector;
 
+/// Vocabulary of 256-bit BRIEF descriptors stored inline. It can be loaded
+/// from the same files as BriefVocabulary
+typedef DBoW2::TemplatedVocabulary
+  <DLoopDetector::FBrief256::TDescriptor, DLoopDetector::FBrief256>
+  Brief256Vocabulary;
+
+/// BRIEF Loop Detector with 256-bit descriptors stored inline (no heap
+/// allocation per descriptor)
+typedef DLoopDetector::TemplatedLoopDetector
+  <DLoopDetector::FBrief256::TDescriptor, DLoopDetector::FBrief256>
+  Brief256LoopDetector;
+
 #endif
 
@@ -0,0 +1,78 @@
+/**
+ * File: DescriptorIndex.h
+ * Date: October 2026
+ * Author: agent
+ * Description: index of a set of descriptors for nearest neighbour search,
+ *   specialized by descriptor classes with approximate indices
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_DESCRIPTOR_INDEX__
+#define __D_T_DESCRIPTOR_INDEX__
+
+#include <vector>
+
+#include "PackedStore.h"
+#include "DistanceKernel.h"
+
+namespace DLoopDetector {
+
+/// TDescriptor: class of descriptor
+/// F: class of descriptor functions
+template<class TDescriptor, class F>
+/// Finds the two nearest descriptors of a query in a set. This version
+/// checks all of them with the distance kernel; binary descriptor classes
+/// specialize it with a hashing index (GEOM_LSH)
+class DescriptorIndex
+{
+public:
+
+  /**
+   * Builds the index. The descriptors are not copied, so they must stay
+   * alive while the index is used
+   * @param descriptors
+   */
+  inline void build(const Span<TDescriptor> &descriptors)
+  {
+    m_all.resize(descriptors.size());
+    for(unsigned int i = 0; i < m_all.size(); ++i) m_all[i] = i;
+    m_kernel.setCandidates(descriptors.data(), m_all);
+  }
+
+  /**
+   * Finds the two nearest descriptors of a query
+   * @param q query
+   * @param best_j (out) index of the nearest descriptor, or -1
+   * @param best_d1 (out) distance to the nearest descriptor (1e9 if none)
+   * @param best_d2 (out) distance to the second nearest descriptor
+   *   (1e9 if none)
+   */
+  inline void nearest2(const TDescriptor &q, int &best_j, double &best_d1,
+    double &best_d2)
+  {
+    m_kernel.nearest2(q, best_j, best_d1, best_d2);
+  }
+
+  /**
+   * Returns the memory held by the index
+   * @return bytes
+   */
+  inline size_t capacity() const
+  {
+    return m_all.capacity() * sizeof(unsigned int) + m_kernel.capacity();
+  }
+
+protected:
+
+  /// Indices of all the descriptors
+  std::vector<unsigned int> m_all;
+  /// Exact search
+  DistanceKernel<TDescriptor, F> m_kernel;
+};
+
+// --------------------------------------------------------------------------
+
+} // namespace DLoopDetector
+
+#endif
@@ -0,0 +1,100 @@
+/**
+ * File: DistanceKernel.h
+ * Date: October 2026
+ * Author: agent
+ * Description: nearest neighbour search of a descriptor among a set of
+ *   candidates, specialized by descriptor classes with faster kernels
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_DISTANCE_KERNEL__
+#define __D_T_DISTANCE_KERNEL__
+
+#include <vector>
+
+namespace DLoopDetector {
+
+/// TDescriptor: class of descriptor
+/// F: class of descriptor functions
+template<class TDescriptor, class F>
+/// Finds the two nearest candidates of a descriptor by calling F::distance.
+/// Descriptor classes can specialize it with vectorized kernels
+class DistanceKernel
+{
+public:
+
+  /**
+   * Sets the candidates B[i_B] to search in. B and i_B must stay alive
+   * until the next call
+   * @param B array of descriptors
+   * @param i_B indices of the candidates in B
+   */
+  inline void setCandidates(const TDescriptor *B,
+    const std::vector<unsigned int> &i_B)
+  {
+    m_B = B;
+    m_i_B = &i_B;
+  }
+
+  /**
+   * Finds the two nearest candidates of a descriptor. Ties are resolved
+   * in favour of the first candidate
+   * @param a descriptor
+   * @param best_j (out) position in i_B of the nearest candidate, or -1
+   * @param best_d1 (out) distance to the nearest candidate (1e9 if none)
+   * @param best_d2 (out) distance to the second nearest candidate
+   *   (1e9 if none)
+   */
+  void nearest2(const TDescriptor &a, int &best_j, double &best_d1,
+    double &best_d2);
+
+  /**
+   * Returns the memory held by the buffers of the kernel
+   * @return bytes
+   */
+  inline size_t capacity() const { return 0; }
+
+protected:
+
+  /// Array of descriptors
+  const TDescriptor *m_B;
+  /// Candidate indices
+  const std::vector<unsigned int> *m_i_B;
+};
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F>
+void DistanceKernel<TDescriptor, F>::nearest2(const TDescriptor &a,
+  int &best_j, double &best_d1, double &best_d2)
+{
+  const TDescriptor *B = m_B;
+  const std::vector<unsigned int> &i_B = *m_i_B;
+
+  best_j = -1;
+  best_d1 = 1e9;
+  best_d2 = 1e9;
+
+  for(unsigned int j = 0; j < i_B.size(); ++j)
+  {
+    double d = F::distance(a, B[i_B[j]]);
+
+    if(d < best_d1)
+    {
+      best_j = j;
+      best_d2 = best_d1;
+      best_d1 = d;
+    }
+    else if(d < best_d2)
+    {
+      best_d2 = d;
+    }
+  }
+}
+
+// --------------------------------------------------------------------------
+
+} // namespace DLoopDetector
+
+#endif
@@ -0,0 +1,233 @@
+/**
+ * File: Epipolar.h
+ * Date: October 2026
+ * Author: agent
+ * Description: epipolar distances of correspondences given a fundamental
+ *   matrix, and inlier counting with runtime dispatch (AVX2/FMA)
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_EPIPOLAR__
+#define __D_T_EPIPOLAR__
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+  (defined(__clang__) || __GNUC__ >= 8)
+#define DLOOPDETECTOR_X86_DISPATCH
+#include <immintrin.h>
+#endif
+
+namespace DLoopDetector {
+
+/// Implementations of the inlier counting. They are free functions so that
+/// each one can be compiled for its own instruction set. The matrix is 
+/// given in float, scaled so that its largest element is 1. A 
+/// correspondence is an inlier iff r^2 <= e^2 * den (Sampson distance 
+/// without division), with den > 0
+namespace EpipolarImpl {
+
+inline int countInliersScalar(const float *F, const float *x1, 
+  const float *y1, const float *x2, const float *y2, int n, float e2,
+  unsigned char *inliers)
+{
+  int count = 0;
+  for(int j = 0; j < n; ++j)
+  {
+    const float a = F[0] * x1[j] + F[1] * y1[j] + F[2];
+    const float b = F[3] * x1[j] + F[4] * y1[j] + F[5];
+    const float c = F[6] * x1[j] + F[7] * y1[j] + F[8];
+    const float d = F[0] * x2[j] + F[3] * y2[j] + F[6];
+    const float e = F[1] * x2[j] + F[4] * y2[j] + F[7];
+
+    const float r = x2[j] * a + y2[j] * b + c;
+    const float den = a * a + b * b + d * d + e * e;
+
+    const bool in = den > 0.f && r * r <= e2 * den;
+    if(inliers) inliers[j] = in;
+    count += in;
+  }
+  return count;
+}
+
+// --------------------------------------------------------------------------
+
+#ifdef DLOOPDETECTOR_X86_DISPATCH
+
+__attribute__((target("avx2,fma,popcnt")))
+inline int countInliersAVX2(const float *F, const float *x1, 
+  const float *y1, const float *x2, const float *y2, int n, float e2,
+  unsigned char *inliers)
+{
+  __m256 f[9];
+  for(int i = 0; i < 9; ++i) f[i] = _mm256_set1_ps(F[i]);
+  const __m256 ve2 = _mm256_set1_ps(e2);
+  const __m256 zero = _mm256_setzero_ps();
+
+  int count = 0;
+  int j = 0;
+  for(; j + 8 <= n; j += 8)
+  {
+    const __m256 vx1 = _mm256_loadu_ps(x1 + j);
+    const __m256 vy1 = _mm256_loadu_ps(y1 + j);
+    const __m256 vx2 = _mm256_loadu_ps(x2 + j);
+    const __m256 vy2 = _mm256_loadu_ps(y2 + j);
+
+    const __m256 a = _mm256_fmadd_ps(f[0], vx1, 
+      _mm256_fmadd_ps(f[1], vy1, f[2]));
+    const __m256 b = _mm256_fmadd_ps(f[3], vx1, 
+      _mm256_fmadd_ps(f[4], vy1, f[5]));
+    const __m256 c = _mm256_fmadd_ps(f[6], vx1, 
+      _mm256_fmadd_ps(f[7], vy1, f[8]));
+    const __m256 d = _mm256_fmadd_ps(f[0], vx2, 
+      _mm256_fmadd_ps(f[3], vy2, f[6]));
+    const __m256 e = _mm256_fmadd_ps(f[1], vx2, 
+      _mm256_fmadd_ps(f[4], vy2, f[7]));
+
+    const __m256 r = _mm256_fmadd_ps(vx2, a, _mm256_fmadd_ps(vy2, b, c));
+    const __m256 den = _mm256_fmadd_ps(a, a, _mm256_fmadd_ps(b, b,
+      _mm256_fmadd_ps(d, d, _mm256_mul_ps(e, e))));
+
+    const __m256 in = _mm256_and_ps(
+      _mm256_cmp_ps(den, zero, _CMP_GT_OQ),
+      _mm256_cmp_ps(_mm256_mul_ps(r, r), _mm256_mul_ps(ve2, den), 
+        _CMP_LE_OQ));
+
+    const int mask = _mm256_movemask_ps(in);
+    count += _mm_popcnt_u32(mask);
+
+    if(inliers)
+    {
+      for(int k = 0; k < 8; ++k) inliers[j + k] = (mask >> k) & 1;
+    }
+  }
+
+  return count + countInliersScalar(F, x1 + j, y1 + j, x2 + j, y2 + j,
+    n - j, e2, inliers ? inliers + j : NULL);
+}
+
+#endif // DLOOPDETECTOR_X86_DISPATCH
+
+} // namespace EpipolarImpl
+
+// --------------------------------------------------------------------------
+
+/// Fundamental matrix F (row-major, 3x3) such that x2' * F * x1 = 0 for
+/// the correspondences x1 <-> x2, and distances of points to it
+namespace Epipolar {
+
+/**
+ * Computes the epipolar line in image 2 of a point of image 1, normalized
+ * so that the dot product with a point is its distance to the line
+ * @param F fundamental matrix
+ * @param x1 x coordinate of the point in image 1
+ * @param y1 y coordinate of the point in image 1
+ * @param l (out) line (a, b, c), with a*a + b*b = 1. It is (0, 0, 0) if the
+ *   point is the epipole
+ */
+inline void line2(const double *F, double x1, double y1, double *l)
+{
+  l[0] = F[0] * x1 + F[1] * y1 + F[2];
+  l[1] = F[3] * x1 + F[4] * y1 + F[5];
+  l[2] = F[6] * x1 + F[7] * y1 + F[8];
+
+  const double n = std::sqrt(l[0] * l[0] + l[1] * l[1]);
+  if(n > 0)
+  {
+    l[0] /= n; l[1] /= n; l[2] /= n;
+  }
+  else
+  {
+    l[0] = l[1] = l[2] = 0;
+  }
+}
+
+/**
+ * Returns the squared Sampson distance of a correspondence, the first
+ * order approximation of its squared reprojection error
+ * @param F fundamental matrix
+ * @param x1 x coordinate in image 1
+ * @param y1 y coordinate in image 1
+ * @param x2 x coordinate in image 2
+ * @param y2 y coordinate in image 2
+ * @return squared distance (pixels^2), the max double if the points are
+ *   the epipoles
+ */
+inline double sampson2(const double *F, double x1, double y1,
+  double x2, double y2)
+{
+  // F * x1 and F' * x2
+  const double a = F[0] * x1 + F[1] * y1 + F[2];
+  const double b = F[3] * x1 + F[4] * y1 + F[5];
+  const double c = F[6] * x1 + F[7] * y1 + F[8];
+  const double d = F[0] * x2 + F[3] * y2 + F[6];
+  const double e = F[1] * x2 + F[4] * y2 + F[7];
+
+  const double r = x2 * a + y2 * b + c;
+  const double den = a * a + b * b + d * d + e * e;
+
+  return den > 0 ? r * r / den : std::numeric_limits<double>::max();
+}
+
+/**
+ * Says whether the AVX2/FMA implementation of countInliers is used in 
+ * this CPU
+ * @return true iff AVX2 and FMA are available
+ */
+inline bool useAVX2()
+{
+#ifdef DLOOPDETECTOR_X86_DISPATCH
+  static const bool avx2 = (__builtin_cpu_init(),
+    __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"));
+  return avx2;
+#else
+  return false;
+#endif
+}
+
+/**
+ * Counts the correspondences x1 <-> x2 whose Sampson distance to F is at
+ * most max_error. The coordinates are given as separate arrays so that 
+ * several correspondences are checked at once
+ * @param F fundamental matrix
+ * @param x1 x coordinates in image 1
+ * @param y1 y coordinates in image 1
+ * @param x2 x coordinates in image 2
+ * @param y2 y coordinates in image 2
+ * @param n number of correspondences
+ * @param max_error max Sampson distance (pixels)
+ * @param inliers (out) if not NULL, n flags set to 1 for the inliers
+ * @return number of inliers
+ */
+inline int countInliers(const double *F, const float *x1, const float *y1,
+  const float *x2, const float *y2, int n, double max_error, 
+  unsigned char *inliers = NULL)
+{
+  // the distance does not depend on the scale of F; scaled to keep float
+  // precision
+  double m = 0;
+  for(int i = 0; i < 9; ++i) m = std::max(m, std::fabs(F[i]));
+  if(m == 0) m = 1;
+  
+  float Ff[9];
+  for(int i = 0; i < 9; ++i) Ff[i] = (float)(F[i] / m);
+  
+  const float e2 = (float)(max_error * max_error);
+
+#ifdef DLOOPDETECTOR_X86_DISPATCH
+  if(useAVX2())
+    return EpipolarImpl::countInliersAVX2(Ff, x1, y1, x2, y2, n, e2, 
+      inliers);
+#endif
+  return EpipolarImpl::countInliersScalar(Ff, x1, y1, x2, y2, n, e2, 
+    inliers);
+}
+
+} // namespace Epipolar
+
+} // namespace DLoopDetector
+
+#endif
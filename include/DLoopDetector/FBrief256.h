@@ -0,0 +1,446 @@
+/**
+ * File: FBrief256.h
+ * Date: October 2026
+ * Author: agent
+ * Description: functions for fixed-size 256-bit BRIEF descriptors
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_F_BRIEF_256__
+#define __D_T_F_BRIEF_256__
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include <stdint.h>
+
+#include <opencv/cv.h>
+#include <boost/dynamic_bitset.hpp>
+
+#include "DistanceKernel.h"
+#include "DescriptorIndex.h"
+#include "HammingKernel.h"
+#include "HammingIndex.h"
+
+namespace DLoopDetector {
+
+/// Functions to manipulate 256-bit BRIEF descriptors stored inline
+class FBrief256
+{
+public:
+
+  /// Descriptor length (in bits)
+  static const int L = 256;
+  /// Number of 64-bit words of a descriptor
+  static const int W = L / 64;
+
+  /// Descriptor type: four 64-bit words, bit i is bit (i % 64) of word i / 64
+  struct TDescriptor
+  {
+    /// Packed bits
+    uint64_t words[W];
+
+    /**
+     * Creates a descriptor with all the bits unset
+     */
+    TDescriptor() { reset(); }
+
+    /**
+     * Unsets all the bits
+     */
+    inline void reset()
+    {
+      for(int i = 0; i < W; ++i) words[i] = 0;
+    }
+
+    /**
+     * Returns the value of a bit
+     * @param i bit index
+     * @return true iff bit i is set
+     */
+    inline bool test(int i) const
+    {
+      return (words[i >> 6] >> (i & 63)) & 1;
+    }
+
+    /**
+     * Sets a bit
+     * @param i bit index
+     */
+    inline void set(int i)
+    {
+      words[i >> 6] |= (uint64_t)1 << (i & 63);
+    }
+
+    /**
+     * Returns the number of bits of the descriptor
+     * @return L
+     */
+    inline int size() const { return L; }
+
+    /**
+     * Compares two descriptors
+     * @param b
+     * @return true iff all the bits are equal
+     */
+    inline bool operator==(const TDescriptor &b) const
+    {
+      for(int i = 0; i < W; ++i) if(words[i] != b.words[i]) return false;
+      return true;
+    }
+  };
+
+  typedef const TDescriptor *pDescriptor;
+
+  /**
+   * Calculates the mean value of a set of descriptors (bitwise majority)
+   * @param descriptors
+   * @param mean mean descriptor
+   */
+  static void meanValue(const std::vector<pDescriptor> &descriptors,
+    TDescriptor &mean);
+
+  /**
+   * Calculates the Hamming distance between two descriptors
+   * @param a
+   * @param b
+   * @return distance
+   */
+  static inline double distance(const TDescriptor &a, const TDescriptor &b)
+  {
+    return (double)hamming(a, b);
+  }
+
+  /**
+   * Calculates the Hamming distance between two descriptors as an integer
+   * @param a
+   * @param b
+   * @return number of different bits
+   */
+  static inline int hamming(const TDescriptor &a, const TDescriptor &b)
+  {
+    return popcount(a.words[0] ^ b.words[0]) +
+      popcount(a.words[1] ^ b.words[1]) +
+      popcount(a.words[2] ^ b.words[2]) +
+      popcount(a.words[3] ^ b.words[3]);
+  }
+
+  /**
+   * Returns a string version of the descriptor, in the same format as
+   * FBrief (most significant bit first), so that BRIEF vocabularies can
+   * be loaded with this descriptor type
+   * @param a descriptor
+   * @return string version
+   */
+  static std::string toString(const TDescriptor &a);
+
+  /**
+   * Returns a descriptor from a string
+   * @param a descriptor
+   * @param s string version
+   */
+  static void fromString(TDescriptor &a, const std::string &s);
+
+  /**
+   * Returns a mat with the descriptors in float format
+   * @param descriptors
+   * @param mat (out) NxL 32F matrix
+   */
+  static void toMat32F(const std::vector<TDescriptor> &descriptors,
+    cv::Mat &mat);
+
+  /**
+   * Converts a BRIEF bitset (e.g. computed by DVision::BRIEF) into a
+   * descriptor. Bits beyond L are ignored
+   * @param bits
+   * @param a (out) descriptor
+   */
+  static void fromBitset(const boost::dynamic_bitset<> &bits, TDescriptor &a);
+
+  /**
+   * Converts a set of BRIEF bitsets into descriptors
+   * @param bits
+   * @param descriptors (out)
+   */
+  static void fromBitsets(const std::vector<boost::dynamic_bitset<> > &bits,
+    std::vector<TDescriptor> &descriptors);
+
+protected:
+
+  /**
+   * Counts the bits set in a word
+   * @param x
+   * @return number of bits set
+   */
+  static inline int popcount(uint64_t x)
+  {
+#if defined(__GNUC__)
+    return __builtin_popcountll(x);
+#else
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (int)((x * 0x0101010101010101ULL) >> 56);
+#endif
+  }
+
+  /**
+   * Returns the index of the least significant bit set in a word
+   * @param x non-zero word
+   * @return number of trailing zeros
+   */
+  static inline int ctz(uint64_t x)
+  {
+#if defined(__GNUC__)
+    return __builtin_ctzll(x);
+#else
+    int n = 0;
+    while(!(x & 1)) { x >>= 1; ++n; }
+    return n;
+#endif
+  }
+};
+
+// --------------------------------------------------------------------------
+
+inline void FBrief256::meanValue(const std::vector<pDescriptor> &descriptors,
+  TDescriptor &mean)
+{
+  mean.reset();
+
+  if(descriptors.empty()) return;
+
+  if(descriptors.size() == 1)
+  {
+    mean = *descriptors[0];
+    return;
+  }
+
+  int sum[L] = {0};
+
+  std::vector<pDescriptor>::const_iterator it;
+  for(it = descriptors.begin(); it != descriptors.end(); ++it)
+  {
+    for(int w = 0; w < W; ++w)
+    {
+      uint64_t x = (*it)->words[w];
+      int *s = sum + w * 64;
+      while(x)
+      {
+        // visit only the set bits
+        s[ctz(x)]++;
+        x &= x - 1;
+      }
+    }
+  }
+
+  // same majority rule as FBrief: a bit is set if more than half of the
+  // descriptors have it (ties are not set)
+  const int N2 = (int)descriptors.size() / 2;
+  for(int i = 0; i < L; ++i)
+  {
+    if(sum[i] > N2) mean.set(i);
+  }
+}
+
+// --------------------------------------------------------------------------
+
+inline std::string FBrief256::toString(const TDescriptor &a)
+{
+  std::string s(L, '0');
+  for(int i = 0; i < L; ++i)
+  {
+    if(a.test(i)) s[L - 1 - i] = '1';
+  }
+  return s;
+}
+
+// --------------------------------------------------------------------------
+
+inline void FBrief256::fromString(TDescriptor &a, const std::string &s)
+{
+  a.reset();
+
+  std::stringstream ss(s);
+  std::string bits;
+  ss >> bits;
+
+  // the first character is the most significant bit
+  const int n = (int)(bits.size() < (size_t)L ? bits.size() : L);
+  for(int k = 0; k < n; ++k)
+  {
+    if(bits[k] == '1') a.set(n - 1 - k);
+  }
+}
+
+// --------------------------------------------------------------------------
+
+inline void FBrief256::toMat32F(const std::vector<TDescriptor> &descriptors,
+  cv::Mat &mat)
+{
+  if(descriptors.empty())
+  {
+    mat.release();
+    return;
+  }
+
+  const int N = descriptors.size();
+
+  mat.create(N, L, CV_32F);
+
+  for(int i = 0; i < N; ++i)
+  {
+    const TDescriptor &desc = descriptors[i];
+    float *p = mat.ptr<float>(i);
+    for(int j = 0; j < L; ++j, ++p)
+    {
+      *p = (desc.test(j) ? 1.f : 0.f);
+    }
+  }
+}
+
+// --------------------------------------------------------------------------
+
+inline void FBrief256::fromBitset(const boost::dynamic_bitset<> &bits,
+  TDescriptor &a)
+{
+  a.reset();
+
+  const int n = (int)(bits.size() < (size_t)L ? bits.size() : L);
+  for(int i = 0; i < n; ++i)
+  {
+    if(bits[i]) a.set(i);
+  }
+}
+
+// --------------------------------------------------------------------------
+
+inline void FBrief256::fromBitsets(
+  const std::vector<boost::dynamic_bitset<> > &bits,
+  std::vector<TDescriptor> &descriptors)
+{
+  descriptors.resize(bits.size());
+  for(unsigned int i = 0; i < bits.size(); ++i)
+  {
+    fromBitset(bits[i], descriptors[i]);
+  }
+}
+
+// --------------------------------------------------------------------------
+
+/// Nearest neighbour search of 256-bit BRIEF descriptors with the SIMD
+/// Hamming kernel. The candidates are packed contiguously once per set
+template<>
+class DistanceKernel<FBrief256::TDescriptor, FBrief256>
+{
+public:
+
+  /**
+   * Sets the candidates B[i_B] to search in, copying them into a
+   * contiguous buffer
+   * @param B array of descriptors
+   * @param i_B indices of the candidates in B
+   */
+  inline void setCandidates(const FBrief256::TDescriptor *B,
+    const std::vector<unsigned int> &i_B)
+  {
+    const int n = (int)i_B.size();
+    m_train.resize(n * FBrief256::W);
+    m_dist.resize(n);
+
+    for(int j = 0; j < n; ++j)
+    {
+      const uint64_t *w = B[i_B[j]].words;
+      std::copy(w, w + FBrief256::W, m_train.begin() + j * FBrief256::W);
+    }
+  }
+
+  /**
+   * Finds the two nearest candidates of a descriptor
+   * @param a descriptor
+   * @param best_j (out) position in i_B of the nearest candidate, or -1
+   * @param best_d1 (out) distance to the nearest candidate (1e9 if none)
+   * @param best_d2 (out) distance to the second nearest candidate
+   *   (1e9 if none)
+   */
+  inline void nearest2(const FBrief256::TDescriptor &a, int &best_j,
+    double &best_d1, double &best_d2)
+  {
+    const int n = (int)m_dist.size();
+    HammingKernel::nearest2(a.words, n ? &m_train[0] : NULL, n,
+      n ? &m_dist[0] : NULL, best_j, best_d1, best_d2);
+  }
+
+  /**
+   * Returns the memory held by the buffers of the kernel
+   * @return bytes
+   */
+  inline size_t capacity() const
+  {
+    return m_train.capacity() * sizeof(uint64_t) +
+      m_dist.capacity() * sizeof(int);
+  }
+
+protected:
+
+  /// Packed candidate words
+  std::vector<uint64_t> m_train;
+  /// Distance buffer
+  std::vector<int> m_dist;
+};
+
+// --------------------------------------------------------------------------
+
+/// Approximate nearest neighbour search of 256-bit BRIEF descriptors by
+/// multi-index hashing of their bytes, with exact Hamming re-ranking
+template<>
+class DescriptorIndex<FBrief256::TDescriptor, FBrief256>
+{
+public:
+
+  /**
+   * Builds the index. The descriptors are not copied, so they must stay
+   * alive while the index is used
+   * @param descriptors
+   */
+  inline void build(const Span<FBrief256::TDescriptor> &descriptors)
+  {
+    // the descriptors are W contiguous words each
+    m_index.build(descriptors.empty() ? NULL : descriptors[0].words,
+      (int)descriptors.size());
+  }
+
+  /**
+   * Finds the two nearest descriptors of a query among those that share
+   * some byte with it
+   * @param q query
+   * @param best_j (out) index of the nearest descriptor, or -1
+   * @param best_d1 (out) distance to the nearest descriptor (1e9 if none)
+   * @param best_d2 (out) distance to the second nearest descriptor
+   *   (1e9 if none)
+   */
+  inline void nearest2(const FBrief256::TDescriptor &q, int &best_j,
+    double &best_d1, double &best_d2)
+  {
+    m_index.nearest2(q.words, best_j, best_d1, best_d2);
+  }
+
+  /**
+   * Returns the memory held by the index
+   * @return bytes
+   */
+  inline size_t capacity() const { return m_index.capacity(); }
+
+protected:
+
+  /// Multi-index hashing
+  HammingIndex m_index;
+};
+
+// --------------------------------------------------------------------------
+
+} // namespace DLoopDetector
+
+#endif
@@ -0,0 +1,287 @@
+/**
+ * File: FSurf64Fixed.h
+ * Date: October 2026
+ * Author: agent
+ * Description: functions for fixed-length SURF64 descriptors
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_F_SURF_64_FIXED__
+#define __D_T_F_SURF_64_FIXED__
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <algorithm>
+
+#include <opencv/cv.h>
+
+#include "DistanceKernel.h"
+#include "L2Kernel.h"
+
+#if defined(_MSC_VER)
+#define DLOOPDETECTOR_ALIGN16 __declspec(align(16))
+#else
+#define DLOOPDETECTOR_ALIGN16 __attribute__((aligned(16)))
+#endif
+
+namespace DLoopDetector {
+
+/// Functions to manipulate SURF64 descriptors stored inline
+class FSurf64Fixed
+{
+public:
+
+  /// Descriptor length (in floats)
+  static const int L = 64;
+
+  /// Descriptor type: 64 contiguous floats, 16-byte aligned so that
+  /// std::vector storage (malloc alignment) keeps every descriptor aligned
+  struct DLOOPDETECTOR_ALIGN16 TDescriptor
+  {
+    /// Descriptor values
+    float v[L];
+
+    /**
+     * Creates a descriptor with all the values set to 0
+     */
+    TDescriptor() { std::fill(v, v + L, 0.f); }
+
+    /**
+     * Returns a value of the descriptor
+     * @param i index
+     * @return value
+     */
+    inline float& operator[](int i) { return v[i]; }
+
+    /**
+     * Returns a value of the descriptor
+     * @param i index
+     * @return value
+     */
+    inline const float& operator[](int i) const { return v[i]; }
+
+    /**
+     * Returns the length of the descriptor
+     * @return L
+     */
+    inline int size() const { return L; }
+  };
+
+  typedef const TDescriptor *pDescriptor;
+
+  /**
+   * Calculates the mean value of a set of descriptors
+   * @param descriptors
+   * @param mean mean descriptor
+   */
+  static void meanValue(const std::vector<pDescriptor> &descriptors,
+    TDescriptor &mean);
+
+  /**
+   * Calculates the (squared) distance between two descriptors, as FSurf64
+   * @param a
+   * @param b
+   * @return distance
+   */
+  static double distance(const TDescriptor &a, const TDescriptor &b);
+
+  /**
+   * Returns a string version of the descriptor, in the same format as
+   * FSurf64, so that SURF64 vocabularies can be loaded with this type
+   * @param a descriptor
+   * @return string version
+   */
+  static std::string toString(const TDescriptor &a);
+
+  /**
+   * Returns a descriptor from a string
+   * @param a descriptor
+   * @param s string version
+   */
+  static void fromString(TDescriptor &a, const std::string &s);
+
+  /**
+   * Returns a mat with the descriptors in float format
+   * @param descriptors
+   * @param mat (out) NxL 32F matrix
+   */
+  static void toMat32F(const std::vector<TDescriptor> &descriptors,
+    cv::Mat &mat);
+
+  /**
+   * Converts a packed array of SURF64 values (e.g. as given by cv::SURF)
+   * into descriptors
+   * @param plain N*L values
+   * @param descriptors (out) N descriptors
+   */
+  static void fromPlain(const std::vector<float> &plain,
+    std::vector<TDescriptor> &descriptors);
+
+  /**
+   * Converts a set of FSurf64 descriptors into this type
+   * @param vs descriptors of length L
+   * @param descriptors (out)
+   */
+  static void fromVectors(const std::vector<std::vector<float> > &vs,
+    std::vector<TDescriptor> &descriptors);
+};
+
+// --------------------------------------------------------------------------
+
+inline void FSurf64Fixed::meanValue(
+  const std::vector<pDescriptor> &descriptors, TDescriptor &mean)
+{
+  mean = TDescriptor();
+
+  if(descriptors.empty()) return;
+
+  if(descriptors.size() == 1)
+  {
+    mean = *descriptors[0];
+    return;
+  }
+
+  std::vector<pDescriptor>::const_iterator it;
+  for(it = descriptors.begin(); it != descriptors.end(); ++it)
+  {
+    const float *p = (*it)->v;
+    for(int i = 0; i < L; ++i) mean.v[i] += p[i];
+  }
+
+  const float s = (float)descriptors.size();
+  for(int i = 0; i < L; ++i) mean.v[i] /= s;
+}
+
+// --------------------------------------------------------------------------
+
+inline double FSurf64Fixed::distance(const TDescriptor &a,
+  const TDescriptor &b)
+{
+  double sqd = 0.;
+  for(int i = 0; i < L; ++i)
+  {
+    const float d = a.v[i] - b.v[i];
+    sqd += d * d;
+  }
+  return sqd;
+}
+
+// --------------------------------------------------------------------------
+
+inline std::string FSurf64Fixed::toString(const TDescriptor &a)
+{
+  std::stringstream ss;
+  for(int i = 0; i < L; ++i)
+  {
+    ss << a.v[i] << " ";
+  }
+  return ss.str();
+}
+
+// --------------------------------------------------------------------------
+
+inline void FSurf64Fixed::fromString(TDescriptor &a, const std::string &s)
+{
+  a = TDescriptor();
+
+  std::stringstream ss(s);
+  for(int i = 0; i < L; ++i)
+  {
+    ss >> a.v[i];
+  }
+}
+
+// --------------------------------------------------------------------------
+
+inline void FSurf64Fixed::toMat32F(const std::vector<TDescriptor> &descriptors,
+  cv::Mat &mat)
+{
+  if(descriptors.empty())
+  {
+    mat.release();
+    return;
+  }
+
+  const int N = descriptors.size();
+
+  mat.create(N, L, CV_32F);
+
+  for(int i = 0; i < N; ++i)
+  {
+    std::copy(descriptors[i].v, descriptors[i].v + L, mat.ptr<float>(i));
+  }
+}
+
+// --------------------------------------------------------------------------
+
+inline void FSurf64Fixed::fromPlain(const std::vector<float> &plain,
+  std::vector<TDescriptor> &descriptors)
+{
+  descriptors.resize(plain.size() / L);
+
+  std::vector<float>::const_iterator it = plain.begin();
+  for(unsigned int i = 0; i < descriptors.size(); ++i, it += L)
+  {
+    std::copy(it, it + L, descriptors[i].v);
+  }
+}
+
+// --------------------------------------------------------------------------
+
+inline void FSurf64Fixed::fromVectors(
+  const std::vector<std::vector<float> > &vs,
+  std::vector<TDescriptor> &descriptors)
+{
+  descriptors.resize(vs.size());
+  for(unsigned int i = 0; i < vs.size(); ++i)
+  {
+    const int n = (int)vs[i].size() < L ? (int)vs[i].size() : L;
+    descriptors[i] = TDescriptor();
+    std::copy(vs[i].begin(), vs[i].begin() + n, descriptors[i].v);
+  }
+}
+
+// --------------------------------------------------------------------------
+
+/// Nearest neighbour search of SURF64 descriptors with the vectorized L2
+/// kernel with early abandoning
+template<>
+class DistanceKernel<FSurf64Fixed::TDescriptor, FSurf64Fixed>:
+  public L2DistanceKernel<FSurf64Fixed::L>
+{
+public:
+
+  /**
+   * Sets the candidates B[i_B] to search in
+   * @param B array of descriptors
+   * @param i_B indices of the candidates in B
+   */
+  inline void setCandidates(const FSurf64Fixed::TDescriptor *B,
+    const std::vector<unsigned int> &i_B)
+  {
+    m_train.resize(i_B.size());
+    for(unsigned int j = 0; j < i_B.size(); ++j) m_train[j] = B[i_B[j]].v;
+  }
+
+  /**
+   * Finds the two nearest candidates of a descriptor
+   * @param a descriptor
+   * @param best_j (out) position in i_B of the nearest candidate, or -1
+   * @param best_d1 (out) distance to the nearest candidate (1e9 if none)
+   * @param best_d2 (out) distance to the second nearest candidate
+   *   (1e9 if none)
+   */
+  inline void nearest2(const FSurf64Fixed::TDescriptor &a, int &best_j,
+    double &best_d1, double &best_d2) const
+  {
+    L2DistanceKernel<FSurf64Fixed::L>::nearest2(a.v, best_j, best_d1, best_d2);
+  }
+};
+
+// --------------------------------------------------------------------------
+
+} // namespace DLoopDetector
+
+#endif
@@ -0,0 +1,165 @@
+/**
+ * File: FeatureBudget.h
+ * Date: October 2026
+ * Author: agent
+ * Description: ranking of keypoints by response spread over an image grid,
+ *   to keep only a budget of them
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_FEATURE_BUDGET__
+#define __D_T_FEATURE_BUDGET__
+
+#include <vector>
+#include <algorithm>
+
+#include <opencv/cv.h>
+
+namespace DLoopDetector {
+
+/// Ranks keypoints so that any number of the first ones are the strongest
+/// keypoints spread over the image: the image is divided into a grid, and
+/// the best keypoint of each cell comes before the second best one of any
+/// cell, and so on. Keypoints of the same rank are sorted by response
+class FeatureBudget
+{
+public:
+
+  /**
+   * Creates a ranking for images of unknown size, which sorts keypoints
+   * by response only
+   */
+  FeatureBudget(): m_rows(0), m_cols(0), m_cell(0), m_grid_cols(1) {}
+
+  /**
+   * Sets the grid
+   * @param rows image height (0 if unknown)
+   * @param cols image width (0 if unknown)
+   * @param cells number of cells along the longest side of the image
+   */
+  inline void setGrid(int rows, int cols, int cells)
+  {
+    m_rows = rows;
+    m_cols = cols;
+    const int side = std::max(rows, cols);
+    if(side <= 0 || cells <= 1)
+    {
+      m_cell = 0;
+      m_grid_cols = 1;
+    }
+    else
+    {
+      m_cell = (side + cells - 1) / cells;
+      m_grid_cols = (cols + m_cell - 1) / m_cell;
+    }
+  }
+
+  /**
+   * Ranks some keypoints
+   * @param keys keypoints
+   * @param order (out) indices of all the keys, best first
+   */
+  void rank(const std::vector<cv::KeyPoint> &keys,
+    std::vector<unsigned int> &order);
+
+  /**
+   * Returns the memory held by the ranking
+   * @return bytes
+   */
+  inline size_t capacity() const
+  {
+    return m_items.capacity() * sizeof(tItem);
+  }
+
+protected:
+
+  /// Keypoint being ranked
+  struct tItem
+  {
+    /// Cell, and then rank in the cell
+    unsigned int group;
+    /// Response
+    float response;
+    /// Index of the keypoint
+    unsigned int index;
+  };
+
+  /**
+   * Sorts items by group, descending response and index
+   * @param a
+   * @param b
+   * @return true iff a goes before b
+   */
+  static inline bool before(const tItem &a, const tItem &b)
+  {
+    if(a.group != b.group) return a.group < b.group;
+    if(a.response != b.response) return a.response > b.response;
+    return a.index < b.index;
+  }
+
+protected:
+
+  /// Image size
+  int m_rows, m_cols;
+  /// Side of the cells (pixels), 0 for a single cell
+  int m_cell;
+  /// Number of cells of a row of the grid
+  int m_grid_cols;
+  /// Items
+  std::vector<tItem> m_items;
+};
+
+// --------------------------------------------------------------------------
+
+inline void FeatureBudget::rank(const std::vector<cv::KeyPoint> &keys,
+  std::vector<unsigned int> &order)
+{
+  const unsigned int n = (unsigned int)keys.size();
+  m_items.resize(n);
+
+  for(unsigned int i = 0; i < n; ++i)
+  {
+    unsigned int cell = 0;
+    if(m_cell > 0)
+    {
+      // keypoints out of the image go to the border cells
+      const int x = std::min(std::max((int)keys[i].pt.x, 0),
+        std::max(m_cols - 1, 0));
+      const int y = std::min(std::max((int)keys[i].pt.y, 0),
+        std::max(m_rows - 1, 0));
+      cell = (y / m_cell) * m_grid_cols + x / m_cell;
+    }
+
+    m_items[i].group = cell;
+    m_items[i].response = keys[i].response;
+    m_items[i].index = i;
+  }
+
+  if(m_cell > 0)
+  {
+    // rank in the cell
+    std::sort(m_items.begin(), m_items.end(), before);
+    unsigned int cell = 0, r = 0;
+    for(unsigned int i = 0; i < n; ++i)
+    {
+      if(i == 0 || m_items[i].group != cell)
+      {
+        cell = m_items[i].group;
+        r = 0;
+      }
+      m_items[i].group = r++;
+    }
+  }
+
+  std::sort(m_items.begin(), m_items.end(), before);
+
+  order.resize(n);
+  for(unsigned int i = 0; i < n; ++i) order[i] = m_items[i].index;
+}
+
+// --------------------------------------------------------------------------
+
+} // namespace DLoopDetector
+
+#endif
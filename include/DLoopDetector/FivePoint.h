@@ -0,0 +1,263 @@
+/**
+ * File: FivePoint.h
+ * Date: October 2026
+ * Author: agent
+ * Description: 5-point minimal solver of the essential matrix
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_FIVE_POINT__
+#define __D_T_FIVE_POINT__
+
+#include <cmath>
+#include <algorithm>
+
+#include "Linear.h"
+
+namespace DLoopDetector {
+
+/// Essential matrices E (row-major, 3x3) such that x2' * E * x1 = 0 for
+/// five correspondences x1 <-> x2 of calibrated (normalized) coordinates,
+/// computed as in Stewenius et al., "Recent developments on direct relative
+/// orientation" (2006): E is a combination of the 4 vectors of the null
+/// space of the epipolar constraints, whose coefficients are found from
+/// the eigenvalues of a 10x10 action matrix
+namespace FivePoint {
+
+/// Polynomials in x, y, z of degree up to 3, with the coefficients of the
+/// monomials x^3, x^2y, xy^2, y^3, x^2z, xyz, y^2z, xz^2, yz^2, z^3, x^2,
+/// xy, y^2, xz, yz, z^2, x, y, z, 1, in this order
+namespace Impl {
+
+/// Number of monomials
+static const int MONOMIALS = 20;
+
+/**
+ * Returns the index of the product of two monomials
+ * @param i index of a monomial
+ * @param j index of a monomial
+ * @return index of the product, -1 if its degree is larger than 3
+ */
+inline int product(int i, int j)
+{
+  static const int exps[MONOMIALS][3] = {
+    {3,0,0}, {2,1,0}, {1,2,0}, {0,3,0}, {2,0,1}, {1,1,1}, {0,2,1},
+    {1,0,2}, {0,1,2}, {0,0,3}, {2,0,0}, {1,1,0}, {0,2,0}, {1,0,1},
+    {0,1,1}, {0,0,2}, {1,0,0}, {0,1,0}, {0,0,1}, {0,0,0} };
+
+  struct tTable
+  {
+    int p[MONOMIALS][MONOMIALS];
+    tTable()
+    {
+      for(int a = 0; a < MONOMIALS; ++a)
+        for(int b = 0; b < MONOMIALS; ++b)
+        {
+          p[a][b] = -1;
+          for(int c = 0; c < MONOMIALS; ++c)
+            if(exps[c][0] == exps[a][0] + exps[b][0] &&
+               exps[c][1] == exps[a][1] + exps[b][1] &&
+               exps[c][2] == exps[a][2] + exps[b][2])
+              p[a][b] = c;
+        }
+    }
+  };
+
+  static const tTable table;
+  return table.p[i][j];
+}
+
+/**
+ * Multiplies two polynomials whose product has degree up to 3
+ * @param a polynomial
+ * @param b polynomial
+ * @param r (out) a * b
+ */
+inline void mul(const double *a, const double *b, double *r)
+{
+  std::fill(r, r + MONOMIALS, 0.);
+  for(int i = 0; i < MONOMIALS; ++i)
+  {
+    if(a[i] == 0) continue;
+    for(int j = 0; j < MONOMIALS; ++j)
+    {
+      if(b[j] == 0) continue;
+      const int k = product(i, j);
+      if(k >= 0) r[k] += a[i] * b[j];
+    }
+  }
+}
+
+/**
+ * Computes r += s * a
+ * @param a polynomial
+ * @param s scale
+ * @param r polynomial
+ */
+inline void add(const double *a, double s, double *r)
+{
+  for(int i = 0; i < MONOMIALS; ++i) r[i] += s * a[i];
+}
+
+} // namespace Impl
+
+// --------------------------------------------------------------------------
+
+/**
+ * Computes the essential matrices of 5 correspondences
+ * @param x1 5 points (x, y) of image 1, in normalized coordinates
+ * @param x2 5 points (x, y) of image 2, in normalized coordinates
+ * @param E (out) up to 10 matrices (9 values each)
+ * @return number of matrices
+ */
+inline int solve(const double *x1, const double *x2, double *E)
+{
+  using namespace Impl;
+
+  // null space of the epipolar constraints
+  double A[5 * 9];
+  for(int k = 0; k < 5; ++k)
+  {
+    const double u1 = x1[2 * k], v1 = x1[2 * k + 1];
+    const double u2 = x2[2 * k], v2 = x2[2 * k + 1];
+    double *a = A + 9 * k;
+    a[0] = u2 * u1; a[1] = u2 * v1; a[2] = u2;
+    a[3] = v2 * u1; a[4] = v2 * v1; a[5] = v2;
+    a[6] = u1; a[7] = v1; a[8] = 1;
+  }
+
+  double N[4 * 9]; // X, Y, Z, W
+  if(!Linear::nullSpace(A, 5, 9, 5, N)) return 0;
+
+  // entries of E = x X + y Y + z Z + W as polynomials
+  double e[9][MONOMIALS];
+  for(int i = 0; i < 9; ++i)
+  {
+    std::fill(e[i], e[i] + MONOMIALS, 0.);
+    e[i][16] = N[i];
+    e[i][17] = N[9 + i];
+    e[i][18] = N[18 + i];
+    e[i][19] = N[27 + i];
+  }
+
+  // constraints: det(E) = 0 and 2 E E' E - trace(E E') E = 0
+  double C[10][MONOMIALS];
+  double t[MONOMIALS], u[MONOMIALS];
+
+  std::fill(C[0], C[0] + MONOMIALS, 0.);
+  for(int c = 0; c < 3; ++c)
+  {
+    // cofactor of e(0, c)
+    const int c1 = (c + 1) % 3, c2 = (c + 2) % 3;
+    mul(e[3 + c1], e[6 + c2], t);
+    mul(e[3 + c2], e[6 + c1], u);
+    add(u, -1, t);
+    mul(e[c], t, u);
+    add(u, 1, C[0]);
+  }
+
+  double EEt[9][MONOMIALS];
+  for(int i = 0; i < 3; ++i)
+    for(int j = i; j < 3; ++j)
+    {
+      std::fill(EEt[i * 3 + j], EEt[i * 3 + j] + MONOMIALS, 0.);
+      for(int k = 0; k < 3; ++k)
+      {
+        mul(e[i * 3 + k], e[j * 3 + k], t);
+        add(t, 1, EEt[i * 3 + j]);
+      }
+      if(i != j) std::copy(EEt[i * 3 + j], EEt[i * 3 + j] + MONOMIALS,
+        EEt[j * 3 + i]);
+    }
+
+  double tr[MONOMIALS];
+  std::fill(tr, tr + MONOMIALS, 0.);
+  for(int i = 0; i < 3; ++i) add(EEt[i * 4], 0.5, tr);
+
+  for(int i = 0; i < 3; ++i)
+    for(int j = 0; j < 3; ++j)
+    {
+      double *row = C[1 + i * 3 + j];
+      mul(tr, e[i * 3 + j], row);
+      for(int k = 0; k < 3; ++k)
+      {
+        mul(EEt[i * 3 + k], e[k * 3 + j], t);
+        add(t, -1, row);
+      }
+    }
+
+  // Gauss-Jordan elimination of the cubic monomials
+  for(int c = 0; c < 10; ++c)
+  {
+    int p = c;
+    for(int r = c + 1; r < 10; ++r)
+      if(std::fabs(C[r][c]) > std::fabs(C[p][c])) p = r;
+    if(C[p][c] == 0) return 0;
+    if(p != c) std::swap_ranges(C[c], C[c] + MONOMIALS, C[p]);
+
+    const double s = 1 / C[c][c];
+    for(int j = c; j < MONOMIALS; ++j) C[c][j] *= s;
+
+    for(int r = 0; r < 10; ++r)
+    {
+      if(r == c || C[r][c] == 0) continue;
+      const double m = C[r][c];
+      for(int j = c; j < MONOMIALS; ++j) C[r][j] -= m * C[c][j];
+    }
+  }
+
+  // action matrix of the multiplication by x on the basis x^2, xy, y^2,
+  // xz, yz, z^2, x, y, z, 1. Cubic monomial i equals -C[i][10..19] * basis
+  double M[100];
+  std::fill(M, M + 100, 0.);
+  const int cubic[6] = { 0, 1, 2, 4, 5, 7 };
+  for(int r = 0; r < 6; ++r)
+    for(int j = 0; j < 10; ++j) M[r * 10 + j] = -C[cubic[r]][10 + j];
+  M[6 * 10 + 0] = 1; // x * x
+  M[7 * 10 + 1] = 1; // x * y
+  M[8 * 10 + 3] = 1; // x * z
+  M[9 * 10 + 6] = 1; // x * 1
+
+  double H[100], wr[10], wi[10];
+  std::copy(M, M + 100, H);
+  if(!Linear::eigenvalues(H, 10, wr, wi)) return 0;
+
+  // each real eigenvalue gives a solution: the eigenvector is the basis
+  // evaluated at (x, y, z)
+  int n = 0;
+  for(int s = 0; s < 10; ++s)
+  {
+    if(wi[s] != 0) continue;
+
+    double B[100], v[10];
+    std::copy(M, M + 100, B);
+    for(int i = 0; i < 10; ++i) B[i * 10 + i] -= wr[s];
+    if(!Linear::nullSpace(B, 10, 10, 9, v) || v[9] == 0) continue;
+
+    const double x = v[6] / v[9], y = v[7] / v[9], z = v[8] / v[9];
+
+    double *Es = E + 9 * n;
+    double norm = 0;
+    for(int i = 0; i < 9; ++i)
+    {
+      Es[i] = x * N[i] + y * N[9 + i] + z * N[18 + i] + N[27 + i];
+      norm += Es[i] * Es[i];
+    }
+    if(norm == 0 || norm != norm) continue;
+
+    norm = std::sqrt(norm);
+    for(int i = 0; i < 9; ++i) Es[i] /= norm;
+    ++n;
+  }
+
+  return n;
+}
+
+// --------------------------------------------------------------------------
+
+} // namespace FivePoint
+
+} // namespace DLoopDetector
+
+#endif
@@ -0,0 +1,212 @@
+/**
+ * File: HammingIndex.h
+ * Date: October 2026
+ * Author: agent
+ * Description: approximate nearest neighbour search of 256-bit binary
+ *   descriptors by multi-index hashing
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_HAMMING_INDEX__
+#define __D_T_HAMMING_INDEX__
+
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+
+#include "HammingKernel.h"
+
+namespace DLoopDetector {
+
+/// Index of a set of 256-bit descriptors (4 words each) for approximate
+/// nearest neighbour search. Each byte of the descriptors is the key of a
+/// hash table (multi-index hashing): the candidates of a query are the
+/// descriptors that share at least one byte with it, and they are ranked by
+/// their exact Hamming distance. A descriptor at distance d of the query is
+/// found with probability 1 - (1 - (1 - d/256)^8)^32, e.g. > 0.99 for
+/// d = 50, while about 1/8 of random descriptors are visited. The
+/// candidates are gathered and compared with the SIMD Hamming kernel
+class HammingIndex
+{
+public:
+
+  /// Number of words of a descriptor
+  static const int W = 4;
+  /// Number of hash tables (one per byte)
+  static const int TABLES = W * 8;
+  /// Number of buckets of each table
+  static const int BUCKETS = 256;
+
+  /**
+   * Creates an empty index
+   */
+  HammingIndex(): m_train(NULL), m_n(0), m_query(0) {}
+
+  /**
+   * Builds the index of n descriptors. The descriptors are not copied, so
+   * they must stay alive while the index is used
+   * @param train n descriptors of W words each, stored contiguously
+   * @param n number of descriptors
+   */
+  void build(const uint64_t *train, int n);
+
+  /**
+   * Returns the number of descriptors indexed
+   * @return number of descriptors
+   */
+  inline int size() const { return m_n; }
+
+  /**
+   * Finds the two nearest descriptors among the candidates of a query
+   * @param q query (W words)
+   * @param best_j (out) index of the nearest descriptor, -1 if there are
+   *   no candidates
+   * @param best_d1 (out) smallest distance (1e9 if none)
+   * @param best_d2 (out) second smallest distance (1e9 if none)
+   */
+  void nearest2(const uint64_t *q, int &best_j, double &best_d1,
+    double &best_d2);
+
+  /**
+   * Returns the memory held by the index
+   * @return bytes
+   */
+  inline size_t capacity() const
+  {
+    return (m_offsets.capacity() + m_ids.capacity() + m_stamp.capacity() +
+      m_cand_ids.capacity()) * sizeof(unsigned int) +
+      m_dist.capacity() * sizeof(int) +
+      m_cand_words.capacity() * sizeof(uint64_t);
+  }
+
+protected:
+
+  /**
+   * Returns the byte t of a descriptor, the key of table t
+   * @param d descriptor
+   * @param t table
+   * @return key
+   */
+  static inline unsigned int key(const uint64_t *d, int t)
+  {
+    return (unsigned int)(d[t >> 3] >> ((t & 7) << 3)) & 0xff;
+  }
+
+protected:
+
+  /// Indexed descriptors
+  const uint64_t *m_train;
+  /// Number of indexed descriptors
+  int m_n;
+
+  /// Start of each bucket in m_ids: table t, bucket b starts at
+  /// m_offsets[t * (BUCKETS + 1) + b]
+  std::vector<unsigned int> m_offsets;
+  /// Descriptor indices sorted by table and bucket
+  std::vector<unsigned int> m_ids;
+
+  /// Last query that visited each descriptor
+  std::vector<unsigned int> m_stamp;
+  /// Current query
+  unsigned int m_query;
+
+  /// Candidates of the current query
+  std::vector<unsigned int> m_cand_ids;
+  /// Words of the candidates, contiguous for the Hamming kernel
+  std::vector<uint64_t> m_cand_words;
+  /// Distances of the candidates
+  std::vector<int> m_dist;
+};
+
+// --------------------------------------------------------------------------
+
+inline void HammingIndex::build(const uint64_t *train, int n)
+{
+  m_train = train;
+  m_n = n;
+
+  m_offsets.assign(TABLES * (BUCKETS + 1), 0);
+  m_ids.resize((size_t)TABLES * n);
+
+  if(m_stamp.size() < (size_t)n) m_stamp.resize(n, m_query);
+
+  // room for all the candidates of a query
+  m_cand_ids.resize(n);
+  m_cand_words.resize((size_t)n * W);
+  m_dist.resize(n);
+
+  // counting sort of the descriptors by each key
+  for(int t = 0; t < TABLES; ++t)
+  {
+    unsigned int *offsets = &m_offsets[t * (BUCKETS + 1)];
+
+    for(int i = 0; i < n; ++i) ++offsets[key(train + i * W, t) + 1];
+    for(int b = 0; b < BUCKETS; ++b) offsets[b + 1] += offsets[b];
+
+    // offsets[b] is used as cursor and then restored
+    unsigned int *ids = n > 0 ? &m_ids[(size_t)t * n] : NULL;
+    for(int i = 0; i < n; ++i) ids[offsets[key(train + i * W, t)]++] = i;
+    for(int b = BUCKETS; b > 0; --b) offsets[b] = offsets[b - 1];
+    offsets[0] = 0;
+  }
+}
+
+// --------------------------------------------------------------------------
+
+inline void HammingIndex::nearest2(const uint64_t *q, int &best_j,
+  double &best_d1, double &best_d2)
+{
+  if(++m_query == 0)
+  {
+    // the stamps wrapped around
+    std::fill(m_stamp.begin(), m_stamp.end(), 0);
+    m_query = 1;
+  }
+
+  if(m_n == 0)
+  {
+    best_j = -1;
+    best_d1 = best_d2 = 1e9;
+    return;
+  }
+
+  // gather the candidates that share a key with the query
+  unsigned int *stamp = &m_stamp[0];
+  unsigned int *cand_ids = &m_cand_ids[0];
+  uint64_t *cand_words = &m_cand_words[0];
+  int nc = 0;
+
+  for(int t = 0; t < TABLES; ++t)
+  {
+    const unsigned int k = key(q, t);
+    const unsigned int *offsets = &m_offsets[t * (BUCKETS + 1)];
+    const unsigned int *ids = &m_ids[(size_t)t * m_n];
+
+    for(unsigned int p = offsets[k]; p < offsets[k + 1]; ++p)
+    {
+      const unsigned int i = ids[p];
+      if(stamp[i] != m_query)
+      {
+        stamp[i] = m_query;
+        cand_ids[nc] = i;
+        const uint64_t *w = m_train + (size_t)i * W;
+        uint64_t *c = cand_words + (size_t)nc * W;
+        c[0] = w[0]; c[1] = w[1]; c[2] = w[2]; c[3] = w[3];
+        ++nc;
+      }
+    }
+  }
+
+  // exact distances
+  HammingKernel::nearest2(q, cand_words, nc, &m_dist[0], best_j, best_d1,
+    best_d2);
+
+  if(best_j >= 0) best_j = m_cand_ids[best_j];
+}
+
+// --------------------------------------------------------------------------
+
+} // namespace DLoopDetector
+
+#endif
@@ -0,0 +1,308 @@
+/**
+ * File: HammingKernel.h
+ * Date: October 2026
+ * Author: agent
+ * Description: one-vs-many Hamming distance of 256-bit descriptors with
+ *   runtime dispatch (POPCNT, AVX2, AVX-512 VPOPCNTDQ)
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_HAMMING_KERNEL__
+#define __D_T_HAMMING_KERNEL__
+
+#include <stdint.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+  (defined(__clang__) || __GNUC__ >= 8)
+#define DLOOPDETECTOR_X86_DISPATCH
+#include <immintrin.h>
+#endif
+
+namespace DLoopDetector {
+
+/// Implementations of the Hamming kernel. They are free functions so that
+/// each one can be compiled for its own instruction set
+namespace HammingKernelImpl {
+
+inline void kernelScalar(const uint64_t *q,
+  const uint64_t *train, int n, int *dist)
+{
+  for(int j = 0; j < n; ++j, train += 4)
+  {
+    int d = 0;
+    for(int w = 0; w < 4; ++w)
+    {
+      uint64_t x = q[w] ^ train[w];
+      x = x - ((x >> 1) & 0x5555555555555555ULL);
+      x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+      x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+      d += (int)((x * 0x0101010101010101ULL) >> 56);
+    }
+    dist[j] = d;
+  }
+}
+
+// --------------------------------------------------------------------------
+
+#ifdef DLOOPDETECTOR_X86_DISPATCH
+
+__attribute__((target("popcnt")))
+inline void kernelPopcnt(const uint64_t *q,
+  const uint64_t *train, int n, int *dist)
+{
+  const uint64_t q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+  for(int j = 0; j < n; ++j, train += 4)
+  {
+    dist[j] = __builtin_popcountll(q0 ^ train[0]) +
+      __builtin_popcountll(q1 ^ train[1]) +
+      __builtin_popcountll(q2 ^ train[2]) +
+      __builtin_popcountll(q3 ^ train[3]);
+  }
+}
+
+// --------------------------------------------------------------------------
+
+__attribute__((target("avx2,popcnt")))
+inline void kernelAVX2(const uint64_t *q,
+  const uint64_t *train, int n, int *dist)
+{
+  const __m256i query = _mm256_loadu_si256((const __m256i*)q);
+  const __m256i lut = _mm256_setr_epi8(
+    0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+    0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low_mask = _mm256_set1_epi8(0x0f);
+  const __m256i zero = _mm256_setzero_si256();
+
+  int j = 0;
+  for(; j + 4 <= n; j += 4, train += 16)
+  {
+    // per candidate: 4 partial sums in 64-bit lanes
+    __m256i s[4];
+    for(int c = 0; c < 4; ++c)
+    {
+      const __m256i x = _mm256_xor_si256(query,
+        _mm256_loadu_si256((const __m256i*)(train + 4 * c)));
+      const __m256i lo = _mm256_shuffle_epi8(lut,
+        _mm256_and_si256(x, low_mask));
+      const __m256i hi = _mm256_shuffle_epi8(lut,
+        _mm256_and_si256(_mm256_srli_epi16(x, 4), low_mask));
+      s[c] = _mm256_sad_epu8(_mm256_add_epi8(lo, hi), zero);
+    }
+
+    // transpose-and-add the partial sums of the 4 candidates
+    const __m256i x01 = _mm256_or_si256(s[0], _mm256_slli_epi64(s[1], 32));
+    const __m256i x23 = _mm256_or_si256(s[2], _mm256_slli_epi64(s[3], 32));
+    const __m256i y = _mm256_add_epi32(_mm256_unpacklo_epi64(x01, x23),
+      _mm256_unpackhi_epi64(x01, x23));
+    const __m128i r = _mm_add_epi32(_mm256_castsi256_si128(y),
+      _mm256_extracti128_si256(y, 1));
+
+    _mm_storeu_si128((__m128i*)(dist + j), r);
+  }
+
+  if(j < n) kernelPopcnt(q, train, n - j, dist + j);
+}
+
+// --------------------------------------------------------------------------
+
+// some GCC versions warn about _mm512_undefined_* inside the intrinsics
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+__attribute__((target("avx512f,avx512vpopcntdq,popcnt")))
+inline void kernelAVX512(const uint64_t *q,
+  const uint64_t *train, int n, int *dist)
+{
+  // each register holds two candidates
+  const __m512i query = _mm512_broadcast_i64x4(
+    _mm256_loadu_si256((const __m256i*)q));
+
+  int j = 0;
+  for(; j + 8 <= n; j += 8, train += 32)
+  {
+    const __m512i p0 = _mm512_popcnt_epi64(_mm512_xor_si512(query,
+      _mm512_loadu_si512((const void*)(train))));
+    const __m512i p1 = _mm512_popcnt_epi64(_mm512_xor_si512(query,
+      _mm512_loadu_si512((const void*)(train + 8))));
+    const __m512i p2 = _mm512_popcnt_epi64(_mm512_xor_si512(query,
+      _mm512_loadu_si512((const void*)(train + 16))));
+    const __m512i p3 = _mm512_popcnt_epi64(_mm512_xor_si512(query,
+      _mm512_loadu_si512((const void*)(train + 24))));
+
+    // p0 = [c0 | c1], p1 = [c2 | c3], ... (4 words per candidate)
+    const __m512i x01 = _mm512_or_si512(p0, _mm512_slli_epi64(p1, 32));
+    const __m512i x23 = _mm512_or_si512(p2, _mm512_slli_epi64(p3, 32));
+    const __m512i y = _mm512_add_epi32(_mm512_unpacklo_epi64(x01, x23),
+      _mm512_unpackhi_epi64(x01, x23));
+    // y lanes: [c0 c2 c4 c6]a [c0 c2 c4 c6]b [c1 c3 c5 c7]a [c1 c3 c5 c7]b
+
+    const __m256i lo = _mm512_castsi512_si256(y);
+    const __m256i hi = _mm512_extracti64x4_epi64(y, 1);
+    const __m128i even = _mm_add_epi32(_mm256_castsi256_si128(lo),
+      _mm256_extracti128_si256(lo, 1));
+    const __m128i odd = _mm_add_epi32(_mm256_castsi256_si128(hi),
+      _mm256_extracti128_si256(hi, 1));
+
+    _mm_storeu_si128((__m128i*)(dist + j), _mm_unpacklo_epi32(even, odd));
+    _mm_storeu_si128((__m128i*)(dist + j + 4), _mm_unpackhi_epi32(even, odd));
+  }
+
+  if(j < n) kernelPopcnt(q, train, n - j, dist + j);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#endif // DLOOPDETECTOR_X86_DISPATCH
+
+} // namespace HammingKernelImpl
+
+// --------------------------------------------------------------------------
+
+/// Computes the Hamming distance between a 256-bit query and a contiguous
+/// set of 256-bit descriptors, with the fastest implementation available
+/// in the running CPU
+class HammingKernel
+{
+public:
+
+  /// Implementations of the kernel
+  enum Implementation
+  {
+    /// Portable bit counting
+    IMPL_SCALAR,
+    /// Hardware popcnt, one 64-bit word at a time
+    IMPL_POPCNT,
+    /// Nibble lookup table in 256-bit registers
+    IMPL_AVX2,
+    /// Native 64-bit lane popcount in 512-bit registers
+    IMPL_AVX512
+  };
+
+  /**
+   * Returns the implementation selected for this CPU
+   * @return implementation
+   */
+  static Implementation implementation();
+
+  /**
+   * Computes the distance between q and n descriptors
+   * @param q query (4 words)
+   * @param train n descriptors of 4 words each, stored contiguously
+   * @param n number of train descriptors
+   * @param dist (out) n distances
+   */
+  static inline void distances(const uint64_t *q, const uint64_t *train,
+    int n, int *dist)
+  {
+    dispatch()(q, train, n, dist);
+  }
+
+  /**
+   * Computes the distances between q and n descriptors and returns the two
+   * smallest ones, with the same tie rules as a sequential scan
+   * @param q query (4 words)
+   * @param train n descriptors of 4 words each, stored contiguously
+   * @param n number of train descriptors
+   * @param dist (out) buffer for n distances
+   * @param best_j (out) index of the nearest descriptor, -1 if n == 0
+   * @param best_d1 (out) smallest distance (1e9 if none)
+   * @param best_d2 (out) second smallest distance (1e9 if none)
+   */
+  static void nearest2(const uint64_t *q, const uint64_t *train, int n,
+    int *dist, int &best_j, double &best_d1, double &best_d2);
+
+protected:
+
+  /// Signature of the kernel implementations
+  typedef void (*tKernel)(const uint64_t *, const uint64_t *, int, int *);
+
+  /**
+   * Returns the kernel to use, selected the first time
+   * @return kernel
+   */
+  static inline tKernel dispatch()
+  {
+    static const tKernel k = select(implementation());
+    return k;
+  }
+
+  /**
+   * Returns the kernel of the given implementation
+   * @param impl
+   * @return kernel
+   */
+  static tKernel select(Implementation impl);
+};
+
+// --------------------------------------------------------------------------
+
+inline HammingKernel::Implementation HammingKernel::implementation()
+{
+#ifdef DLOOPDETECTOR_X86_DISPATCH
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx512f") &&
+    __builtin_cpu_supports("avx512vpopcntdq"))
+    return IMPL_AVX512;
+  if(__builtin_cpu_supports("avx2"))
+    return IMPL_AVX2;
+  if(__builtin_cpu_supports("popcnt"))
+    return IMPL_POPCNT;
+#endif
+  return IMPL_SCALAR;
+}
+
+// --------------------------------------------------------------------------
+
+inline HammingKernel::tKernel HammingKernel::select(Implementation impl)
+{
+  switch(impl)
+  {
+#ifdef DLOOPDETECTOR_X86_DISPATCH
+    case IMPL_AVX512: return &HammingKernelImpl::kernelAVX512;
+    case IMPL_AVX2: return &HammingKernelImpl::kernelAVX2;
+    case IMPL_POPCNT: return &HammingKernelImpl::kernelPopcnt;
+#endif
+    default: return &HammingKernelImpl::kernelScalar;
+  }
+}
+
+// --------------------------------------------------------------------------
+
+inline void HammingKernel::nearest2(const uint64_t *q, const uint64_t *train,
+  int n, int *dist, int &best_j, double &best_d1, double &best_d2)
+{
+  distances(q, train, n, dist);
+
+  int d1 = 1000000000, d2 = 1000000000;
+  best_j = -1;
+
+  for(int j = 0; j < n; ++j)
+  {
+    if(dist[j] < d1)
+    {
+      best_j = j;
+      d2 = d1;
+      d1 = dist[j];
+    }
+    else if(dist[j] < d2)
+    {
+      d2 = dist[j];
+    }
+  }
+
+  best_d1 = d1;
+  best_d2 = d2;
+}
+
+
+// --------------------------------------------------------------------------
+
+} // namespace DLoopDetector
+
+#endif
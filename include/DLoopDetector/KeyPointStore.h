@@ -0,0 +1,359 @@
+/**
+ * File: KeyPointStore.h
+ * Date: October 2026
+ * Author: agent
+ * Description: storage of the keypoints of the entries of a loop detector,
+ *   either complete or only their coordinates
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_KEYPOINT_STORE__
+#define __D_T_KEYPOINT_STORE__
+
+#include <vector>
+#include <stdint.h>
+
+#include <opencv/cv.h>
+
+#include "PackedStore.h"
+
+namespace DLoopDetector {
+
+/// How keypoints of the entries are stored
+enum KeyPointStorage
+{
+  /// Complete cv::KeyPoint objects
+  KEYS_FULL,
+  /// Only the coordinates, as floats (8 bytes per keypoint)
+  KEYS_POINTS_FLOAT,
+  /// Only the coordinates, as 16-bit fixed point (4 bytes per keypoint)
+  KEYS_POINTS_FIXED16
+};
+
+/// Stores the keypoints of a sequence of entries. The geometrical checks
+/// only use keypoint coordinates, so the coordinates can be kept alone
+class KeyPointStore
+{
+public:
+
+  /// Stored keypoints of an entry, in the format of the store. The stores
+  /// never move them, so that the view is valid until the entry is set 
+  /// again or the store is cleared
+  struct EntryView
+  {
+    /// Stored data
+    const void *data;
+    /// Number of keypoints
+    unsigned int size;
+
+    EntryView(): data(NULL), size(0) {}
+  };
+
+public:
+
+  /**
+   * Creates an empty store
+   * @param mode storage mode
+   * @param max_coordinate largest expected coordinate (e.g. the image
+   *   width). It sets the precision of KEYS_POINTS_FIXED16. If 0, up to
+   *   2048 pixels are assumed
+   */
+  KeyPointStore(KeyPointStorage mode = KEYS_FULL, int max_coordinate = 0);
+
+  /**
+   * Returns the storage mode
+   * @return mode
+   */
+  inline KeyPointStorage mode() const { return m_mode; }
+
+  /**
+   * Returns the number of entries
+   * @return number of entries
+   */
+  inline size_t size() const { return m_entries; }
+
+  /**
+   * Sets the keypoints of an entry
+   * @param i entry index (<= size())
+   * @param keys
+   */
+  void set(size_t i, const std::vector<cv::KeyPoint> &keys);
+
+  /**
+   * Returns the keypoints of an entry. Only available with KEYS_FULL
+   * @param i entry index
+   * @return keypoints, or an empty span if only coordinates are stored
+   */
+  inline Span<cv::KeyPoint> keys(size_t i) const
+  {
+    return m_mode == KEYS_FULL ? m_keys[i] : Span<cv::KeyPoint>();
+  }
+
+  /**
+   * Returns the keypoints of an entry view. Only available with KEYS_FULL
+   * @param entry view of an entry of this store
+   * @return keypoints, or an empty span if only coordinates are stored
+   */
+  inline Span<cv::KeyPoint> keys(const EntryView &entry) const
+  {
+    return m_mode == KEYS_FULL ? 
+      Span<cv::KeyPoint>((const cv::KeyPoint*)entry.data, entry.size) :
+      Span<cv::KeyPoint>();
+  }
+
+  /**
+   * Returns the number of keypoints of an entry
+   * @param i entry index
+   * @return number of keypoints
+   */
+  size_t size(size_t i) const;
+
+  /**
+   * Returns a view of the stored keypoints of an entry
+   * @param i entry index
+   * @return view
+   */
+  EntryView view(size_t i) const;
+
+  /**
+   * Writes the coordinates of some keypoints of an entry as consecutive
+   * (x, y) pairs, which can be wrapped by an Nx2 CV_32F matrix. The buffer
+   * is only reallocated when it has to grow
+   * @param i entry index
+   * @param indices indices of the keypoints to get
+   * @param xy (out) 2N coordinates
+   */
+  void getPoints(size_t i, const std::vector<unsigned int> &indices,
+    std::vector<float> &xy) const;
+
+  /**
+   * Same as above, with the view of an entry
+   * @param entry view of an entry of this store
+   * @param indices indices of the keypoints to get
+   * @param xy (out) 2N coordinates
+   */
+  void getPoints(const EntryView &entry, 
+    const std::vector<unsigned int> &indices, std::vector<float> &xy) const;
+
+  /**
+   * Writes the coordinates of some keypoints as consecutive (x, y) pairs
+   * @param keys
+   * @param indices indices of the keypoints to get
+   * @param xy (out) 2N coordinates
+   */
+  static void getPoints(const std::vector<cv::KeyPoint> &keys,
+    const std::vector<unsigned int> &indices, std::vector<float> &xy);
+
+  /**
+   * Reserves space for the expected number of entries and keypoints
+   * @param nentries
+   * @param nkeys keypoints per entry
+   */
+  void reserve(size_t nentries, size_t nkeys);
+
+  /**
+   * Removes all the entries
+   */
+  void clear();
+
+protected:
+
+  /// Coordinates in fixed point
+  struct tFixedPoint
+  {
+    int16_t x;
+    int16_t y;
+  };
+
+  /**
+   * Converts a coordinate to fixed point
+   * @param v
+   * @return fixed point value
+   */
+  inline int16_t toFixed(float v) const
+  {
+    float f = v * m_scale + (v >= 0 ? 0.5f : -0.5f);
+    if(f > 32767.f) f = 32767.f;
+    else if(f < -32768.f) f = -32768.f;
+    return (int16_t)f;
+  }
+
+protected:
+
+  /// Storage mode
+  KeyPointStorage m_mode;
+  /// Number of entries
+  size_t m_entries;
+  /// Scale of fixed point coordinates (power of 2)
+  float m_scale;
+
+  /// Complete keypoints (KEYS_FULL)
+  PackedStore<cv::KeyPoint> m_keys;
+  /// Float coordinates (KEYS_POINTS_FLOAT)
+  PackedStore<cv::Point2f> m_points;
+  /// Fixed point coordinates (KEYS_POINTS_FIXED16)
+  PackedStore<tFixedPoint> m_fixed;
+};
+
+// --------------------------------------------------------------------------
+
+inline KeyPointStore::KeyPointStore(KeyPointStorage mode, int max_coordinate)
+  : m_mode(mode), m_entries(0)
+{
+  if(max_coordinate <= 0) max_coordinate = 2048;
+
+  // largest number of fractional bits that keeps the coordinates in 15 bits
+  int bits = 0;
+  while(bits < 8 && (max_coordinate << (bits + 1)) < 32768) ++bits;
+  m_scale = (float)(1 << bits);
+}
+
+// --------------------------------------------------------------------------
+
+inline void KeyPointStore::set(size_t i, const std::vector<cv::KeyPoint> &keys)
+{
+  if(m_mode == KEYS_FULL)
+  {
+    m_keys.set(i, keys);
+  }
+  else if(m_mode == KEYS_POINTS_FLOAT)
+  {
+    cv::Point2f *points = m_points.assign(i, keys.size());
+    for(size_t k = 0; k < keys.size(); ++k) points[k] = keys[k].pt;
+  }
+  else
+  {
+    tFixedPoint *points = m_fixed.assign(i, keys.size());
+    for(size_t k = 0; k < keys.size(); ++k)
+    {
+      points[k].x = toFixed(keys[k].pt.x);
+      points[k].y = toFixed(keys[k].pt.y);
+    }
+  }
+
+  if(i == m_entries) ++m_entries;
+}
+
+// --------------------------------------------------------------------------
+
+inline size_t KeyPointStore::size(size_t i) const
+{
+  if(m_mode == KEYS_FULL) return m_keys[i].size();
+  else if(m_mode == KEYS_POINTS_FLOAT) return m_points[i].size();
+  else return m_fixed[i].size();
+}
+
+// --------------------------------------------------------------------------
+
+inline KeyPointStore::EntryView KeyPointStore::view(size_t i) const
+{
+  EntryView e;
+  if(m_mode == KEYS_FULL)
+  {
+    e.data = m_keys[i].data();
+    e.size = (unsigned int)m_keys[i].size();
+  }
+  else if(m_mode == KEYS_POINTS_FLOAT)
+  {
+    e.data = m_points[i].data();
+    e.size = (unsigned int)m_points[i].size();
+  }
+  else
+  {
+    e.data = m_fixed[i].data();
+    e.size = (unsigned int)m_fixed[i].size();
+  }
+  return e;
+}
+
+// --------------------------------------------------------------------------
+
+inline void KeyPointStore::getPoints(size_t i,
+  const std::vector<unsigned int> &indices, std::vector<float> &xy) const
+{
+  getPoints(view(i), indices, xy);
+}
+
+// --------------------------------------------------------------------------
+
+inline void KeyPointStore::getPoints(const EntryView &entry,
+  const std::vector<unsigned int> &indices, std::vector<float> &xy) const
+{
+  xy.resize(indices.size() * 2);
+  if(indices.empty()) return;
+
+  float *p = &xy[0];
+  std::vector<unsigned int>::const_iterator it;
+
+  if(m_mode == KEYS_FULL)
+  {
+    const cv::KeyPoint *keys = (const cv::KeyPoint*)entry.data;
+    for(it = indices.begin(); it != indices.end(); ++it)
+    {
+      *p++ = keys[*it].pt.x;
+      *p++ = keys[*it].pt.y;
+    }
+  }
+  else if(m_mode == KEYS_POINTS_FLOAT)
+  {
+    const cv::Point2f *points = (const cv::Point2f*)entry.data;
+    for(it = indices.begin(); it != indices.end(); ++it)
+    {
+      *p++ = points[*it].x;
+      *p++ = points[*it].y;
+    }
+  }
+  else
+  {
+    const tFixedPoint *points = (const tFixedPoint*)entry.data;
+    const float inv = 1.f / m_scale;
+    for(it = indices.begin(); it != indices.end(); ++it)
+    {
+      *p++ = points[*it].x * inv;
+      *p++ = points[*it].y * inv;
+    }
+  }
+}
+
+// --------------------------------------------------------------------------
+
+inline void KeyPointStore::getPoints(const std::vector<cv::KeyPoint> &keys,
+  const std::vector<unsigned int> &indices, std::vector<float> &xy)
+{
+  xy.resize(indices.size() * 2);
+  if(indices.empty()) return;
+
+  float *p = &xy[0];
+  std::vector<unsigned int>::const_iterator it;
+  for(it = indices.begin(); it != indices.end(); ++it)
+  {
+    *p++ = keys[*it].pt.x;
+    *p++ = keys[*it].pt.y;
+  }
+}
+
+// --------------------------------------------------------------------------
+
+inline void KeyPointStore::reserve(size_t nentries, size_t nkeys)
+{
+  if(m_mode == KEYS_FULL) m_keys.reserve(nentries, nentries * nkeys);
+  else if(m_mode == KEYS_POINTS_FLOAT) m_points.reserve(nentries, nentries * nkeys);
+  else m_fixed.reserve(nentries, nentries * nkeys);
+}
+
+// --------------------------------------------------------------------------
+
+inline void KeyPointStore::clear()
+{
+  m_keys.clear();
+  m_points.clear();
+  m_fixed.clear();
+  m_entries = 0;
+}
+
+// --------------------------------------------------------------------------
+
+} // namespace DLoopDetector
+
+#endif
@@ -0,0 +1,217 @@
+/**
+ * File: L2Kernel.h
+ * Date: October 2026
+ * Author: agent
+ * Description: one-vs-many squared L2 distance of float descriptors with
+ *   early abandoning and runtime dispatch (AVX2/FMA)
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_L2_KERNEL__
+#define __D_T_L2_KERNEL__
+
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+  (defined(__clang__) || __GNUC__ >= 8)
+#define DLOOPDETECTOR_X86_DISPATCH
+#include <immintrin.h>
+#endif
+
+namespace DLoopDetector {
+
+/// Implementations of the L2 kernel. They are free functions so that
+/// each one can be compiled for its own instruction set
+namespace L2KernelImpl {
+
+/**
+ * Updates the two nearest distances with d, as a sequential scan does
+ */
+inline void update2(double d, int j, int &best_j, double &best_d1,
+  double &best_d2)
+{
+  if(d < best_d1)
+  {
+    best_j = j;
+    best_d2 = best_d1;
+    best_d1 = d;
+  }
+  else if(d < best_d2)
+  {
+    best_d2 = d;
+  }
+}
+
+// --------------------------------------------------------------------------
+
+inline void nearest2Scalar(const float *q, const float * const *train,
+  int n, int L, int &best_j, double &best_d1, double &best_d2)
+{
+  for(int j = 0; j < n; ++j)
+  {
+    const float *b = train[j];
+    float s = 0.f;
+    int k = 0;
+    while(k < L)
+    {
+      // check the bound every 16 dimensions
+      const int end = (k + 16 < L ? k + 16 : L);
+      for(; k < end; ++k)
+      {
+        const float d = q[k] - b[k];
+        s += d * d;
+      }
+      if((double)s >= best_d2) break;
+    }
+    if(k == L) update2(s, j, best_j, best_d1, best_d2);
+  }
+}
+
+// --------------------------------------------------------------------------
+
+#ifdef DLOOPDETECTOR_X86_DISPATCH
+
+__attribute__((target("avx2,fma")))
+inline float hsum(__m256 v)
+{
+  __m128 x = _mm_add_ps(_mm256_castps256_ps128(v),
+    _mm256_extractf128_ps(v, 1));
+  x = _mm_add_ps(x, _mm_movehl_ps(x, x));
+  x = _mm_add_ss(x, _mm_shuffle_ps(x, x, 1));
+  return _mm_cvtss_f32(x);
+}
+
+// --------------------------------------------------------------------------
+
+__attribute__((target("avx2,fma")))
+inline void nearest2AVX2(const float *q, const float * const *train,
+  int n, int L, int &best_j, double &best_d1, double &best_d2)
+{
+  // L is a multiple of 16
+  for(int j = 0; j < n; ++j)
+  {
+    const float *b = train[j];
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+
+    int k = 0;
+    for(; k < L; k += 16)
+    {
+      const __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(q + k),
+        _mm256_loadu_ps(b + k));
+      const __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(q + k + 8),
+        _mm256_loadu_ps(b + k + 8));
+      acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+      acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+
+      // abandon when this pair cannot beat the second best any more
+      if(k + 16 < L && (double)hsum(_mm256_add_ps(acc0, acc1)) >= best_d2)
+        break;
+    }
+
+    if(k >= L)
+      update2(hsum(_mm256_add_ps(acc0, acc1)), j, best_j, best_d1, best_d2);
+  }
+}
+
+#endif // DLOOPDETECTOR_X86_DISPATCH
+
+} // namespace L2KernelImpl
+
+// --------------------------------------------------------------------------
+
+/// Finds the two nearest float descriptors of a query among a set of
+/// candidates. Candidates that cannot beat the current second nearest one
+/// are abandoned before computing their full distance
+class L2Kernel
+{
+public:
+
+  /**
+   * Finds the two nearest candidates by squared L2 distance
+   * @param q query of L floats
+   * @param train n pointers to candidates of L floats
+   * @param n number of candidates
+   * @param L descriptor length
+   * @param best_j (out) index of the nearest candidate, -1 if n == 0
+   * @param best_d1 (out) smallest distance (1e9 if none)
+   * @param best_d2 (out) second smallest distance (1e9 if none)
+   */
+  static inline void nearest2(const float *q, const float * const *train,
+    int n, int L, int &best_j, double &best_d1, double &best_d2)
+  {
+    best_j = -1;
+    best_d1 = 1e9;
+    best_d2 = 1e9;
+
+#ifdef DLOOPDETECTOR_X86_DISPATCH
+    if(L % 16 == 0 && useAVX2())
+    {
+      L2KernelImpl::nearest2AVX2(q, train, n, L, best_j, best_d1, best_d2);
+      return;
+    }
+#endif
+    L2KernelImpl::nearest2Scalar(q, train, n, L, best_j, best_d1, best_d2);
+  }
+
+  /**
+   * Says whether the AVX2/FMA implementation is used in this CPU
+   * @return true iff AVX2 and FMA are available
+   */
+  static inline bool useAVX2()
+  {
+#ifdef DLOOPDETECTOR_X86_DISPATCH
+    static const bool avx2 = (__builtin_cpu_init(),
+      __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"));
+    return avx2;
+#else
+    return false;
+#endif
+  }
+};
+
+// --------------------------------------------------------------------------
+
+/// L: descriptor length
+template<int L>
+/// Base of the distance kernels of float descriptors of length L
+class L2DistanceKernel
+{
+public:
+
+  /**
+   * Finds the two nearest candidates of a descriptor
+   * @param a descriptor values
+   * @param best_j (out) position of the nearest candidate, or -1
+   * @param best_d1 (out) distance to the nearest candidate (1e9 if none)
+   * @param best_d2 (out) distance to the second nearest candidate
+   *   (1e9 if none)
+   */
+  inline void nearest2(const float *a, int &best_j, double &best_d1,
+    double &best_d2) const
+  {
+    L2Kernel::nearest2(a, m_train.empty() ? NULL : &m_train[0],
+      (int)m_train.size(), L, best_j, best_d1, best_d2);
+  }
+
+  /**
+   * Returns the memory held by the buffers of the kernel
+   * @return bytes
+   */
+  inline size_t capacity() const
+  {
+    return m_train.capacity() * sizeof(const float*);
+  }
+
+protected:
+
+  /// Pointers to the candidates
+  std::vector<const float*> m_train;
+};
+
+// --------------------------------------------------------------------------
+
+} // namespace DLoopDetector
+
+#endif
@@ -0,0 +1,166 @@
+/**
+ * File: LRUCache.h
+ * Date: October 2026
+ * Author: agent
+ * Description: bounded cache with least-recently-used replacement
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_LRU_CACHE__
+#define __D_T_LRU_CACHE__
+
+#include <list>
+#include <map>
+#include <utility>
+#include <cstddef>
+
+namespace DLoopDetector {
+
+/// Key: class of the keys
+/// T: class of the values (default constructible)
+template<class Key, class T>
+/// Keeps up to a fixed number of values. When it is full, the least
+/// recently used value is evicted. Evicted values are not destroyed but
+/// handed over to the new key, so that their buffers can be reused
+class LRUCache
+{
+public:
+
+  typedef typename std::list<std::pair<Key, T> >::const_iterator
+    const_iterator;
+
+  /**
+   * Creates an empty cache
+   * @param capacity max number of values
+   */
+  LRUCache(size_t capacity = 0): m_capacity(capacity), m_hits(0),
+    m_misses(0) {}
+
+  /**
+   * Changes the max number of values, evicting values if necessary
+   * @param capacity
+   */
+  void setCapacity(size_t capacity);
+
+  /**
+   * Returns the max number of values
+   * @return capacity
+   */
+  inline size_t capacity() const { return m_capacity; }
+
+  /**
+   * Returns the number of values
+   * @return number of values
+   */
+  inline size_t size() const { return m_index.size(); }
+
+  /**
+   * Returns the value of a key and marks it as the most recently used.
+   * On a miss, the returned value is either new or an evicted one, and it
+   * must be set by the caller. Capacity must be > 0
+   * @param key
+   * @param hit (out) true iff the key was in the cache
+   * @return value of the key
+   */
+  T& get(const Key &key, bool &hit);
+
+  /**
+   * Removes all the values. The counters are kept
+   */
+  void clear();
+
+  /**
+   * Returns the number of calls to get that found their key
+   * @return hits
+   */
+  inline unsigned long hits() const { return m_hits; }
+
+  /**
+   * Returns the number of calls to get that did not find their key
+   * @return misses
+   */
+  inline unsigned long misses() const { return m_misses; }
+
+  /**
+   * Iterators to the pairs <key, value>, from the most recently used
+   */
+  inline const_iterator begin() const { return m_items.begin(); }
+  inline const_iterator end() const { return m_items.end(); }
+
+protected:
+
+  typedef typename std::list<std::pair<Key, T> >::iterator iterator;
+
+  /// Max number of values
+  size_t m_capacity;
+  /// Values, from the most recently used
+  std::list<std::pair<Key, T> > m_items;
+  /// Position of each key in m_items
+  std::map<Key, iterator> m_index;
+  /// Counters
+  unsigned long m_hits, m_misses;
+};
+
+// --------------------------------------------------------------------------
+
+template<class Key, class T>
+void LRUCache<Key, T>::setCapacity(size_t capacity)
+{
+  m_capacity = capacity;
+  while(m_items.size() > m_capacity)
+  {
+    m_index.erase(m_items.back().first);
+    m_items.pop_back();
+  }
+}
+
+// --------------------------------------------------------------------------
+
+template<class Key, class T>
+T& LRUCache<Key, T>::get(const Key &key, bool &hit)
+{
+  typename std::map<Key, iterator>::iterator mit = m_index.find(key);
+
+  hit = (mit != m_index.end());
+
+  if(hit)
+  {
+    ++m_hits;
+    m_items.splice(m_items.begin(), m_items, mit->second);
+  }
+  else
+  {
+    ++m_misses;
+
+    if(m_items.size() < m_capacity)
+    {
+      m_items.push_front(std::make_pair(key, T()));
+    }
+    else
+    {
+      // reuse the least recently used value
+      m_index.erase(m_items.back().first);
+      m_items.splice(m_items.begin(), m_items, --m_items.end());
+      m_items.front().first = key;
+    }
+    m_index[key] = m_items.begin();
+  }
+
+  return m_items.front().second;
+}
+
+// --------------------------------------------------------------------------
+
+template<class Key, class T>
+void LRUCache<Key, T>::clear()
+{
+  m_items.clear();
+  m_index.clear();
+}
+
+// --------------------------------------------------------------------------
+
+} // namespace DLoopDetector
+
+#endif
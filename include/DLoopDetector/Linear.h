@@ -0,0 +1,418 @@
+/**
+ * File: Linear.h
+ * Date: October 2026
+ * Author: agent
+ * Description: small dense linear algebra for the minimal solvers (null
+ *   spaces, linear systems, symmetric and general eigenvalue problems)
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_LINEAR__
+#define __D_T_LINEAR__
+
+#include <cmath>
+#include <algorithm>
+
+namespace DLoopDetector {
+
+/// Routines on small row-major matrices of doubles, without allocations
+namespace Linear {
+
+/**
+ * Finds a basis of the null space of a matrix by Gaussian elimination with
+ * full pivoting
+ * @param A rows x cols matrix (row-major), destroyed
+ * @param rows number of rows
+ * @param cols number of columns (<= 16)
+ * @param rank expected rank of A (<= rows, < cols)
+ * @param basis (out) cols - rank vectors of cols values each
+ * @return false if the rank of A is smaller than the expected one
+ */
+inline bool nullSpace(double *A, int rows, int cols, int rank,
+  double *basis)
+{
+  int col[16];
+  for(int j = 0; j < cols; ++j) col[j] = j;
+
+  double max_pivot = 0;
+
+  for(int r = 0; r < rank; ++r)
+  {
+    // pivot: largest element of the remaining submatrix
+    int pr = r, pc = r;
+    double best = 0;
+    for(int i = r; i < rows; ++i)
+      for(int j = r; j < cols; ++j)
+        if(std::fabs(A[i * cols + col[j]]) > best)
+        {
+          best = std::fabs(A[i * cols + col[j]]);
+          pr = i; pc = j;
+        }
+
+    if(r == 0) max_pivot = best;
+    if(best == 0 || best <= 1e-12 * max_pivot) return false;
+
+    if(pr != r)
+      for(int j = 0; j < cols; ++j)
+        std::swap(A[r * cols + j], A[pr * cols + j]);
+    std::swap(col[r], col[pc]);
+
+    const double p = A[r * cols + col[r]];
+    for(int i = r + 1; i < rows; ++i)
+    {
+      const double m = A[i * cols + col[r]] / p;
+      if(m == 0) continue;
+      for(int j = r; j < cols; ++j)
+        A[i * cols + col[j]] -= m * A[r * cols + col[j]];
+    }
+  }
+
+  // one vector per column without pivot
+  for(int b = 0; b < cols - rank; ++b)
+  {
+    double *f = basis + b * cols;
+    for(int j = rank; j < cols; ++j) f[col[j]] = (j == rank + b ? 1 : 0);
+
+    for(int r = rank - 1; r >= 0; --r)
+    {
+      double s = 0;
+      for(int j = r + 1; j < cols; ++j) s += A[r * cols + col[j]] * f[col[j]];
+      f[col[r]] = -s / A[r * cols + col[r]];
+    }
+
+    double norm = 0;
+    for(int j = 0; j < cols; ++j) norm += f[j] * f[j];
+    norm = std::sqrt(norm);
+    for(int j = 0; j < cols; ++j) f[j] /= norm;
+  }
+
+  return true;
+}
+
+// --------------------------------------------------------------------------
+
+/**
+ * Solves a square linear system A * x = b by Gaussian elimination with
+ * partial pivoting
+ * @param A N x N matrix (row-major), destroyed
+ * @param b N values, replaced with the solution x
+ * @param N size
+ * @return false if A is singular
+ */
+inline bool solve(double *A, double *b, int N)
+{
+  for(int c = 0; c < N; ++c)
+  {
+    int p = c;
+    for(int r = c + 1; r < N; ++r)
+      if(std::fabs(A[r * N + c]) > std::fabs(A[p * N + c])) p = r;
+    if(A[p * N + c] == 0) return false;
+
+    if(p != c)
+    {
+      for(int j = 0; j < N; ++j) std::swap(A[c * N + j], A[p * N + j]);
+      std::swap(b[c], b[p]);
+    }
+
+    for(int r = c + 1; r < N; ++r)
+    {
+      const double m = A[r * N + c] / A[c * N + c];
+      if(m == 0) continue;
+      for(int j = c; j < N; ++j) A[r * N + j] -= m * A[c * N + j];
+      b[r] -= m * b[c];
+    }
+  }
+
+  for(int r = N - 1; r >= 0; --r)
+  {
+    double s = b[r];
+    for(int j = r + 1; j < N; ++j) s -= A[r * N + j] * b[j];
+    b[r] = s / A[r * N + r];
+  }
+  return true;
+}
+
+// --------------------------------------------------------------------------
+
+/**
+ * Finds the eigenvectors of a symmetric matrix with the Jacobi method
+ * @param A N x N symmetric matrix (row-major), destroyed
+ * @param N size
+ * @param V (out) N x N matrix whose column i is the eigenvector of w[i]
+ * @param w (out) N eigenvalues
+ */
+inline void jacobi(double *A, int N, double *V, double *w)
+{
+  for(int i = 0; i < N; ++i)
+    for(int j = 0; j < N; ++j)
+      V[i * N + j] = (i == j ? 1. : 0.);
+
+  for(int sweep = 0; sweep < 50; ++sweep)
+  {
+    double off = 0, diag = 0;
+    for(int i = 0; i < N; ++i)
+    {
+      diag += A[i * N + i] * A[i * N + i];
+      for(int j = i + 1; j < N; ++j) off += A[i * N + j] * A[i * N + j];
+    }
+    if(off <= 1e-30 * diag || off == 0) break;
+
+    for(int p = 0; p < N; ++p)
+      for(int q = p + 1; q < N; ++q)
+      {
+        const double apq = A[p * N + q];
+        if(apq == 0) continue;
+
+        // rotation that zeroes A[p][q]
+        const double theta = (A[q * N + q] - A[p * N + p]) / (2 * apq);
+        const double t = (theta >= 0 ? 1. : -1.) /
+          (std::fabs(theta) + std::sqrt(theta * theta + 1));
+        const double c = 1 / std::sqrt(t * t + 1), s = t * c;
+
+        for(int k = 0; k < N; ++k)
+        {
+          const double akp = A[k * N + p], akq = A[k * N + q];
+          A[k * N + p] = c * akp - s * akq;
+          A[k * N + q] = s * akp + c * akq;
+        }
+        for(int k = 0; k < N; ++k)
+        {
+          const double apk = A[p * N + k], aqk = A[q * N + k];
+          A[p * N + k] = c * apk - s * aqk;
+          A[q * N + k] = s * apk + c * aqk;
+        }
+        for(int k = 0; k < N; ++k)
+        {
+          const double vkp = V[k * N + p], vkq = V[k * N + q];
+          V[k * N + p] = c * vkp - s * vkq;
+          V[k * N + q] = s * vkp + c * vkq;
+        }
+      }
+  }
+
+  for(int i = 0; i < N; ++i) w[i] = A[i * N + i];
+}
+
+// --------------------------------------------------------------------------
+
+/**
+ * Finds the eigenvalues of a general real matrix: reduction to Hessenberg
+ * form by elimination and shifted QR iterations (as elmhes and hqr of
+ * Numerical Recipes)
+ * @param A N x N matrix (row-major, N <= 16), destroyed
+ * @param N size
+ * @param wr (out) real parts of the N eigenvalues
+ * @param wi (out) imaginary parts of the N eigenvalues (0 for the real
+ *   ones)
+ * @return false if the iterations did not converge
+ */
+inline bool eigenvalues(double *A, int N, double *wr, double *wi)
+{
+  // 1-based access to keep the classical formulation
+  auto a = [A, N](int i, int j) -> double& { return A[(i - 1) * N + j - 1]; };
+
+  // Hessenberg form
+  for(int m = 2; m < N; ++m)
+  {
+    double x = 0;
+    int i = m;
+    for(int j = m; j <= N; ++j)
+    {
+      if(std::fabs(a(j, m - 1)) > std::fabs(x))
+      {
+        x = a(j, m - 1);
+        i = j;
+      }
+    }
+    if(i != m)
+    {
+      for(int j = m - 1; j <= N; ++j) std::swap(a(i, j), a(m, j));
+      for(int j = 1; j <= N; ++j) std::swap(a(j, i), a(j, m));
+    }
+    if(x != 0)
+    {
+      for(i = m + 1; i <= N; ++i)
+      {
+        double y = a(i, m - 1);
+        if(y != 0)
+        {
+          y /= x;
+          a(i, m - 1) = y;
+          for(int j = m; j <= N; ++j) a(i, j) -= y * a(m, j);
+          for(int j = 1; j <= N; ++j) a(j, m) += y * a(j, i);
+        }
+      }
+    }
+  }
+  for(int i = 3; i <= N; ++i)
+    for(int j = 1; j < i - 1; ++j) a(i, j) = 0;
+
+  // QR iterations
+  double anorm = 0;
+  for(int i = 1; i <= N; ++i)
+    for(int j = std::max(i - 1, 1); j <= N; ++j) anorm += std::fabs(a(i, j));
+
+  int nn = N, l;
+  double t = 0, p = 0, q = 0, r = 0, s, w, x, y, z;
+
+  while(nn >= 1)
+  {
+    int its = 0;
+    do
+    {
+      for(l = nn; l >= 2; --l)
+      {
+        s = std::fabs(a(l - 1, l - 1)) + std::fabs(a(l, l));
+        if(s == 0) s = anorm;
+        if(std::fabs(a(l, l - 1)) + s == s)
+        {
+          a(l, l - 1) = 0;
+          break;
+        }
+      }
+      x = a(nn, nn);
+      if(l == nn)
+      {
+        // one root found
+        wr[nn - 1] = x + t;
+        wi[nn - 1] = 0;
+        --nn;
+      }
+      else
+      {
+        y = a(nn - 1, nn - 1);
+        w = a(nn, nn - 1) * a(nn - 1, nn);
+        if(l == nn - 1)
+        {
+          // two roots found
+          p = 0.5 * (y - x);
+          q = p * p + w;
+          z = std::sqrt(std::fabs(q));
+          x += t;
+          if(q >= 0)
+          {
+            z = p + (p >= 0 ? std::fabs(z) : -std::fabs(z));
+            wr[nn - 2] = wr[nn - 1] = x + z;
+            if(z != 0) wr[nn - 1] = x - w / z;
+            wi[nn - 2] = wi[nn - 1] = 0;
+          }
+          else
+          {
+            wr[nn - 2] = wr[nn - 1] = x + p;
+            wi[nn - 2] = -z;
+            wi[nn - 1] = z;
+          }
+          nn -= 2;
+        }
+        else
+        {
+          if(its == 60) return false;
+          if(its == 10 || its == 20)
+          {
+            // exceptional shift
+            t += x;
+            for(int i = 1; i <= nn; ++i) a(i, i) -= x;
+            s = std::fabs(a(nn, nn - 1)) + std::fabs(a(nn - 1, nn - 2));
+            y = x = 0.75 * s;
+            w = -0.4375 * s * s;
+          }
+          ++its;
+
+          int m;
+          for(m = nn - 2; m >= l; --m)
+          {
+            z = a(m, m);
+            r = x - z;
+            s = y - z;
+            p = (r * s - w) / a(m + 1, m) + a(m, m + 1);
+            q = a(m + 1, m + 1) - z - r - s;
+            r = a(m + 2, m + 1);
+            s = std::fabs(p) + std::fabs(q) + std::fabs(r);
+            p /= s;
+            q /= s;
+            r /= s;
+            if(m == l) break;
+            const double u = std::fabs(a(m, m - 1)) *
+              (std::fabs(q) + std::fabs(r));
+            const double v = std::fabs(p) * (std::fabs(a(m - 1, m - 1)) +
+              std::fabs(z) + std::fabs(a(m + 1, m + 1)));
+            if(u + v == v) break;
+          }
+          for(int i = m + 2; i <= nn; ++i)
+          {
+            a(i, i - 2) = 0;
+            if(i != m + 2) a(i, i - 3) = 0;
+          }
+          for(int k = m; k <= nn - 1; ++k)
+          {
+            if(k != m)
+            {
+              p = a(k, k - 1);
+              q = a(k + 1, k - 1);
+              r = 0;
+              if(k != nn - 1) r = a(k + 2, k - 1);
+              if((x = std::fabs(p) + std::fabs(q) + std::fabs(r)) != 0)
+              {
+                p /= x;
+                q /= x;
+                r /= x;
+              }
+            }
+            const double sq = std::sqrt(p * p + q * q + r * r);
+            if((s = (p >= 0 ? sq : -sq)) != 0)
+            {
+              if(k == m)
+              {
+                if(l != m) a(k, k - 1) = -a(k, k - 1);
+              }
+              else
+              {
+                a(k, k - 1) = -s * x;
+              }
+              p += s;
+              x = p / s;
+              y = q / s;
+              z = r / s;
+              q /= p;
+              r /= p;
+              for(int j = k; j <= nn; ++j)
+              {
+                p = a(k, j) + q * a(k + 1, j);
+                if(k != nn - 1)
+                {
+                  p += r * a(k + 2, j);
+                  a(k + 2, j) -= p * z;
+                }
+                a(k + 1, j) -= p * y;
+                a(k, j) -= p * x;
+              }
+              const int mmin = (nn < k + 3 ? nn : k + 3);
+              for(int i = l; i <= mmin; ++i)
+              {
+                p = x * a(i, k) + y * a(i, k + 1);
+                if(k != nn - 1)
+                {
+                  p += z * a(i, k + 2);
+                  a(i, k + 2) -= p * r;
+                }
+                a(i, k + 1) -= p * q;
+                a(i, k) -= p;
+              }
+            }
+          }
+        }
+      }
+    } while(l < nn - 1);
+  }
+
+  return true;
+}
+
+// --------------------------------------------------------------------------
+
+} // namespace Linear
+
+} // namespace DLoopDetector
+
+#endif
@@ -0,0 +1,159 @@
+/**
+ * File: MatchTable.h
+ * Date: October 2026
+ * Author: agent
+ * Description: table of correspondences that keeps the best match of each
+ *   target feature
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_MATCH_TABLE__
+#define __D_T_MATCH_TABLE__
+
+#include <vector>
+#include <cstddef>
+
+namespace DLoopDetector {
+
+/// Collects the correspondences query -> target found by a matcher. When
+/// several queries match the same target, only the closest one is kept.
+/// Each target has a slot in a direct table, so that conflicts are resolved
+/// in constant time
+class MatchTable
+{
+public:
+
+  /// Correspondence
+  struct tMatch
+  {
+    /// Index of the query feature
+    unsigned int query;
+    /// Index of the target feature
+    unsigned int target;
+    /// Distance between both descriptors
+    double distance;
+    /// False if the match was rejected after being added
+    bool valid;
+  };
+
+public:
+
+  /**
+   * Removes all the matches and prepares the table for targets in
+   * [0, ntargets). Only the slots used since the last reset are cleared
+   * @param ntargets number of target features
+   */
+  void reset(size_t ntargets);
+
+  /**
+   * Adds the match query -> target, unless the target has already been
+   * matched with a smaller or equal distance. A replaced match keeps its
+   * position
+   * @param query query index
+   * @param target target index (< ntargets)
+   * @param distance distance between both descriptors
+   */
+  inline void offer(unsigned int query, unsigned int target, double distance)
+  {
+    int &slot = m_slot[target];
+    if(slot < 0)
+    {
+      slot = (int)m_matches.size();
+      tMatch m = { query, target, distance, true };
+      m_matches.push_back(m);
+    }
+    else if(distance < m_matches[slot].distance)
+    {
+      m_matches[slot].query = query;
+      m_matches[slot].distance = distance;
+    }
+  }
+
+  /**
+   * Returns the number of matches added, including rejected ones
+   * @return number of matches
+   */
+  inline size_t size() const { return m_matches.size(); }
+
+  /**
+   * Returns a match
+   * @param i match index (< size())
+   * @return match
+   */
+  inline const tMatch& operator[](size_t i) const { return m_matches[i]; }
+
+  /**
+   * Rejects a match. Its target remains taken
+   * @param i match index (< size())
+   */
+  inline void reject(size_t i) { m_matches[i].valid = false; }
+
+  /**
+   * Returns the valid matches in the order they were added
+   * @param i_query (out) query indices
+   * @param i_target (out) target indices
+   * @param distances (out) if not NULL, distances of the matches
+   */
+  void get(std::vector<unsigned int> &i_query,
+    std::vector<unsigned int> &i_target, 
+    std::vector<double> *distances = NULL) const;
+
+  /**
+   * Returns the memory held by the table
+   * @return bytes
+   */
+  inline size_t capacity() const
+  {
+    return m_slot.capacity() * sizeof(int) +
+      m_matches.capacity() * sizeof(tMatch);
+  }
+
+protected:
+
+  /// Position in m_matches of the match of each target, -1 if none
+  std::vector<int> m_slot;
+  /// Matches
+  std::vector<tMatch> m_matches;
+};
+
+// --------------------------------------------------------------------------
+
+inline void MatchTable::reset(size_t ntargets)
+{
+  std::vector<tMatch>::const_iterator it;
+  for(it = m_matches.begin(); it != m_matches.end(); ++it)
+  {
+    m_slot[it->target] = -1;
+  }
+  m_matches.resize(0);
+
+  if(m_slot.size() < ntargets) m_slot.resize(ntargets, -1);
+}
+
+// --------------------------------------------------------------------------
+
+inline void MatchTable::get(std::vector<unsigned int> &i_query,
+  std::vector<unsigned int> &i_target, std::vector<double> *distances) const
+{
+  i_query.resize(0);
+  i_target.resize(0);
+  if(distances) distances->resize(0);
+
+  std::vector<tMatch>::const_iterator it;
+  for(it = m_matches.begin(); it != m_matches.end(); ++it)
+  {
+    if(it->valid)
+    {
+      i_query.push_back(it->query);
+      i_target.push_back(it->target);
+      if(distances) distances->push_back(it->distance);
+    }
+  }
+}
+
+// --------------------------------------------------------------------------
+
+} // namespace DLoopDetector
+
+#endif
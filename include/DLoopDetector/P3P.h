@@ -0,0 +1,550 @@
+/**
+ * File: P3P.h
+ * Date: October 2026
+ * Author: agent
+ * Description: minimal solver of the pose of a calibrated camera from 3
+ *   points (perspective-3-point problem), and its robust estimation
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_P3P__
+#define __D_T_P3P__
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <stdint.h>
+
+#include "Linear.h"
+
+namespace DLoopDetector {
+
+/// Poses (R, t) of a camera that sees three known 3D points P along three
+/// given bearing vectors, such that R * P + t lies on the rays. Computed as
+/// in Grunert's solution (see Haralick et al., "Review and analysis of
+/// solutions of the three point perspective pose estimation problem",
+/// 1994): the distances along the rays come from the roots of a quartic,
+/// and the pose from the absolute orientation of both sets of points
+namespace P3P {
+
+/**
+ * Finds the real roots of a polynomial
+ * @param c coefficients c[0] * x^n + ... + c[n]
+ * @param n degree (<= 16)
+ * @param roots (out) up to n roots
+ * @return number of real roots
+ */
+inline int realRoots(const double *c, int n, double *roots)
+{
+  // leading zeros lower the degree
+  while(n > 0 && c[0] == 0) { ++c; --n; }
+  if(n <= 0) return 0;
+
+  // eigenvalues of the companion matrix
+  double M[16 * 16], wr[16], wi[16];
+  std::fill(M, M + n * n, 0.);
+  for(int j = 0; j < n; ++j) M[j] = -c[j + 1] / c[0];
+  for(int i = 1; i < n; ++i) M[i * n + i - 1] = 1;
+
+  if(!Linear::eigenvalues(M, n, wr, wi)) return 0;
+
+  int nr = 0;
+  for(int i = 0; i < n; ++i)
+  {
+    if(std::fabs(wi[i]) > 1e-8 * (1 + std::fabs(wr[i]))) continue;
+
+    // polish with Newton steps
+    double x = wr[i];
+    for(int it = 0; it < 3; ++it)
+    {
+      double p = c[0], dp = 0;
+      for(int k = 1; k <= n; ++k)
+      {
+        dp = dp * x + p;
+        p = p * x + c[k];
+      }
+      if(dp == 0) break;
+      x -= p / dp;
+    }
+    roots[nr++] = x;
+  }
+  return nr;
+}
+
+// --------------------------------------------------------------------------
+
+/**
+ * Finds the rigid transformation (R, t) with Q = R * P + t that best
+ * aligns two sets of points in the least squares sense (Horn's method
+ * with unit quaternions)
+ * @param P n points (x, y, z)
+ * @param Q n points (x, y, z)
+ * @param n number of points (>= 3)
+ * @param R (out) rotation (row-major)
+ * @param t (out) translation
+ */
+inline void absoluteOrientation(const double *P, const double *Q, int n,
+  double *R, double *t)
+{
+  double cp[3] = {0, 0, 0}, cq[3] = {0, 0, 0};
+  for(int k = 0; k < n; ++k)
+    for(int i = 0; i < 3; ++i)
+    {
+      cp[i] += P[3 * k + i] / n;
+      cq[i] += Q[3 * k + i] / n;
+    }
+
+  // cross-covariance S(i, j) = sum (p_i * q_j)
+  double S[9];
+  std::fill(S, S + 9, 0.);
+  for(int k = 0; k < n; ++k)
+    for(int i = 0; i < 3; ++i)
+      for(int j = 0; j < 3; ++j)
+        S[i * 3 + j] += (P[3 * k + i] - cp[i]) * (Q[3 * k + j] - cq[j]);
+
+  const double xx = S[0], xy = S[1], xz = S[2], yx = S[3], yy = S[4],
+    yz = S[5], zx = S[6], zy = S[7], zz = S[8];
+  double N[16] = {
+    xx + yy + zz, yz - zy, zx - xz, xy - yx,
+    yz - zy, xx - yy - zz, xy + yx, zx + xz,
+    zx - xz, xy + yx, -xx + yy - zz, yz + zy,
+    xy - yx, zx + xz, yz + zy, -xx - yy + zz };
+
+  double V[16], w[4];
+  Linear::jacobi(N, 4, V, w);
+  const int imax = (int)(std::max_element(w, w + 4) - w);
+  const double q0 = V[imax], q1 = V[4 + imax], q2 = V[8 + imax],
+    q3 = V[12 + imax];
+
+  R[0] = q0 * q0 + q1 * q1 - q2 * q2 - q3 * q3;
+  R[1] = 2 * (q1 * q2 - q0 * q3);
+  R[2] = 2 * (q1 * q3 + q0 * q2);
+  R[3] = 2 * (q1 * q2 + q0 * q3);
+  R[4] = q0 * q0 - q1 * q1 + q2 * q2 - q3 * q3;
+  R[5] = 2 * (q2 * q3 - q0 * q1);
+  R[6] = 2 * (q1 * q3 - q0 * q2);
+  R[7] = 2 * (q2 * q3 + q0 * q1);
+  R[8] = q0 * q0 - q1 * q1 - q2 * q2 + q3 * q3;
+
+  for(int i = 0; i < 3; ++i)
+    t[i] = cq[i] - (R[i * 3] * cp[0] + R[i * 3 + 1] * cp[1] +
+      R[i * 3 + 2] * cp[2]);
+}
+
+// --------------------------------------------------------------------------
+
+/**
+ * Computes the poses of a camera from 3 correspondences
+ * @param f 3 unit bearing vectors (x, y, z) in the camera frame
+ * @param P 3 points (x, y, z) in the world frame
+ * @param R (out) up to 4 rotations (9 values each, row-major)
+ * @param t (out) up to 4 translations (3 values each)
+ * @return number of poses
+ */
+inline int solve(const double *f, const double *P, double *R, double *t)
+{
+  const double *f1 = f, *f2 = f + 3, *f3 = f + 6;
+  const double *P1 = P, *P2 = P + 3, *P3 = P + 6;
+
+  // squared distances between the points
+  double a2 = 0, b2 = 0, c2 = 0;
+  for(int i = 0; i < 3; ++i)
+  {
+    a2 += (P2[i] - P3[i]) * (P2[i] - P3[i]);
+    b2 += (P1[i] - P3[i]) * (P1[i] - P3[i]);
+    c2 += (P1[i] - P2[i]) * (P1[i] - P2[i]);
+  }
+  if(a2 == 0 || b2 == 0 || c2 == 0) return 0;
+
+  // cosines of the angles between the rays
+  const double ca = f2[0] * f3[0] + f2[1] * f3[1] + f2[2] * f3[2];
+  const double cb = f1[0] * f3[0] + f1[1] * f3[1] + f1[2] * f3[2];
+  const double cg = f1[0] * f2[0] + f1[1] * f2[1] + f1[2] * f2[2];
+
+  // quartic in v = s3 / s1
+  const double amc = (a2 - c2) / b2, apc = (a2 + c2) / b2;
+  const double bmc = (b2 - c2) / b2, bma = (b2 - a2) / b2;
+
+  double A[5];
+  A[0] = (amc - 1) * (amc - 1) - 4 * c2 / b2 * ca * ca;
+  A[1] = 4 * (amc * (1 - amc) * cb - (1 - apc) * ca * cg +
+    2 * c2 / b2 * ca * ca * cb);
+  A[2] = 2 * (amc * amc - 1 + 2 * amc * amc * cb * cb + 2 * bmc * ca * ca -
+    4 * apc * ca * cb * cg + 2 * bma * cg * cg);
+  A[3] = 4 * (-amc * (1 + amc) * cb + 2 * a2 / b2 * cg * cg * cb -
+    (1 - apc) * ca * cg);
+  A[4] = (1 + amc) * (1 + amc) - 4 * a2 / b2 * cg * cg;
+
+  double roots[4];
+  const int nr = realRoots(A, 4, roots);
+
+  int n = 0;
+  for(int r = 0; r < nr; ++r)
+  {
+    const double v = roots[r];
+    const double den = 2 * (cg - v * ca);
+    if(v <= 0 || den == 0) continue;
+
+    const double u = ((amc - 1) * v * v - 2 * amc * cb * v + 1 + amc) / den;
+    if(u <= 0) continue;
+
+    const double s1_2 = b2 / (1 + v * v - 2 * v * cb);
+    if(s1_2 <= 0) continue;
+
+    const double s1 = std::sqrt(s1_2), s2 = u * s1, s3 = v * s1;
+
+    // points in the camera frame
+    const double Q[9] = { s1 * f1[0], s1 * f1[1], s1 * f1[2],
+      s2 * f2[0], s2 * f2[1], s2 * f2[2], s3 * f3[0], s3 * f3[1], s3 * f3[2] };
+
+    absoluteOrientation(P, Q, 3, R + 9 * n, t + 3 * n);
+    ++n;
+  }
+
+  return n;
+}
+
+// --------------------------------------------------------------------------
+
+} // namespace P3P
+
+// --------------------------------------------------------------------------
+
+/// Estimates the pose of a calibrated camera from correspondences between
+/// known 3D points and its keypoints with RANSAC. Hypotheses come from the
+/// P3P solver and are scored by their number of inliers (reprojection 
+/// error). The best pose is refined with all its inliers by Gauss-Newton
+class PoseSolver
+{
+public:
+
+  /// Size of the minimal samples
+  static const int SAMPLE = 3;
+
+  /**
+   * Creates a solver for a camera with unit focal lengths
+   */
+  PoseSolver(): m_seed(0), m_fx(1), m_fy(1), m_cx(0), m_cy(0) {}
+
+  /**
+   * Sets the intrinsic parameters of the camera
+   * @param fx focal length in x (pixels)
+   * @param fy focal length in y (pixels)
+   * @param cx principal point x (pixels)
+   * @param cy principal point y (pixels)
+   */
+  inline void setCamera(double fx, double fy, double cx, double cy)
+  {
+    m_fx = fx; m_fy = fy; m_cx = cx; m_cy = cy;
+  }
+
+  /**
+   * Finds the pose (R, t) of the camera such that the points R * P + t
+   * project onto their keypoints x, supported by the largest number of
+   * correspondences
+   * @param P n points (x, y, z)
+   * @param x n keypoints (x, y) in pixels
+   * @param n number of correspondences
+   * @param max_error max reprojection error (pixels) of the inliers
+   * @param probability probability of finding the best pose required to
+   *   stop early
+   * @param max_iterations max number of samples
+   * @param R (out) rotation (row-major), if any inlier
+   * @param t (out) translation, if any inlier
+   * @param status (out) if not NULL, n flags set to 1 for the inliers
+   * @return number of inliers of the pose (0 if there are fewer than 3
+   *   correspondences)
+   */
+  int solve(const float *P, const float *x, int n, double max_error,
+    double probability, int max_iterations, double *R, double *t,
+    std::vector<unsigned char> *status);
+
+  /**
+   * Returns the memory held by the solver
+   * @return bytes
+   */
+  inline size_t capacity() const
+  {
+    return m_f.capacity() * sizeof(double) + m_sample.capacity() * 
+      sizeof(int) + m_inliers.capacity();
+  }
+
+protected:
+
+  /**
+   * Counts the correspondences that a pose reprojects close enough
+   * @param R rotation
+   * @param t translation
+   * @param max_error2 squared max reprojection error
+   * @param inliers (out) if not NULL, n inlier flags
+   * @return number of inliers
+   */
+  int countInliers(const double *R, const double *t, double max_error2,
+    unsigned char *inliers) const;
+
+  /**
+   * Refines a pose by minimizing the reprojection error of some 
+   * correspondences with Gauss-Newton
+   * @param idx indices of the correspondences
+   * @param m number of correspondences (>= 3)
+   * @param R (in/out) rotation
+   * @param t (in/out) translation
+   * @return false if the system is degenerate
+   */
+  bool refine(const int *idx, int m, double *R, double *t) const;
+
+  /**
+   * Returns a random number
+   * @return number
+   */
+  inline uint64_t random()
+  {
+    // xorshift64*
+    m_seed ^= m_seed >> 12;
+    m_seed ^= m_seed << 25;
+    m_seed ^= m_seed >> 27;
+    return m_seed * 2685821657736338717ULL;
+  }
+
+protected:
+
+  /// State of the random generator
+  uint64_t m_seed;
+  /// Intrinsic parameters of the camera
+  double m_fx, m_fy, m_cx, m_cy;
+
+  /// Points of the current problem
+  const float *m_P;
+  /// Keypoints of the current problem
+  const float *m_x;
+  /// Number of correspondences of the current problem
+  int m_n;
+
+  /// Unit bearing vectors of the keypoints (x, y, z)
+  std::vector<double> m_f;
+  /// Inliers to refine with
+  std::vector<int> m_sample;
+  /// Inlier flags
+  std::vector<unsigned char> m_inliers;
+};
+
+// --------------------------------------------------------------------------
+
+inline int PoseSolver::solve(const float *P, const float *x, int n, 
+  double max_error, double probability, int max_iterations, double *R, 
+  double *t, std::vector<unsigned char> *status)
+{
+  if(status) status->assign(n, 0);
+  if(n < SAMPLE) return 0;
+
+  m_P = P; m_x = x; m_n = n;
+
+  // K^-1 * x, normalized
+  m_f.resize(3 * n);
+  for(int k = 0; k < n; ++k)
+  {
+    const double u = (x[2 * k] - m_cx) / m_fx;
+    const double v = (x[2 * k + 1] - m_cy) / m_fy;
+    const double s = 1. / std::sqrt(u * u + v * v + 1);
+    m_f[3 * k] = u * s; m_f[3 * k + 1] = v * s; m_f[3 * k + 2] = s;
+  }
+  m_sample.resize(n);
+  m_inliers.resize(n);
+
+  const double max_error2 = max_error * max_error;
+
+  m_seed = 0x9E3779B97F4A7C15ULL; // repeatable results
+
+  int best = 0;
+  int k_max = max_iterations;
+
+  for(int it = 0; it < k_max; ++it)
+  {
+    int s[SAMPLE];
+    int m = 0;
+    while(m < SAMPLE)
+    {
+      const int i = (int)(random() % n);
+      if(std::find(s, s + m, i) == s + m) s[m++] = i;
+    }
+
+    double f[9], Ps[9];
+    for(int k = 0; k < SAMPLE; ++k)
+      for(int i = 0; i < 3; ++i)
+      {
+        f[3 * k + i] = m_f[3 * s[k] + i];
+        Ps[3 * k + i] = P[3 * s[k] + i];
+      }
+
+    double Rh[4 * 9], th[4 * 3];
+    const int nh = P3P::solve(f, Ps, Rh, th);
+
+    for(int h = 0; h < nh; ++h)
+    {
+      const int count = countInliers(Rh + 9 * h, th + 3 * h, max_error2, 
+        NULL);
+      if(count > best)
+      {
+        best = count;
+        std::copy(Rh + 9 * h, Rh + 9 * h + 9, R);
+        std::copy(th + 3 * h, th + 3 * h + 3, t);
+
+        const double w = double(count) / n;
+        const double p_good = w * w * w;
+        if(p_good >= 1) k_max = it + 1;
+        else
+        {
+          const double k = std::log(1 - probability) / std::log(1 - p_good);
+          if(k < k_max) k_max = std::max(it + 1, (int)std::ceil(k));
+        }
+      }
+    }
+  }
+
+  if(best == 0) return 0;
+
+  // refine with all the inliers
+  countInliers(R, t, max_error2, &m_inliers[0]);
+
+  int m = 0;
+  for(int k = 0; k < n; ++k) if(m_inliers[k]) m_sample[m++] = k;
+
+  double Rr[9], tr[3];
+  std::copy(R, R + 9, Rr);
+  std::copy(t, t + 3, tr);
+
+  if(m > SAMPLE && refine(&m_sample[0], m, Rr, tr))
+  {
+    const int refined = countInliers(Rr, tr, max_error2, NULL);
+    if(refined >= best)
+    {
+      best = refined;
+      std::copy(Rr, Rr + 9, R);
+      std::copy(tr, tr + 3, t);
+      countInliers(R, t, max_error2, &m_inliers[0]);
+    }
+  }
+
+  if(status) status->assign(m_inliers.begin(), m_inliers.end());
+
+  return best;
+}
+
+// --------------------------------------------------------------------------
+
+inline int PoseSolver::countInliers(const double *R, const double *t,
+  double max_error2, unsigned char *inliers) const
+{
+  int count = 0;
+  for(int k = 0; k < m_n; ++k)
+  {
+    const float *P = m_P + 3 * k;
+    const double X = R[0] * P[0] + R[1] * P[1] + R[2] * P[2] + t[0];
+    const double Y = R[3] * P[0] + R[4] * P[1] + R[5] * P[2] + t[1];
+    const double Z = R[6] * P[0] + R[7] * P[1] + R[8] * P[2] + t[2];
+
+    bool in = false;
+    if(Z > 0)
+    {
+      const double du = m_fx * X / Z + m_cx - m_x[2 * k];
+      const double dv = m_fy * Y / Z + m_cy - m_x[2 * k + 1];
+      in = (du * du + dv * dv <= max_error2);
+    }
+
+    if(inliers) inliers[k] = in;
+    count += in;
+  }
+  return count;
+}
+
+// --------------------------------------------------------------------------
+
+inline bool PoseSolver::refine(const int *idx, int m, double *R, 
+  double *t) const
+{
+  for(int it = 0; it < 5; ++it)
+  {
+    // normal equations of the update (w, dt): R <- exp([w]x) R, t <- t + dt
+    double A[36], b[6];
+    std::fill(A, A + 36, 0.);
+    std::fill(b, b + 6, 0.);
+
+    for(int k = 0; k < m; ++k)
+    {
+      const float *P = m_P + 3 * idx[k];
+      const double Y[3] = { 
+        R[0] * P[0] + R[1] * P[1] + R[2] * P[2],
+        R[3] * P[0] + R[4] * P[1] + R[5] * P[2],
+        R[6] * P[0] + R[7] * P[1] + R[8] * P[2] };
+      const double X[3] = { Y[0] + t[0], Y[1] + t[1], Y[2] + t[2] };
+      if(X[2] <= 0) continue;
+
+      const double iz = 1. / X[2];
+      const double r[2] = { 
+        m_x[2 * idx[k]] - (m_fx * X[0] * iz + m_cx),
+        m_x[2 * idx[k] + 1] - (m_fy * X[1] * iz + m_cy) };
+
+      // d(u, v)/dX, and dX/d(w, dt) = [-[Y]x I]
+      const double du[3] = { m_fx * iz, 0, -m_fx * X[0] * iz * iz };
+      const double dv[3] = { 0, m_fy * iz, -m_fy * X[1] * iz * iz };
+      const double *d[2] = { du, dv };
+
+      for(int e = 0; e < 2; ++e)
+      {
+        const double *g = d[e];
+        // g' * (-[Y]x) = (Y x g)'
+        const double J[6] = { 
+          Y[1] * g[2] - Y[2] * g[1], 
+          Y[2] * g[0] - Y[0] * g[2],
+          Y[0] * g[1] - Y[1] * g[0],
+          g[0], g[1], g[2] };
+
+        for(int i = 0; i < 6; ++i)
+        {
+          b[i] += J[i] * r[e];
+          for(int j = 0; j < 6; ++j) A[i * 6 + j] += J[i] * J[j];
+        }
+      }
+    }
+
+    if(!Linear::solve(A, b, 6)) return false;
+
+    // Rodrigues
+    const double th = std::sqrt(b[0] * b[0] + b[1] * b[1] + b[2] * b[2]);
+    double dR[9] = { 1, 0, 0, 0, 1, 0, 0, 0, 1 };
+    if(th > 0)
+    {
+      const double k[3] = { b[0] / th, b[1] / th, b[2] / th };
+      const double c = std::cos(th), s = std::sin(th), v = 1 - c;
+      dR[0] = c + k[0] * k[0] * v; 
+      dR[1] = k[0] * k[1] * v - k[2] * s;
+      dR[2] = k[0] * k[2] * v + k[1] * s;
+      dR[3] = k[1] * k[0] * v + k[2] * s;
+      dR[4] = c + k[1] * k[1] * v;
+      dR[5] = k[1] * k[2] * v - k[0] * s;
+      dR[6] = k[2] * k[0] * v - k[1] * s;
+      dR[7] = k[2] * k[1] * v + k[0] * s;
+      dR[8] = c + k[2] * k[2] * v;
+    }
+
+    double R2[9];
+    for(int r = 0; r < 3; ++r)
+      for(int c = 0; c < 3; ++c)
+        R2[r * 3 + c] = dR[r * 3] * R[c] + dR[r * 3 + 1] * R[3 + c] +
+          dR[r * 3 + 2] * R[6 + c];
+
+    std::copy(R2, R2 + 9, R);
+    t[0] += b[3]; t[1] += b[4]; t[2] += b[5];
+
+    if(th < 1e-10) break;
+  }
+
+  return R[0] == R[0] && t[0] == t[0];
+}
+
+// --------------------------------------------------------------------------
+
+} // namespace DLoopDetector
+
+#endif
@@ -0,0 +1,298 @@
+/**
+ * File: PackedStore.h
+ * Date: October 2026
+ * Author: agent
+ * Description: append-only storage of variable-length entries packed in
+ *   contiguous slabs
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_PACKED_STORE__
+#define __D_T_PACKED_STORE__
+
+#include <vector>
+#include <deque>
+#include <cstddef>
+
+namespace DLoopDetector {
+
+/// T: class of the elements
+template<class T>
+/// Read-only view of a contiguous range of elements
+class Span
+{
+public:
+
+  typedef const T* const_iterator;
+
+  /**
+   * Creates an empty span
+   */
+  Span(): m_data(NULL), m_size(0) {}
+
+  /**
+   * Creates a span of n elements starting at data
+   * @param data
+   * @param n
+   */
+  Span(const T *data, size_t n): m_data(data), m_size(n) {}
+
+  /**
+   * Creates a span with all the elements of a vector
+   * @param v
+   */
+  Span(const std::vector<T> &v):
+    m_data(v.empty() ? NULL : &v[0]), m_size(v.size()) {}
+
+  inline size_t size() const { return m_size; }
+  inline bool empty() const { return m_size == 0; }
+  inline const T* data() const { return m_data; }
+  inline const_iterator begin() const { return m_data; }
+  inline const_iterator end() const { return m_data + m_size; }
+  inline const T& operator[](size_t i) const { return m_data[i]; }
+
+protected:
+
+  /// First element
+  const T *m_data;
+  /// Number of elements
+  size_t m_size;
+};
+
+// --------------------------------------------------------------------------
+
+/// T: class of the elements
+template<class T>
+/// Stores a sequence of entries (e.g. the descriptors of each image) packed
+/// in large slabs. The elements of an entry are contiguous, slabs are never
+/// reallocated and entries are indexed by a small offset table
+class PackedStore
+{
+public:
+
+  /**
+   * Creates an empty store
+   * @param slab_size number of elements of each slab. If 0, slabs of
+   *   about 1 MB are used
+   */
+  PackedStore(size_t slab_size = 0);
+
+  /**
+   * Returns the number of entries
+   * @return number of entries
+   */
+  inline size_t size() const { return m_entries.size(); }
+
+  /**
+   * Returns the elements of an entry
+   * @param i entry index
+   * @return view of the elements
+   */
+  inline Span<T> operator[](size_t i) const
+  {
+    const tEntry &e = m_entries[i];
+    return e.size == 0 ? Span<T>() :
+      Span<T>(&m_slabs[e.slab][e.offset], e.size);
+  }
+
+  /**
+   * Sets the elements of an entry. If i == size(), the entry is appended.
+   * If i < size(), the entry is replaced and its previous space is not
+   * reused until the store is cleared
+   * @param i entry index (<= size())
+   * @param v elements
+   */
+  void set(size_t i, const std::vector<T> &v);
+
+  /**
+   * Allocates n default-constructed elements for an entry, as set does,
+   * and returns them to be filled in
+   * @param i entry index (<= size())
+   * @param n number of elements
+   * @return pointer to the first element, NULL if n == 0
+   */
+  T* assign(size_t i, size_t n);
+
+  /**
+   * Reserves space for the expected number of entries and elements
+   * @param nentries number of entries
+   * @param nelements total number of elements
+   */
+  void reserve(size_t nentries, size_t nelements = 0);
+
+  /**
+   * Removes all the entries. The slabs are kept to be reused
+   */
+  void clear();
+
+  /**
+   * Returns the number of elements allocated in the slabs
+   * @return capacity in elements
+   */
+  size_t capacity() const;
+
+protected:
+
+  /// Location of an entry
+  struct tEntry
+  {
+    /// Slab index
+    unsigned int slab;
+    /// Offset of the first element in the slab
+    unsigned int offset;
+    /// Number of elements
+    unsigned int size;
+  };
+
+  /**
+   * Returns a range of n contiguous elements, adding a slab if necessary
+   * @param n number of elements
+   * @param e (out) location of the range
+   */
+  void allocate(size_t n, tEntry &e);
+
+protected:
+
+  /// Slabs. Their capacity is fixed when they are created, so that
+  /// elements are never moved
+  std::deque<std::vector<T> > m_slabs;
+  /// Slab being filled
+  size_t m_current;
+  /// Entries
+  std::vector<tEntry> m_entries;
+  /// Default number of elements of a slab
+  size_t m_slab_size;
+};
+
+// --------------------------------------------------------------------------
+
+template<class T>
+PackedStore<T>::PackedStore(size_t slab_size)
+  : m_current(0), m_slab_size(slab_size)
+{
+  if(m_slab_size == 0)
+  {
+    m_slab_size = (1 << 20) / sizeof(T);
+    if(m_slab_size == 0) m_slab_size = 1;
+  }
+}
+
+// --------------------------------------------------------------------------
+
+template<class T>
+void PackedStore<T>::set(size_t i, const std::vector<T> &v)
+{
+  tEntry e;
+  allocate(v.size(), e);
+
+  if(!v.empty())
+  {
+    std::vector<T> &slab = m_slabs[e.slab];
+    slab.insert(slab.end(), v.begin(), v.end()); // within capacity
+  }
+
+  if(i == m_entries.size())
+    m_entries.push_back(e);
+  else
+    m_entries[i] = e;
+}
+
+// --------------------------------------------------------------------------
+
+template<class T>
+T* PackedStore<T>::assign(size_t i, size_t n)
+{
+  tEntry e;
+  allocate(n, e);
+
+  T *p = NULL;
+  if(n > 0)
+  {
+    std::vector<T> &slab = m_slabs[e.slab];
+    slab.resize(slab.size() + n); // within capacity
+    p = &slab[e.offset];
+  }
+
+  if(i == m_entries.size())
+    m_entries.push_back(e);
+  else
+    m_entries[i] = e;
+
+  return p;
+}
+
+// --------------------------------------------------------------------------
+
+template<class T>
+void PackedStore<T>::allocate(size_t n, tEntry &e)
+{
+  e.size = n;
+
+  if(n == 0)
+  {
+    e.slab = e.offset = 0;
+    return;
+  }
+
+  // look for a slab with enough room, from the current one on
+  while(m_current < m_slabs.size() &&
+    m_slabs[m_current].capacity() - m_slabs[m_current].size() < n)
+  {
+    ++m_current;
+  }
+
+  if(m_current == m_slabs.size())
+  {
+    m_slabs.push_back(std::vector<T>());
+    m_slabs.back().reserve(n > m_slab_size ? n : m_slab_size);
+  }
+
+  e.slab = m_current;
+  e.offset = m_slabs[m_current].size();
+}
+
+// --------------------------------------------------------------------------
+
+template<class T>
+void PackedStore<T>::reserve(size_t nentries, size_t nelements)
+{
+  m_entries.reserve(nentries);
+
+  const size_t cap = capacity();
+  if(nelements > cap)
+  {
+    m_slabs.push_back(std::vector<T>());
+    m_slabs.back().reserve(nelements - cap > m_slab_size ?
+      nelements - cap : m_slab_size);
+  }
+}
+
+// --------------------------------------------------------------------------
+
+template<class T>
+void PackedStore<T>::clear()
+{
+  m_entries.clear();
+  for(size_t i = 0; i < m_slabs.size(); ++i)
+  {
+    m_slabs[i].clear(); // keeps the capacity
+  }
+  m_current = 0;
+}
+
+// --------------------------------------------------------------------------
+
+template<class T>
+size_t PackedStore<T>::capacity() const
+{
+  size_t n = 0;
+  for(size_t i = 0; i < m_slabs.size(); ++i) n += m_slabs[i].capacity();
+  return n;
+}
+
+// --------------------------------------------------------------------------
+
+} // namespace DLoopDetector
+
+#endif
@@ -0,0 +1,645 @@
+/**
+ * File: ProsacSolver.h
+ * Date: October 2026
+ * Author: agent
+ * Description: robust estimation of fundamental and essential matrices 
+ *   with PROSAC
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_PROSAC_SOLVER__
+#define __D_T_PROSAC_SOLVER__
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+
+#include "Epipolar.h"
+#include "FivePoint.h"
+#include "Linear.h"
+#include "WorkerPool.h"
+
+namespace DLoopDetector {
+
+/// Estimates the fundamental matrix of a set of correspondences with
+/// PROSAC (Chum and Matas, 2005): the minimal samples are drawn from a
+/// growing set of the best correspondences first, so that good hypotheses
+/// appear early, and the search stops as soon as the probability of having
+/// missed a better model is low enough. Hypotheses come from the normalized
+/// 8-point algorithm, or from the 5-point algorithm if the camera is 
+/// calibrated, and are scored by their number of inliers (Sampson
+/// distance), which are counted with SIMD code. The samples are drawn in
+/// the calling thread, and the hypotheses can be fitted and scored in
+/// several threads with the same result. The best model is refined with
+/// all its inliers
+class ProsacSolver
+{
+public:
+
+  /// Max size of the minimal samples
+  static const int SAMPLE = 8;
+
+  /**
+   * Creates a solver of fundamental matrices that scores the hypotheses in
+   * the calling thread
+   */
+  ProsacSolver(): m_pool(NULL), m_seed(0), m_essential(false), 
+    m_sample_size(SAMPLE) {}
+
+  /**
+   * Estimates fundamental matrices from 8 correspondences (uncalibrated
+   * camera)
+   */
+  inline void useFundamental()
+  {
+    m_essential = false;
+    m_sample_size = SAMPLE;
+  }
+
+  /**
+   * Estimates essential matrices from 5 correspondences of a calibrated
+   * camera, the same for both images. The models are still returned as the
+   * fundamental matrices K^-T * E * K^-1 in pixels. Invalid intrinsics
+   * (fx or fy <= 0) are rejected, and fundamental matrices are estimated
+   * instead
+   * @param fx focal length in x (pixels)
+   * @param fy focal length in y (pixels)
+   * @param cx principal point x (pixels)
+   * @param cy principal point y (pixels)
+   * @return true iff essential matrices are estimated
+   */
+  inline bool useEssential(double fx, double fy, double cx, double cy)
+  {
+    if(!(fx > 0 && fy > 0))
+    {
+      useFundamental();
+      return false;
+    }
+    
+    m_essential = true;
+    m_sample_size = 5;
+    m_fx = fx; m_fy = fy; m_cx = cx; m_cy = cy;
+    return true;
+  }
+
+  /**
+   * Sets the workers to fit and score the hypotheses with. The pool is not
+   * owned by the solver, and must not run other jobs while it solves
+   * @param pool workers (NULL to use only the calling thread)
+   */
+  inline void setPool(WorkerPool *pool) { m_pool = pool; }
+
+  /**
+   * Finds the fundamental matrix F with x2' * F * x1 = 0 supported by the
+   * largest number of correspondences x1 <-> x2
+   * @param p1 n points (x, y) of image 1
+   * @param p2 n points (x, y) of image 2
+   * @param n number of correspondences
+   * @param order indices of the correspondences sorted by quality, the
+   *   best first. If NULL, the samples are drawn uniformly from all of them
+   *   (RANSAC)
+   * @param max_error max Sampson distance (pixels) of the inliers
+   * @param probability probability of finding the best model required to
+   *   stop early
+   * @param max_iterations max number of hypotheses
+   * @param F (out) fundamental matrix (row-major), if any inlier
+   * @param status (out) if not NULL, n flags set to 1 for the inliers
+   * @return number of inliers of F (0 if there are fewer correspondences 
+   *   than the size of the minimal samples)
+   */
+  int solve(const float *p1, const float *p2, int n,
+    const unsigned int *order, double max_error, double probability,
+    int max_iterations, double *F, std::vector<unsigned char> *status);
+
+  /**
+   * Returns the memory held by the solver
+   * @return bytes
+   */
+  inline size_t capacity() const
+  {
+    return (m_x1.capacity() + m_y1.capacity() + m_x2.capacity() +
+      m_y2.capacity()) * sizeof(float) +
+      (m_n1.capacity() + m_n2.capacity() + m_hypotheses.capacity()) *
+        sizeof(double) +
+      (m_counts.capacity() + m_sample.capacity() + m_samples.capacity() +
+       m_subs.capacity()) * sizeof(int) +
+      m_inliers.capacity();
+  }
+
+protected:
+
+  /**
+   * Fits a fundamental matrix to some correspondences with the normalized
+   * 8-point algorithm (least squares if there are more than 8). In 
+   * essential mode, the closest essential matrix is taken instead
+   * @param idx indices of the correspondences (sorted order)
+   * @param m number of correspondences (>= 8)
+   * @param F (out) fundamental matrix of rank 2 in pixel coordinates
+   * @return false if the correspondences are degenerate
+   */
+  bool fit(const int *idx, int m, double *F) const;
+
+  /**
+   * Fits the essential matrices of a minimal sample with the 5-point 
+   * algorithm and keeps the one with most inliers
+   * @param idx 5 indices of correspondences (sorted order)
+   * @param max_error max Sampson distance
+   * @param F (out) best model in pixel coordinates
+   * @return number of inliers of F, -1 if there is no solution
+   */
+  int fitEssential(const int *idx, double max_error, double *F) const;
+
+  /**
+   * Transforms a matrix of normalized coordinates into pixels
+   * @param Fn matrix with x2n' * Fn * x1n = 0
+   * @param F (out) matrix with x2' * F * x1 = 0
+   * @return false if F is null or not finite
+   */
+  bool denormalize(const double *Fn, double *F) const;
+
+  /**
+   * Fits and scores the hypotheses of the samples in m_samples, in 
+   * parallel if there is a pool of several workers
+   * @param nh number of samples
+   * @param max_error max Sampson distance
+   */
+  void score(int nh, double max_error);
+
+  /**
+   * Fits and scores one hypothesis
+   * @param h index of its sample in m_samples
+   * @param max_error max Sampson distance
+   */
+  inline void scoreOne(int h, double max_error)
+  {
+    double *F = &m_hypotheses[9 * h];
+    if(m_essential)
+      m_counts[h] = fitEssential(&m_samples[SAMPLE * h], max_error, F);
+    else
+      m_counts[h] = (fit(&m_samples[SAMPLE * h], SAMPLE, F) ?
+        Epipolar::countInliers(F, &m_x1[0], &m_y1[0], &m_x2[0], &m_y2[0], 
+          (int)m_x1.size(), max_error) : -1);
+  }
+
+  /**
+   * Draws the next minimal sample of PROSAC
+   * @param n size of the current set of best correspondences
+   * @param last_fixed if true, correspondence n-1 is always in the sample
+   * @param sample (out) indices, as many as the size of the minimal 
+   *   samples
+   */
+  void drawSample(int n, bool last_fixed, int *sample);
+
+  /**
+   * Computes the number of iterations after which the best model so far
+   * is found with the required probability. The inlier ratio of each set
+   * of best correspondences (at least as large as the sampled one) is 
+   * considered, and the smallest number is returned. Sets with so few 
+   * inliers that a wrong model could explain them are skipped
+   * @param F best model
+   * @param sub size of the set of best correspondences being sampled
+   * @param max_error max Sampson distance
+   * @param probability required probability
+   * @return number of iterations
+   */
+  double requiredIterations(const double *F, int sub, double max_error, 
+    double probability);
+
+  /**
+   * Returns a random number
+   * @return number
+   */
+  inline uint64_t random()
+  {
+    // xorshift64*
+    m_seed ^= m_seed >> 12;
+    m_seed ^= m_seed << 25;
+    m_seed ^= m_seed >> 27;
+    return m_seed * 2685821657736338717ULL;
+  }
+
+protected:
+
+  /// Workers of the batches (NULL: the calling thread only)
+  WorkerPool *m_pool;
+  /// State of the random generator
+  uint64_t m_seed;
+  /// Whether essential matrices are estimated
+  bool m_essential;
+  /// Size of the minimal samples (8 or 5)
+  int m_sample_size;
+  /// Intrinsic parameters of the camera in essential mode
+  double m_fx, m_fy, m_cx, m_cy;
+
+  /// Coordinates in order of quality
+  std::vector<float> m_x1, m_y1, m_x2, m_y2;
+  /// Normalized coordinates (x, y) in order of quality
+  std::vector<double> m_n1, m_n2;
+  /// Normalizing transformations (x' = sx * (x - cx), y' = sy * (y - cy))
+  double m_sx1, m_sy1, m_cx1, m_cy1, m_sx2, m_sy2, m_cx2, m_cy2;
+
+  /// Hypotheses to score (9 values each)
+  std::vector<double> m_hypotheses;
+  /// Samples of the hypotheses (SAMPLE indices each)
+  std::vector<int> m_samples;
+  /// Size of the set of best correspondences of each sample
+  std::vector<int> m_subs;
+  /// Number of inliers of each hypothesis (-1 if it is degenerate)
+  std::vector<int> m_counts;
+  /// Inliers to refine with
+  std::vector<int> m_sample;
+  /// Inlier flags in order of quality
+  std::vector<unsigned char> m_inliers;
+};
+
+// --------------------------------------------------------------------------
+
+inline int ProsacSolver::solve(const float *p1, const float *p2, int n,
+  const unsigned int *order, double max_error, double probability,
+  int max_iterations, double *F, std::vector<unsigned char> *status)
+{
+  const int S = m_sample_size;
+
+  if(status) status->assign(n, 0);
+  if(n < S) return 0;
+
+  // correspondences in order of quality
+  m_x1.resize(n); m_y1.resize(n); m_x2.resize(n); m_y2.resize(n);
+  m_n1.resize(2 * n); m_n2.resize(2 * n);
+
+  for(int k = 0; k < n; ++k)
+  {
+    const unsigned int i = (order ? order[k] : k);
+    m_x1[k] = p1[2 * i]; m_y1[k] = p1[2 * i + 1];
+    m_x2[k] = p2[2 * i]; m_y2[k] = p2[2 * i + 1];
+  }
+
+  if(m_essential)
+  {
+    // normalized camera coordinates, K^-1 * x
+    m_sx1 = m_sx2 = 1. / m_fx;
+    m_sy1 = m_sy2 = 1. / m_fy;
+    m_cx1 = m_cx2 = m_cx;
+    m_cy1 = m_cy2 = m_cy;
+  }
+  else
+  {
+    // centroid at 0 and mean distance to it sqrt(2)
+    double mx1 = 0, my1 = 0, mx2 = 0, my2 = 0;
+    for(int k = 0; k < n; ++k)
+    {
+      mx1 += m_x1[k]; my1 += m_y1[k]; mx2 += m_x2[k]; my2 += m_y2[k];
+    }
+    m_cx1 = mx1 / n; m_cy1 = my1 / n; m_cx2 = mx2 / n; m_cy2 = my2 / n;
+
+    double d1 = 0, d2 = 0;
+    for(int k = 0; k < n; ++k)
+    {
+      d1 += std::sqrt((m_x1[k] - m_cx1) * (m_x1[k] - m_cx1) +
+        (m_y1[k] - m_cy1) * (m_y1[k] - m_cy1));
+      d2 += std::sqrt((m_x2[k] - m_cx2) * (m_x2[k] - m_cx2) +
+        (m_y2[k] - m_cy2) * (m_y2[k] - m_cy2));
+    }
+    m_sx1 = m_sy1 = (d1 > 0 ? std::sqrt(2.) * n / d1 : 1);
+    m_sx2 = m_sy2 = (d2 > 0 ? std::sqrt(2.) * n / d2 : 1);
+  }
+
+  for(int k = 0; k < n; ++k)
+  {
+    m_n1[2 * k] = m_sx1 * (m_x1[k] - m_cx1);
+    m_n1[2 * k + 1] = m_sy1 * (m_y1[k] - m_cy1);
+    m_n2[2 * k] = m_sx2 * (m_x2[k] - m_cx2);
+    m_n2[2 * k + 1] = m_sy2 * (m_y2[k] - m_cy2);
+  }
+
+  // with several workers, hypotheses are scored in batches
+  const int workers = (m_pool ? m_pool->size() : 1);
+  const int batch = (workers > 1 ? 16 * workers : 1);
+  m_hypotheses.resize(9 * batch);
+  m_samples.resize(SAMPLE * batch);
+  m_subs.resize(batch);
+  m_counts.resize(batch);
+  m_sample.resize(n);
+  m_inliers.resize(n);
+
+  // PROSAC growth function: T_n is the expected number of samples drawn
+  // only from the n best correspondences after T_N samples in total
+  double Tn = max_iterations;
+  for(int i = 0; i < S; ++i) Tn *= double(S - i) / (n - i);
+  // size of the current set of best correspondences; all of them if there
+  // is no order
+  int sub = (order ? S : n);
+  double Tn_prime = 1;
+
+  m_seed = 0x9E3779B97F4A7C15ULL; // repeatable results
+
+  int best = 0;
+  int k_max = max_iterations;
+  int t = 0;
+
+  while(t < k_max)
+  {
+    const int t0 = t;
+    int nh = 0;
+    while(nh < batch && t < k_max)
+    {
+      ++t;
+      if(t > Tn_prime && sub < n)
+      {
+        const double Tn1 = Tn * (sub + 1) / (sub + 1 - S);
+        Tn_prime += std::ceil(Tn1 - Tn);
+        Tn = Tn1;
+        ++sub;
+      }
+
+      drawSample(sub, order && Tn_prime >= t, &m_samples[SAMPLE * nh]);
+      m_subs[nh] = sub;
+      ++nh;
+    }
+
+    score(nh, max_error);
+
+    // the batch is processed as if one hypothesis were scored at a time,
+    // so that the result does not depend on the number of threads
+    for(int h = 0; h < nh && t0 + h < k_max; ++h)
+    {
+      if(m_counts[h] > best)
+      {
+        best = m_counts[h];
+        std::copy(&m_hypotheses[9 * h], &m_hypotheses[9 * h] + 9, F);
+        
+        const double k = requiredIterations(F, m_subs[h], max_error, 
+          probability);
+        if(k < k_max) k_max = std::max(t0 + h + 1, (int)std::ceil(k));
+      }
+    }
+    
+    t = std::min(t, k_max);
+  }
+
+  if(best == 0) return 0;
+
+  // refine with all the inliers
+  Epipolar::countInliers(F, &m_x1[0], &m_y1[0], &m_x2[0], &m_y2[0], n,
+    max_error, &m_inliers[0]);
+
+  int m = 0;
+  for(int k = 0; k < n; ++k) if(m_inliers[k]) m_sample[m++] = k;
+
+  if(m > SAMPLE && fit(&m_sample[0], m, &m_hypotheses[0]))
+  {
+    const int refined = Epipolar::countInliers(&m_hypotheses[0], &m_x1[0],
+      &m_y1[0], &m_x2[0], &m_y2[0], n, max_error);
+    if(refined >= best)
+    {
+      best = refined;
+      std::copy(&m_hypotheses[0], &m_hypotheses[0] + 9, F);
+      Epipolar::countInliers(F, &m_x1[0], &m_y1[0], &m_x2[0], &m_y2[0], n,
+        max_error, &m_inliers[0]);
+    }
+  }
+
+  if(status)
+  {
+    for(int k = 0; k < n; ++k) (*status)[order ? order[k] : k] = 
+      m_inliers[k];
+  }
+
+  return best;
+}
+
+// --------------------------------------------------------------------------
+
+inline void ProsacSolver::drawSample(int n, bool last_fixed, int *sample)
+{
+  // the last correspondence of the set is always drawn when the set has
+  // just grown, so that the new samples include it
+  int m = 0;
+  if(last_fixed) sample[m++] = n - 1;
+
+  const int range = (last_fixed ? n - 1 : n);
+  while(m < m_sample_size)
+  {
+    const int i = (int)(random() % range);
+    if(std::find(sample, sample + m, i) == sample + m) sample[m++] = i;
+  }
+}
+
+// --------------------------------------------------------------------------
+
+inline double ProsacSolver::requiredIterations(const double *F, int sub, 
+  double max_error, double probability)
+{
+  const int n = (int)m_x1.size();
+  Epipolar::countInliers(F, &m_x1[0], &m_y1[0], &m_x2[0], &m_y2[0], n,
+    max_error, &m_inliers[0]);
+  
+  // all the samples so far were drawn from the best sub correspondences,
+  // so any larger set of best correspondences can be used
+  double k_min = 1e30;
+  int count = 0;
+  
+  for(int k = 0; k < n; ++k)
+  {
+    count += m_inliers[k];
+    if(k + 1 < sub) continue;
+    
+    // non-randomness: more inliers than a wrong model would have, if each
+    // correspondence agreed with it with probability 0.05 (normal 
+    // approximation of the binomial, 99%)
+    const double m = k + 1 - m_sample_size;
+    if(count < m_sample_size + 0.05 * m + 2.33 * std::sqrt(0.0475 * m)) 
+      continue;
+    
+    const double p_good = std::pow(double(count) / (k + 1), 
+      (double)m_sample_size);
+    
+    double its;
+    if(p_good >= 1) its = 0;
+    else if(p_good <= 0) continue;
+    else its = std::log(1 - probability) / std::log(1 - p_good);
+    
+    if(its < k_min) k_min = its;
+  }
+  
+  return k_min;
+}
+
+// --------------------------------------------------------------------------
+
+inline bool ProsacSolver::fit(const int *idx, int m, double *F) const
+{
+  // rows [x2 x1, x2 y1, x2, y2 x1, y2 y1, y2, x1, y1, 1] of A, A * f = 0
+  double Fn[9];
+
+  if(m == 8)
+  {
+    double A[8 * 9];
+    for(int k = 0; k < 8; ++k)
+    {
+      const double x1 = m_n1[2 * idx[k]], y1 = m_n1[2 * idx[k] + 1];
+      const double x2 = m_n2[2 * idx[k]], y2 = m_n2[2 * idx[k] + 1];
+      double *a = A + 9 * k;
+      a[0] = x2 * x1; a[1] = x2 * y1; a[2] = x2; 
+      a[3] = y2 * x1; a[4] = y2 * y1; a[5] = y2;
+      a[6] = x1; a[7] = y1; a[8] = 1;
+    }
+    
+    if(!Linear::nullSpace(A, 8, 9, 8, Fn)) return false;
+  }
+  else
+  {
+    // least squares: eigenvector of the smallest eigenvalue of A' * A
+    double AtA[81];
+    std::fill(AtA, AtA + 81, 0.);
+
+    for(int k = 0; k < m; ++k)
+    {
+      const double x1 = m_n1[2 * idx[k]], y1 = m_n1[2 * idx[k] + 1];
+      const double x2 = m_n2[2 * idx[k]], y2 = m_n2[2 * idx[k] + 1];
+      const double a[9] = { x2 * x1, x2 * y1, x2, y2 * x1, y2 * y1, y2,
+        x1, y1, 1 };
+
+      for(int i = 0; i < 9; ++i)
+        for(int j = i; j < 9; ++j)
+          AtA[i * 9 + j] += a[i] * a[j];
+    }
+    for(int i = 0; i < 9; ++i)
+      for(int j = 0; j < i; ++j)
+        AtA[i * 9 + j] = AtA[j * 9 + i];
+
+    double V[81], w[9];
+    Linear::jacobi(AtA, 9, V, w);
+
+    const int imin = (int)(std::min_element(w, w + 9) - w);
+    for(int i = 0; i < 9; ++i) Fn[i] = V[i * 9 + imin];
+  }
+
+  // right singular vectors of Fn, from the eigenvectors of Fn' * Fn
+  double FtF[9];
+  for(int i = 0; i < 3; ++i)
+    for(int j = 0; j < 3; ++j)
+      FtF[i * 3 + j] = Fn[i] * Fn[j] + Fn[3 + i] * Fn[3 + j] +
+        Fn[6 + i] * Fn[6 + j];
+
+  double U[9], s[3];
+  Linear::jacobi(FtF, 3, U, s);
+
+  double F2[9];
+  if(m_essential)
+  {
+    // essential: U * diag(1, 1, 0) * V' = Fn * sum(v v' / sigma) over the
+    // two largest singular values
+    const int smin = (int)(std::min_element(s, s + 3) - s);
+    std::fill(F2, F2 + 9, 0.);
+    for(int k = 0; k < 3; ++k)
+    {
+      if(k == smin) continue;
+      if(s[k] <= 0) return false;
+      const double sigma = std::sqrt(s[k]);
+      const double v[3] = { U[k], U[3 + k], U[6 + k] };
+      for(int r = 0; r < 3; ++r)
+      {
+        const double fv = (Fn[r * 3] * v[0] + Fn[r * 3 + 1] * v[1] +
+          Fn[r * 3 + 2] * v[2]) / sigma;
+        for(int c = 0; c < 3; ++c) F2[r * 3 + c] += fv * v[c];
+      }
+    }
+  }
+  else
+  {
+    // rank 2: Fn * (I - v v'), with v the right singular vector of the
+    // smallest singular value
+    const int smin = (int)(std::min_element(s, s + 3) - s);
+    const double v[3] = { U[smin], U[3 + smin], U[6 + smin] };
+    for(int r = 0; r < 3; ++r)
+    {
+      const double fv = Fn[r * 3] * v[0] + Fn[r * 3 + 1] * v[1] +
+        Fn[r * 3 + 2] * v[2];
+      for(int c = 0; c < 3; ++c) F2[r * 3 + c] = Fn[r * 3 + c] - fv * v[c];
+    }
+  }
+
+  return denormalize(F2, F);
+}
+
+// --------------------------------------------------------------------------
+
+inline int ProsacSolver::fitEssential(const int *idx, double max_error,
+  double *F) const
+{
+  double x1[10], x2[10];
+  for(int k = 0; k < 5; ++k)
+  {
+    x1[2 * k] = m_n1[2 * idx[k]]; x1[2 * k + 1] = m_n1[2 * idx[k] + 1];
+    x2[2 * k] = m_n2[2 * idx[k]]; x2[2 * k + 1] = m_n2[2 * idx[k] + 1];
+  }
+
+  double E[10 * 9];
+  const int ns = FivePoint::solve(x1, x2, E);
+
+  int best = -1;
+  for(int i = 0; i < ns; ++i)
+  {
+    double Fi[9];
+    if(!denormalize(E + 9 * i, Fi)) continue;
+
+    const int count = Epipolar::countInliers(Fi, &m_x1[0], &m_y1[0], 
+      &m_x2[0], &m_y2[0], (int)m_x1.size(), max_error);
+    if(count > best)
+    {
+      best = count;
+      std::copy(Fi, Fi + 9, F);
+    }
+  }
+  return best;
+}
+
+// --------------------------------------------------------------------------
+
+inline bool ProsacSolver::denormalize(const double *Fn, double *F) const
+{
+  // F = T2' * Fn * T1, with T = [sx 0 -sx cx; 0 sy -sy cy; 0 0 1]
+  const double T1[9] = { m_sx1, 0, -m_sx1 * m_cx1, 0, m_sy1, -m_sy1 * m_cy1,
+    0, 0, 1 };
+  const double T2[9] = { m_sx2, 0, -m_sx2 * m_cx2, 0, m_sy2, -m_sy2 * m_cy2,
+    0, 0, 1 };
+
+  double M[9];
+  for(int r = 0; r < 3; ++r)
+    for(int c = 0; c < 3; ++c)
+      M[r * 3 + c] = Fn[r * 3] * T1[c] + Fn[r * 3 + 1] * T1[3 + c] +
+        Fn[r * 3 + 2] * T1[6 + c];
+
+  double norm = 0;
+  for(int r = 0; r < 3; ++r)
+    for(int c = 0; c < 3; ++c)
+    {
+      F[r * 3 + c] = T2[r] * M[c] + T2[3 + r] * M[3 + c] +
+        T2[6 + r] * M[6 + c];
+      norm += F[r * 3 + c] * F[r * 3 + c];
+    }
+
+  return norm > 0 && norm == norm;
+}
+// --------------------------------------------------------------------------
+
+inline void ProsacSolver::score(int nh, double max_error)
+{
+  if(!m_pool || nh <= 1)
+  {
+    for(int h = 0; h < nh; ++h) scoreOne(h, max_error);
+    return;
+  }
+
+  // each hypothesis is written to its own slot
+  m_pool->run(nh, [this, max_error](int h, int) { scoreOne(h, max_error); });
+}
+
+// --------------------------------------------------------------------------
+
+} // namespace DLoopDetector
+
+#endif
@@ -0,0 +1,65 @@
+/**
+ * File: ReplicaDatabase.h
+ * Date: October 2026
+ * Author: agent
+ * Description: empty database that shares the vocabulary of another one
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_REPLICA_DATABASE__
+#define __D_T_REPLICA_DATABASE__
+
+#include <cstddef>
+
+#include <DBoW2/TemplatedVocabulary.h>
+#include <DBoW2/TemplatedDatabase.h>
+
+namespace DLoopDetector {
+
+/// TDescriptor: class of descriptor
+/// F: class of descriptor functions
+template<class TDescriptor, class F>
+/// Empty database with the direct index settings of another one, whose
+/// vocabulary it uses instead of a copy of its own. The other database
+/// must outlive it and keep its vocabulary
+class ReplicaDatabase: public DBoW2::TemplatedDatabase<TDescriptor, F>
+{
+public:
+
+  /**
+   * Creates an empty database
+   * @param db database whose vocabulary and direct index settings are used
+   */
+  explicit ReplicaDatabase(const DBoW2::TemplatedDatabase<TDescriptor, F> &db)
+    : DBoW2::TemplatedDatabase<TDescriptor, F>(db.usingDirectIndex(),
+      db.getDirectIndexLevels())
+  {
+    const DBoW2::TemplatedVocabulary<TDescriptor, F> *voc =
+      db.getVocabulary();
+
+    // (the vocabulary is only read)
+    this->m_voc = const_cast<DBoW2::TemplatedVocabulary<TDescriptor, F>*>
+      (voc);
+    this->clear();
+  }
+
+  /**
+   * Releases the database, but not the shared vocabulary
+   */
+  virtual ~ReplicaDatabase()
+  {
+    this->m_voc = NULL;
+  }
+
+private:
+
+  ReplicaDatabase(const ReplicaDatabase &);
+  ReplicaDatabase& operator=(const ReplicaDatabase &);
+};
+
+// --------------------------------------------------------------------------
+
+} // namespace DLoopDetector
+
+#endif
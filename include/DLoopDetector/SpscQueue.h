@@ -0,0 +1,172 @@
+/**
+ * File: SpscQueue.h
+ * Date: October 2026
+ * Author: agent
+ * Description: lock-free bounded queue of one producer and one consumer
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_SPSC_QUEUE__
+#define __D_T_SPSC_QUEUE__
+
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+
+namespace DLoopDetector {
+
+/// Bounded ring buffer shared by one producer thread and one consumer
+/// thread, which never lock it. Items are moved in and out
+template<class T>
+class SpscQueue
+{
+public:
+
+  /**
+   * Creates a queue
+   * @param capacity max number of items (rounded up to a power of 2)
+   */
+  SpscQueue(size_t capacity = 16): m_head(0), m_tail(0)
+  {
+    size_t n = 2;
+    while(n < capacity) n <<= 1;
+    m_items.resize(n);
+    m_mask = n - 1;
+  }
+
+  /**
+   * Returns the max number of items
+   * @return capacity
+   */
+  inline size_t capacity() const { return m_items.size(); }
+
+  /**
+   * Adds an item at the back, unless the queue is full. Producer only
+   * @param item item to move into the queue
+   * @return true iff it was added
+   */
+  inline bool tryPush(T &item)
+  {
+    const size_t tail = m_tail.load(std::memory_order_relaxed);
+    if(tail - m_head.load(std::memory_order_acquire) == m_items.size())
+      return false;
+
+    m_items[tail & m_mask] = std::move(item);
+    m_tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * Removes the item at the front, unless the queue is empty. Consumer
+   * only
+   * @param item (out) item moved out of the queue
+   * @return true iff there was an item
+   */
+  inline bool tryPop(T &item)
+  {
+    const size_t head = m_head.load(std::memory_order_relaxed);
+    if(head == m_tail.load(std::memory_order_acquire)) return false;
+
+    item = std::move(m_items[head & m_mask]);
+    m_head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * Returns whether the queue has no items. From the consumer, an empty
+   * queue may get items at any time; from the producer, a non-empty one
+   * may lose them
+   * @return true iff empty
+   */
+  inline bool empty() const
+  {
+    return m_head.load(std::memory_order_acquire) ==
+      m_tail.load(std::memory_order_acquire);
+  }
+
+  /**
+   * Returns whether the queue has no room. Same caveats as empty()
+   * @return true iff full
+   */
+  inline bool full() const
+  {
+    return m_tail.load(std::memory_order_acquire) -
+      m_head.load(std::memory_order_acquire) == m_items.size();
+  }
+
+protected:
+
+  /// Items
+  std::vector<T> m_items;
+  /// Capacity - 1
+  size_t m_mask;
+  /// Number of items popped (consumer)
+  std::atomic<size_t> m_head;
+  /// Number of items pushed (producer)
+  std::atomic<size_t> m_tail;
+};
+
+// --------------------------------------------------------------------------
+
+/// Lets a thread sleep until a condition holds, woken by the thread that
+/// makes it hold. Ringing costs an atomic read unless someone is asleep
+class Doorbell
+{
+public:
+
+  Doorbell(): m_waiting(false) {}
+
+  /**
+   * Waits until a condition holds. It spins for a while before sleeping
+   * @param ready condition, called as ready()
+   */
+  template<class P>
+  void wait(const P &ready)
+  {
+    for(int i = 0; i < 64; ++i)
+    {
+      if(ready()) return;
+      std::this_thread::yield();
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_waiting.store(true);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    // (the timeout only bounds the delay of an unexpected wake-up)
+    while(!ready()) m_cv.wait_for(lock, std::chrono::milliseconds(10));
+    m_waiting.store(false);
+  }
+
+  /**
+   * Wakes up the waiting thread, if any, after changing its condition
+   */
+  inline void ring()
+  {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(m_waiting.load())
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_cv.notify_all();
+    }
+  }
+
+protected:
+
+  /// Whether a thread is asleep
+  std::atomic<bool> m_waiting;
+  /// Protects the sleep
+  std::mutex m_mutex;
+  /// Wakes up the thread
+  std::condition_variable m_cv;
+};
+
+// --------------------------------------------------------------------------
+
+} // namespace DLoopDetector
+
+#endif
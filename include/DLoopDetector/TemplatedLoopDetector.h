@@ -14,6 +14,8 @@
 #include <numeric>
 #include <fstream>
 #include <string>
+#include <deque>
+#include <atomic>
 
 #include <opencv/cv.h>
 
@@ -26,6 +28,20 @@
 #include <DUtilsCV/DUtilsCV.h>
 #include <DVision/DVision.h>
 
+#include "DistanceKernel.h"
+#include "PackedStore.h"
+#include "KeyPointStore.h"
+#include "MatchTable.h"
+#include "DescriptorIndex.h"
+#include "LRUCache.h"
+#include "Epipolar.h"
+#include "ProsacSolver.h"
+#include "P3P.h"
+#include "Cascade.h"
+#include "WorkerPool.h"
+#include "FeatureBudget.h"
+#include "ReplicaDatabase.h"
+
 using namespace std;
 using namespace DUtils;
 using namespace DBoW2;
@@ -43,7 +59,87 @@ enum GeometricalCheck
   /// Use a Flann structure
   GEOM_FLANN,
   /// Do not perform geometrical checking
-  GEOM_NONE
+  GEOM_NONE,
+  /// Use a hashing index of binary descriptors (the features are compared
+  /// exhaustively if the descriptor class does not provide one)
+  GEOM_LSH
+};
+
+/// Geometrical check policy: the check is selected at runtime by 
+/// Parameters::geom_check
+struct RuntimeGeometricalCheck
+{
+  /**
+   * Returns the geometrical check to use
+   * @param geom value of Parameters::geom_check
+   * @return geom
+   */
+  static inline GeometricalCheck get(GeometricalCheck geom) { return geom; }
+};
+
+/// G: geometrical check
+template<GeometricalCheck G>
+/// Geometrical check policy: the check is fixed at compile time and 
+/// Parameters::geom_check is ignored. The branches of the other checks are
+/// compiled out, and with GEOM_NONE no keypoints or descriptors are stored
+struct FixedGeometricalCheck
+{
+  /**
+   * Returns the geometrical check to use
+   * @return G
+   */
+  static inline GeometricalCheck get(GeometricalCheck) { return G; }
+};
+
+/// Robust estimators of fundamental matrices
+enum RobustEstimator
+{
+  /// RANSAC of DVision::FSolver
+  ESTIMATOR_RANSAC,
+  /// Built-in PROSAC, which samples the correspondences with the smallest
+  /// descriptor distances first
+  ESTIMATOR_PROSAC
+};
+
+/// Models of the geometrical verification
+enum VerificationModel
+{
+  /// Fundamental matrix (uncalibrated camera, 8-point algorithm)
+  MODEL_FUNDAMENTAL,
+  /// Essential matrix (calibrated camera, 5-point algorithm)
+  MODEL_ESSENTIAL,
+  /// Relative pose from the 3D points of the old entry and the keypoints
+  /// of the query (calibrated camera with depth, P3P)
+  MODEL_POSE
+};
+
+/// Cheap tests of the correspondences that run before the robust 
+/// estimation of the model (Parameters::cascade combines them)
+enum CascadeTest
+{
+  /// Enough correspondences survive the neighbour ratio test
+  CASCADE_MATCHES = 1,
+  /// The changes of orientation and scale of the keypoints are consistent
+  /// (only with KEYS_FULL)
+  CASCADE_ORIENTATION = 2,
+  /// An affine transformation fitted to small samples is supported by 
+  /// enough correspondences
+  CASCADE_AFFINE = 4
+};
+
+/// Stages of the geometrical check that can reject a candidate
+enum VerificationStage
+{
+  /// The candidate was not rejected
+  STAGE_NONE,
+  /// Too few correspondences
+  STAGE_MATCHES,
+  /// Inconsistent changes of orientation and scale (CASCADE_ORIENTATION)
+  STAGE_ORIENTATION,
+  /// No affine consensus (CASCADE_AFFINE)
+  STAGE_AFFINE,
+  /// The robust estimation of the model failed
+  STAGE_MODEL
 };
 
 /// Reasons for dismissing loops
@@ -76,6 +172,19 @@ struct DetectionResult
   EntryId query;
   /// Matched id if loop detected, otherwise, best candidate 
   EntryId match;
+  /// Number of inliers of the fundamental matrix of the geometrical check,
+  /// if it was estimated with ESTIMATOR_PROSAC, MODEL_ESSENTIAL, MODEL_POSE
+  /// or reuse_last_model (0 otherwise)
+  int inliers;
+  /// Whether R and t hold the pose of the loop. Only with MODEL_POSE, if 
+  /// the 3D points of the match were available
+  bool has_pose;
+  /// Rotation (row-major) and translation of the query camera with respect
+  /// to the matched one, such that x_query = R * x_match + t
+  double R[9], t[3];
+  /// Stage of the geometrical check that rejected the candidate, if status
+  /// is NO_GEOMETRICAL_CONSISTENCY (STAGE_NONE otherwise)
+  VerificationStage rejected_by;
   
   /**
    * Checks if the loop was detected
@@ -89,7 +198,10 @@ struct DetectionResult
 
 /// TDescriptor: class of descriptor
 /// F: class of descriptor functions
-template<class TDescriptor, class F>
+/// TGeomCheck: geometrical check policy (RuntimeGeometricalCheck or
+///   FixedGeometricalCheck<G>)
+template<class TDescriptor, class F, 
+  class TGeomCheck = RuntimeGeometricalCheck>
 /// Generic Loop detector
 class TemplatedLoopDetector
 {
@@ -111,7 +223,7 @@ public:
     float alpha;
     /// Min consistent matches to pass the temporal check
     int k;
-    /// Geometrical check
+    /// Geometrical check (ignored if the detector policy fixes it)
     GeometricalCheck geom_check;
     /// If using direct index for geometrical checking, direct index levels
     int di_levels;
@@ -124,6 +236,9 @@ public:
     int max_db_results;
     /// Min raw score between current entry and previous one to consider a match 
     float min_nss_factor;
+    /// Min raw score of the entries returned by query and queryBatch when
+    /// use_nss is set, since they have no previous image to normalize with
+    float min_query_score;
     /// Min number of close matches to consider some of them
     int min_matches_per_group; 
     /// Max separation between matches to consider them of the same group
@@ -143,11 +258,121 @@ public:
     double ransac_probability;
     /// Max reprojection error of fundamental matrices
     double max_reprojection_error;
+    /// Robust estimator of the fundamental matrices
+    RobustEstimator estimator;
+    /// Number of threads to fit and score the hypotheses of 
+    /// ESTIMATOR_PROSAC with (1: only the calling thread)
+    int estimator_threads;
+    /// Model of the geometrical verification. MODEL_ESSENTIAL requires 
+    /// the intrinsic parameters below (otherwise fundamental matrices are
+    /// estimated, as with MODEL_FUNDAMENTAL) and always uses the built-in
+    /// solver, which samples as PROSAC or uniformly, as RANSAC, according
+    /// to estimator. MODEL_POSE requires them too, and the 3D points of the
+    /// entries given to detectLoop; the entries without them, or without
+    /// valid intrinsics (fx or fy <= 0), are checked with a fundamental 
+    /// matrix
+    VerificationModel model;
+    /// Focal lengths (pixels) of the camera, for MODEL_ESSENTIAL and 
+    /// MODEL_POSE
+    double fx, fy;
+    /// Principal point (pixels) of the camera, for MODEL_ESSENTIAL and
+    /// MODEL_POSE
+    double cx, cy;
+    
+    /// Reuse the fundamental matrix of the last loop: the next queries 
+    /// against the same island look for correspondences along its epipolar
+    /// lines and verify them with a few RANSAC iterations, before falling
+    /// back to the full geometrical check
+    bool reuse_last_model;
+    /// Max distance (pixels) to the epipolar lines of the last model of 
+    /// the correspondences found by the guided matching
+    double guided_epipolar_distance;
+    /// Max number of iterations of RANSAC after the guided matching
+    int guided_ransac_iterations;
+    
+    // These are to reject candidates before the RANSAC
+    
+    /// Tests to run before the robust estimation of the model, cheapest 
+    /// first (combination of CascadeTest flags, 0 for none)
+    int cascade;
+    /// Min number of correspondences (CASCADE_MATCHES)
+    int cascade_min_matches;
+    /// Number of bins of the histograms of orientation and scale changes
+    /// (CASCADE_ORIENTATION)
+    int cascade_bins;
+    /// Min fraction of correspondences consistent with the dominant 
+    /// changes of orientation and scale (CASCADE_ORIENTATION)
+    double cascade_min_consistency;
+    /// Number of samples of the affine consensus (CASCADE_AFFINE)
+    int cascade_affine_iterations;
+    /// Max distance (pixels) of the inliers of the affine transformations.
+    /// It is loose, since affinities only approximate the motion
+    /// (CASCADE_AFFINE)
+    double cascade_affine_error;
+    
+    // These are to verify several candidates
+    
+    /// Number of islands whose entries are checked, by descending score.
+    /// The first consistent entry in that order is the match. The temporal
+    /// consistency is still computed with the best island
+    int verify_islands;
+    /// Number of entries of each island that are checked, by descending 
+    /// score
+    int verify_entries;
+    /// Number of threads that check the candidates concurrently (1: only
+    /// the calling thread). Once a candidate is consistent, the candidates
+    /// after it that have not started are skipped
+    int verify_threads;
+    /// Number of threads that transform the images of detectLoopBatch and
+    /// that run the queries of queryBatch (0: as many as cores)
+    int batch_threads;
     
     // This is to compute correspondences
     
     /// Max value of the neighbour-ratio of accepted correspondences
     double max_neighbor_ratio;
+    /// Keep only mutual nearest neighbours (the query descriptor must also
+    /// be the nearest one to its match among the candidates)
+    bool cross_check;
+    /// Number of threads of the brute-force matching of GEOM_EXHAUSTIVE 
+    /// (1: only the calling thread). The matches are the same
+    int exhaustive_threads;
+    /// Number of descriptors of the tiles of the brute-force matching of
+    /// GEOM_EXHAUSTIVE, so that each tile stays in cache while a block of
+    /// queries is compared with it (0: one tile, unless there are several
+    /// threads)
+    int exhaustive_tile;
+    
+    // Feature budget
+    
+    /// Max number of keypoints kept of each entry (0: all). The strongest
+    /// ones are kept, spread over a grid of the image (image_rows and
+    /// image_cols), and the bow vector of the entry is computed with them
+    /// only. The kept keypoints are stored in order of preference
+    int max_stored_keys;
+    /// Max number of keypoints of each entry used by the geometrical check
+    /// (0: all). They are the first ones in order of preference, so that
+    /// it should be lower than max_stored_keys
+    int max_verified_keys;
+    /// Number of cells of the grid along the longest side of the image. 
+    /// If the image size is unknown, keypoints are ranked by response
+    int budget_grid;
+    
+    // Memory usage
+    
+    /// How the keypoints of the entries are stored. The geometrical checks
+    /// only need their coordinates
+    KeyPointStorage key_storage;
+    /// Number of indices of stored entries kept by GEOM_FLANN and GEOM_LSH,
+    /// so that checking the same entry again reuses its index. If 0, an 
+    /// index of the current entry is built for each check instead
+    int index_cache_size;
+    /// Keep two read-only replicas of the database, updated as entries are
+    /// added, so that other threads can query them (see read()) while 
+    /// entries are added. The database takes three times the memory. A
+    /// replica held by a view is not updated, so that the vectors of the 
+    /// new entries are kept until it is released
+    bool concurrent_reads;
   
     /**
      * Creates parameters by default
@@ -230,6 +455,15 @@ public:
    */
   inline const TemplatedVocabulary<TDescriptor, F>& getVocabulary() const;
   
+  /**
+   * Returns the parameters of the detector
+   * @return parameters
+   */
+  inline const Parameters& getParameters() const
+  {
+    return m_params;
+  }
+  
   /**
    * Sets the database to use. The contents of the database and the detector
    * entries are cleared
@@ -264,11 +498,394 @@ public:
     const std::vector<TDescriptor> &descriptors,
     DetectionResult &match);
 
+  /**
+   * Same as above, but with the bow vector of the descriptors already 
+   * computed with the vocabulary of the detector, so that the descriptors
+   * are not transformed again. This is only possible with GEOM_DI if a 
+   * feature vector of the right level is given as well; otherwise the 
+   * descriptors are transformed as usual. If Parameters::max_stored_keys 
+   * drops some features, the given vectors are ignored and the kept 
+   * features are transformed instead
+   * @param keys keypoints of the image
+   * @param descriptors descriptors associated to the given keypoints
+   * @param bowvec bow vector of descriptors
+   * @param featvec feature vector of descriptors (NULL if not available)
+   * @param di_levels levels up from the leaves of the nodes of featvec. It
+   *   must be Parameters::di_levels for featvec to be used
+   * @param match (out) match or failing information
+   * @return true iff there was match
+   */
+  bool detectLoop(const std::vector<cv::KeyPoint> &keys, 
+    const std::vector<TDescriptor> &descriptors,
+    const BowVector &bowvec, const FeatureVector *featvec, int di_levels,
+    DetectionResult &match);
+  
+  /**
+   * Same as above, with a bow vector only
+   * @param keys keypoints of the image
+   * @param descriptors descriptors associated to the given keypoints
+   * @param bowvec bow vector of descriptors
+   * @param match (out) match or failing information
+   * @return true iff there was match
+   */
+  inline bool detectLoop(const std::vector<cv::KeyPoint> &keys, 
+    const std::vector<TDescriptor> &descriptors,
+    const BowVector &bowvec, DetectionResult &match)
+  {
+    return detectLoop(keys, descriptors, bowvec, NULL, 0, match);
+  }
+
+  /**
+   * Same as above, with the 3D points of the keypoints as well, for
+   * MODEL_POSE. Later queries that match this entry are verified with 
+   * them, and their relative pose is returned
+   * @param keys keypoints of the image
+   * @param descriptors descriptors associated to the given keypoints
+   * @param points 3D point of each keypoint in the frame of the camera 
+   *   (z along the optical axis). Unknown points have z <= 0 or NaN
+   * @param match (out) match or failing information
+   * @return true iff there was match
+   */
+  bool detectLoop(const std::vector<cv::KeyPoint> &keys, 
+    const std::vector<TDescriptor> &descriptors,
+    const std::vector<cv::Point3f> &points, DetectionResult &match);
+
+  /**
+   * Same as above, with the depth of the keypoints (e.g. from a RGB-D or 
+   * stereo camera) instead of their 3D points, which are computed with
+   * the intrinsic parameters of Parameters. Without valid ones (fx or 
+   * fy <= 0), no points are stored and the entry is checked with a 
+   * fundamental matrix
+   * @param keys keypoints of the image
+   * @param descriptors descriptors associated to the given keypoints
+   * @param depths depth (z) of each keypoint. Unknown depths are <= 0 or
+   *   NaN
+   * @param match (out) match or failing information
+   * @return true iff there was match
+   */
+  bool detectLoop(const std::vector<cv::KeyPoint> &keys, 
+    const std::vector<TDescriptor> &descriptors,
+    const std::vector<float> &depths, DetectionResult &match);
+
+  /**
+   * Computes the bow vector of an entry that detectLoop would compute, and
+   * its feature vector if the geometrical check is GEOM_DI, without
+   * modifying the detector. It only reads the vocabulary and the 
+   * parameters, so that several threads can call it while detectLoop runs
+   * (but not with setDatabase or setVocabulary), to transform entries
+   * ahead of their detection. The vectors can be given to detectLoop with
+   * Parameters::di_levels
+   * @param keys keypoints of the image
+   * @param descriptors descriptors associated to the given keypoints
+   * @param bowvec (out) bow vector
+   * @param featvec (out) feature vector (cleared if not used)
+   * @return false if the feature budget changes the features, so that 
+   *   detectLoop must transform the kept ones itself (the vectors are not 
+   *   computed then)
+   */
+  bool transform(const std::vector<cv::KeyPoint> &keys, 
+    const std::vector<TDescriptor> &descriptors, 
+    BowVector &bowvec, FeatureVector &featvec) const;
+
+  /**
+   * Adds a sequence of images and returns their matches, with the same 
+   * results as calling detectLoop with each of them in order. The 
+   * vocabulary transformations do not depend on each other, so that they 
+   * run in parallel (Parameters::batch_threads) on chunks of the sequence;
+   * then the images of each chunk are added in order
+   * @param keys keypoints of each image
+   * @param descriptors descriptors associated to the keypoints of each
+   *   image
+   * @param matches (out) match or failing information of each image
+   * @return number of loops detected
+   */
+  unsigned int detectLoopBatch(
+    const std::vector<std::vector<cv::KeyPoint> > &keys, 
+    const std::vector<std::vector<TDescriptor> > &descriptors,
+    std::vector<DetectionResult> &matches);
+
+  /// Working memory of query and queryBatch
+  class QueryContext;
+
+  /**
+   * Looks for the stored entry that matches an image (e.g. to relocalize,
+   * or from another camera) without adding it to the database nor 
+   * changing the temporal window. The islands of the whole database are 
+   * candidates, and the first one in order that passes the geometrical
+   * check is the match. There is no previous image to normalize the 
+   * scores with, so that the raw scores are filtered by alpha if use_nss
+   * is false, and by Parameters::min_query_score otherwise. 
+   * match.query is the id the image would get if it were added. With
+   * Parameters::concurrent_reads, it reads a view of the entries (see 
+   * read()), so that other threads can call it while entries are added; 
+   * otherwise, it must not run while entries are added
+   * @param keys keypoints of the image
+   * @param descriptors descriptors associated to the given keypoints
+   * @param match (out) match or failing information
+   * @param context working memory, reused by the calls it is given
+   * @param verify whether the candidates are checked geometrically. If 
+   *   not, the best one is the match
+   * @return true iff there was match
+   */
+  bool query(const std::vector<cv::KeyPoint> &keys, 
+    const std::vector<TDescriptor> &descriptors, DetectionResult &match,
+    QueryContext &context, bool verify = true) const;
+
+  /**
+   * Same as query, with several images, which are processed in parallel
+   * (Parameters::batch_threads). They all read the same view of the 
+   * entries with Parameters::concurrent_reads
+   * @param keys keypoints of each image
+   * @param descriptors descriptors associated to the keypoints of each
+   *   image
+   * @param matches (out) match or failing information of each image
+   * @param context working memory, reused by the calls it is given. It 
+   *   keeps the threads of the batch as well
+   * @param verify whether the candidates are checked geometrically
+   * @return number of images with match
+   */
+  unsigned int queryBatch(
+    const std::vector<std::vector<cv::KeyPoint> > &keys, 
+    const std::vector<std::vector<TDescriptor> > &descriptors,
+    std::vector<DetectionResult> &matches, QueryContext &context, 
+    bool verify = true) const;
+
+  /**
+   * Returns the keypoints stored for an entry. They are only available if
+   * the geometrical check is not GEOM_NONE and keypoints are stored with 
+   * KEYS_FULL. The view remains valid until the detector is cleared
+   * @param id entry id
+   * @return keypoints, or an empty view if they are not stored
+   */
+  inline Span<cv::KeyPoint> getKeys(EntryId id) const
+  {
+    return id < m_image_keys.size() ? m_image_keys.keys(id) : 
+      Span<cv::KeyPoint>();
+  }
+
+  /**
+   * Returns the descriptors stored for an entry. They are not stored with
+   * GEOM_NONE. The view remains valid until the detector is cleared
+   * @param id entry id
+   * @return descriptors, or an empty view if they are not stored
+   */
+  inline Span<TDescriptor> getDescriptors(EntryId id) const
+  {
+    return id < m_image_descriptors.size() ? m_image_descriptors[id] :
+      Span<TDescriptor>();
+  }
+
+  /**
+   * Returns the 3D points stored for an entry. They are only available if
+   * the geometrical check is not GEOM_NONE and the entry was given with 
+   * points or depths. The view remains valid until the detector is cleared
+   * @param id entry id
+   * @return 3D points, or an empty view if they are not stored
+   */
+  inline Span<cv::Point3f> getPoints3D(EntryId id) const
+  {
+    return id < m_image_points.size() ? m_image_points[id] : 
+      Span<cv::Point3f>();
+  }
+
   /**
    * Resets the detector and clears the database, such that the next entry
    * will be 0 again
    */
   inline void clear();
+  
+  /**
+   * Returns the number of calls to detectLoop after which the reusable 
+   * buffers of the workspaces of the detector (of the calling thread and
+   * of the verification workers) had grown. Once the detector has warmed 
+   * up (or after allocate), this number should stop growing. It only 
+   * compares the capacity of those buffers between calls, so that it is a 
+   * hint to size allocate, not a count of allocations: the stored entries,
+   * the cached indices, DBoW2, OpenCV, the threads and the vectors kept for
+   * Parameters::concurrent_reads allocate memory that it does not see
+   * @return number of calls that enlarged the workspaces
+   */
+  inline unsigned int getWorkspaceGrowths() const
+  {
+    return m_workspace.growths;
+  }
+  
+  /**
+   * Returns the number of checks that found the index of the old entry in
+   * the cache (see Parameters::index_cache_size)
+   * @return cache hits
+   */
+  inline unsigned long getIndexCacheHits() const
+  {
+    unsigned long n = m_workspace.flann_cache.hits() + 
+      m_workspace.index_cache.hits();
+    for(size_t i = 0; i < m_workers.size(); ++i)
+      n += m_workers[i].flann_cache.hits() + m_workers[i].index_cache.hits();
+    return n;
+  }
+  
+  /**
+   * Returns the number of checks that had to build the index of the old 
+   * entry (see Parameters::index_cache_size)
+   * @return cache misses
+   */
+  inline unsigned long getIndexCacheMisses() const
+  {
+    unsigned long n = m_workspace.flann_cache.misses() + 
+      m_workspace.index_cache.misses();
+    for(size_t i = 0; i < m_workers.size(); ++i)
+      n += m_workers[i].flann_cache.misses() + 
+        m_workers[i].index_cache.misses();
+    return n;
+  }
+  
+protected:
+  
+  /// Read-only replica of the entries (Parameters::concurrent_reads)
+  struct tReplica
+  {
+    /// Database of the replica, with the vocabulary of the detector
+    ReplicaDatabase<TDescriptor, F> *db;
+    /// Stored data of each entry (the stores never move them)
+    vector<KeyPointStore::EntryView> keys;
+    vector<Span<TDescriptor> > descriptors;
+    vector<Span<cv::Point3f> > points;
+    /// Store of the keypoints, to read keys
+    const KeyPointStore *key_store;
+    /// Number of views that hold the replica
+    std::atomic<int> readers;
+    
+    tReplica(): db(NULL), key_store(NULL), readers(0) {}
+    ~tReplica() { delete db; }
+  };
+  
+public:
+  
+  /// Read-only view of the entries of the detector as they were at some
+  /// point, which a thread can use while another one adds entries 
+  /// (Parameters::concurrent_reads). Its replica is not updated until the
+  /// view is released, so that views should be short-lived
+  class ReadView
+  {
+  public:
+    
+    /**
+     * Creates an invalid view
+     */
+    ReadView(): m_replica(NULL) {}
+    
+    /**
+     * Takes the replica of another view
+     * @param v
+     */
+    ReadView(ReadView &&v): m_replica(v.m_replica) { v.m_replica = NULL; }
+    
+    /**
+     * Releases this view and takes the replica of another one
+     * @param v
+     */
+    ReadView& operator=(ReadView &&v)
+    {
+      if(this != &v)
+      {
+        release();
+        m_replica = v.m_replica;
+        v.m_replica = NULL;
+      }
+      return *this;
+    }
+    
+    /**
+     * Releases the view
+     */
+    ~ReadView() { release(); }
+    
+    /**
+     * Returns whether the view holds a replica
+     * @return true iff valid
+     */
+    inline bool valid() const { return m_replica != NULL; }
+    
+    /**
+     * Returns the number of entries of the view
+     * @return number of entries
+     */
+    inline size_t size() const { return m_replica->descriptors.size(); }
+    
+    /**
+     * Returns the database of the view, which can be queried
+     * @return database
+     */
+    inline const TemplatedDatabase<TDescriptor, F>& getDatabase() const
+    {
+      return *m_replica->db;
+    }
+    
+    /**
+     * Returns the keypoints stored for an entry (see 
+     * TemplatedLoopDetector::getKeys)
+     * @param id entry id (< size())
+     * @return keypoints, or an empty view if they are not stored
+     */
+    inline Span<cv::KeyPoint> getKeys(EntryId id) const
+    {
+      return m_replica->key_store->keys(m_replica->keys[id]);
+    }
+    
+    /**
+     * Returns the descriptors stored for an entry
+     * @param id entry id (< size())
+     * @return descriptors, or an empty view if they are not stored
+     */
+    inline Span<TDescriptor> getDescriptors(EntryId id) const
+    {
+      return m_replica->descriptors[id];
+    }
+    
+    /**
+     * Returns the 3D points stored for an entry
+     * @param id entry id (< size())
+     * @return 3D points, or an empty view if they are not stored
+     */
+    inline Span<cv::Point3f> getPoints3D(EntryId id) const
+    {
+      return m_replica->points[id];
+    }
+    
+    /**
+     * Releases the replica, so that the detector can update it. The view
+     * becomes invalid
+     */
+    inline void release()
+    {
+      if(m_replica) m_replica->readers.fetch_sub(1);
+      m_replica = NULL;
+    }
+    
+  protected:
+    friend class TemplatedLoopDetector;
+    
+    /**
+     * Creates a view of a replica already held
+     * @param r
+     */
+    explicit ReadView(tReplica *r): m_replica(r) {}
+    
+  protected:
+    /// Replica held
+    tReplica *m_replica;
+  };
+  
+  /**
+   * Returns a view of the entries added so far. If a view has been held
+   * for long, the last entries may be missing. Views must be released 
+   * soon: while one is held, the detector keeps the bow and feature 
+   * vectors of all the entries added after it. It can be called from any
+   * thread, and it neither waits for detectLoop nor makes it wait; clear,
+   * setDatabase and setVocabulary must not be called while views are held
+   * @return view, invalid if Parameters::concurrent_reads is not set
+   */
+  ReadView read() const;
 
 protected:
   
@@ -386,45 +1003,543 @@ protected:
     tTemporalWindow(): nentries(0) {}
   };
   
+  /// Entry to verify
+  struct tCandidate
+  {
+    /// Old entry
+    EntryId entry;
+    /// Index of its island in the islands of the query
+    unsigned int island;
+    /// Score of the entry
+    double score;
+  };
+  
+  /// Fundamental matrix of the last loop detected
+  struct tVerifiedModel
+  {
+    /// Whether there is a model
+    bool valid;
+    /// Island of the loop
+    EntryId first, last;
+    /// Old entry of the loop
+    EntryId old_entry;
+    /// Query of the loop
+    EntryId query;
+    /// Matrix (row-major) such that x_query' * F * x_old = 0
+    double fmatrix[9];
+    /// Keypoints of the old entry that were inliers
+    vector<unsigned int> i_inliers;
+    
+    /**
+     * Creates an invalid model
+     */
+    tVerifiedModel(): valid(false) {}
+  };
+  
+  /// Working memory of a detection. It is kept between calls so that the
+  /// buffers are reused instead of allocated again
+  struct tWorkspace
+  {
+    /// Bow vector of the current entry
+    BowVector bowvec;
+    /// Feature vector of the current entry
+    FeatureVector featvec;
+    /// Ranking of the keypoints of the current entry (feature budget)
+    FeatureBudget budget;
+    /// Indices of the kept keypoints of the current entry, in order of
+    /// preference
+    vector<unsigned int> ranked;
+    /// Keypoints, descriptors and 3D points or depths of the current entry
+    /// kept by the feature budget
+    vector<cv::KeyPoint> kept_keys;
+    vector<TDescriptor> kept_descriptors;
+    vector<cv::Point3f> kept_points;
+    vector<float> kept_depths;
+    /// Keypoints and descriptors of the current entry used by the 
+    /// geometrical check (Parameters::max_verified_keys)
+    vector<cv::KeyPoint> verified_keys;
+    vector<TDescriptor> verified_descriptors;
+    /// Database query results
+    QueryResults qret;
+    /// Islands of the query results
+    vector<tIsland> islands;
+    /// Islands by descending score
+    vector<unsigned int> island_order;
+    /// Entries to verify, in order of preference
+    vector<tCandidate> candidates;
+    /// Worker that verified each candidate (-1 if skipped)
+    vector<int> cand_worker;
+    /// Number of inliers found for each candidate
+    vector<int> cand_inliers;
+    /// Stage reached by the check of each candidate
+    vector<VerificationStage> cand_stage;
+    /// Indices of the correspondences
+    vector<unsigned int> i_old, i_cur;
+    /// Best correspondence of each current feature
+    MatchTable table;
+    /// Indices of all the features (GEOM_EXHAUSTIVE)
+    vector<unsigned int> i_all_old, i_all_cur;
+    /// Coordinates of the correspondences, as Nx2 matrices
+    vector<float> old_points, cur_points;
+    /// Last fundamental matrix found (with Parameters::reuse_last_model)
+    double fmatrix[9];
+    /// Inlier flags of the last fundamental matrix
+    vector<unsigned char> status;
+    /// Number of inliers of the last fundamental matrix, if known
+    int inliers;
+    /// Descriptor distances of the correspondences
+    vector<double> distances;
+    /// Correspondences sorted by distance (ESTIMATOR_PROSAC)
+    vector<unsigned int> order;
+    /// Robust estimator (ESTIMATOR_PROSAC or MODEL_ESSENTIAL)
+    ProsacSolver prosac;
+    /// Workers of the robust estimator (Parameters::estimator_threads)
+    WorkerPool prosac_pool;
+    /// Keypoints of the old entry that were inliers of the last matrix
+    vector<unsigned int> i_inliers;
+    /// Robust estimator of poses (MODEL_POSE)
+    PoseSolver pose;
+    /// 3D points of the old entry and keypoints of the current one of the
+    /// correspondences with a known point (MODEL_POSE)
+    vector<float> pose_points, pose_keys;
+    /// Correspondences with a known point (MODEL_POSE)
+    vector<unsigned int> pose_index;
+    /// Last pose found (MODEL_POSE)
+    double R[9], t[3];
+    /// Whether R and t were found in the last check
+    bool has_pose;
+    /// Stage reached by the last check
+    VerificationStage stage;
+    /// Orientation (degrees) and scale (log2) changes of the 
+    /// correspondences (CASCADE_ORIENTATION)
+    vector<float> dangle, dscale;
+    /// Histograms of the changes (CASCADE_ORIENTATION)
+    vector<int> hist;
+    /// Current features close to an epipolar line (guided matching)
+    vector<unsigned int> i_cand;
+    /// Nearest neighbour search
+    DistanceKernel<TDescriptor, F> kernel;
+    /// Nearest neighbour search of the other threads of the tiled matching
+    std::deque<DistanceKernel<TDescriptor, F> > tile_kernels;
+    /// Threads of the tiled matching
+    WorkerPool matcher_pool;
+    /// Candidate indices of each tile
+    vector<vector<unsigned int> > tiles;
+    /// Nearest neighbours found by the tiled matching: position of the 
+    /// nearest candidate and distances to the two nearest ones
+    vector<int> nn_j;
+    vector<double> nn_d1, nn_d2;
+    /// Targets of the matches to cross check (tiled matching)
+    vector<unsigned int> cc_targets;
+    /// Features of a word of the old and current entries within the 
+    /// verification budget (GEOM_DI)
+    vector<unsigned int> di_old, di_cur;
+    /// Flann structure with the current descriptors (GEOM_FLANN)
+    cv::FlannBasedMatcher flann;
+    /// Entry whose descriptors are in flann (-1 if none)
+    int flann_entry;
+    /// Descriptors to build the flann structure
+    vector<cv::Mat> flann_features;
+    /// Old descriptors to query the flann structure with
+    vector<TDescriptor> flann_old;
+    /// Old descriptors as a matrix
+    cv::Mat flann_query;
+    /// Results of the flann structure
+    vector<vector<cv::DMatch> > flann_matches;
+    /// Index of the current descriptors (GEOM_LSH)
+    DescriptorIndex<TDescriptor, F> index;
+    /// Replica whose entries the checks read instead of those of the 
+    /// detector (query with Parameters::concurrent_reads), or NULL
+    const tReplica *replica;
+    /// Flann structures of stored entries (GEOM_FLANN)
+    LRUCache<EntryId, cv::FlannBasedMatcher> flann_cache;
+    /// Indices of stored entries (GEOM_LSH)
+    LRUCache<EntryId, DescriptorIndex<TDescriptor, F> > index_cache;
+    
+    /// Number of detections after which the buffers of the workspaces had
+    /// grown (only kept by the workspace of the calling thread)
+    unsigned int growths;
+    /// Footprint of the workspaces after the last detection
+    size_t last_footprint;
+    
+    /**
+     * Creates an empty workspace
+     */
+    tWorkspace(): inliers(0), has_pose(false), stage(STAGE_NONE), 
+      flann_entry(-1), replica(NULL), growths(0), last_footprint(0) {}
+    
+    /**
+     * Returns the memory held by the buffers whose growth is tracked
+     * @return bytes
+     */
+    size_t footprint() const
+    {
+      return qret.capacity() * sizeof(Result) +
+        islands.capacity() * sizeof(tIsland) +
+        candidates.capacity() * sizeof(tCandidate) +
+        (island_order.capacity() + cand_worker.capacity() + 
+         cand_inliers.capacity() + nn_j.capacity() + 
+         cc_targets.capacity()) * sizeof(int) +
+        (nn_d1.capacity() + nn_d2.capacity()) * sizeof(double) +
+        cand_stage.capacity() * sizeof(VerificationStage) +
+        (i_old.capacity() + i_cur.capacity() + i_all_old.capacity() + 
+         i_all_cur.capacity() + i_inliers.capacity() + i_cand.capacity() +
+         order.capacity() + pose_index.capacity() + ranked.capacity() +
+         di_old.capacity() + di_cur.capacity()) * sizeof(unsigned int) +
+        budget.capacity() +
+        (kept_keys.capacity() + verified_keys.capacity()) * 
+          sizeof(cv::KeyPoint) +
+        (kept_descriptors.capacity() + verified_descriptors.capacity()) *
+          sizeof(TDescriptor) + kept_points.capacity() * sizeof(cv::Point3f) +
+        kept_depths.capacity() * sizeof(float) +
+        status.capacity() + distances.capacity() * sizeof(double) +
+        prosac.capacity() + pose.capacity() +
+        (pose_points.capacity() + pose_keys.capacity() + dangle.capacity() +
+         dscale.capacity()) * sizeof(float) + hist.capacity() * sizeof(int) +
+        table.capacity() +
+        (old_points.capacity() + cur_points.capacity()) * sizeof(float) +
+        kernel.capacity() +
+        flann_old.capacity() * sizeof(TDescriptor) +
+        flann_matches.capacity() * sizeof(vector<cv::DMatch>) +
+        index.capacity();
+    }
+    
+    /**
+     * Reserves the buffers for the given number of keypoints per entry
+     * @param nkeys
+     * @param nresults max number of database results
+     */
+    void reserve(size_t nkeys, size_t nresults)
+    {
+      qret.reserve(nresults);
+      islands.reserve(nresults);
+      island_order.reserve(nresults);
+      i_old.reserve(nkeys); i_cur.reserve(nkeys);
+      table.reset(nkeys); 
+      i_all_old.reserve(nkeys); i_all_cur.reserve(nkeys);
+      old_points.reserve(2 * nkeys); cur_points.reserve(2 * nkeys);
+      status.reserve(nkeys); i_inliers.reserve(nkeys); i_cand.reserve(nkeys);
+      distances.reserve(nkeys); order.reserve(nkeys);
+      pose_points.reserve(3 * nkeys); pose_keys.reserve(2 * nkeys);
+      pose_index.reserve(nkeys);
+      dangle.reserve(nkeys); dscale.reserve(nkeys);
+      ranked.reserve(nkeys);
+    }
+  };
+  
+public:
+  
+  /// Working memory of query and queryBatch, owned by the caller, so that
+  /// the calls it is given reuse it instead of allocating it again. A 
+  /// context must not be given to two calls at the same time, but each 
+  /// thread can have its own one
+  class QueryContext
+  {
+  public:
+    
+    /**
+     * Creates an empty context
+     */
+    QueryContext(): m_clears(0) {}
+    
+  protected:
+    friend class TemplatedLoopDetector;
+    
+    /// Working memory of each worker
+    std::deque<tWorkspace> m_workspaces;
+    /// Workers of queryBatch
+    WorkerPool m_pool;
+    /// Number of times the detector had been cleared when the context was
+    /// last used, to drop the caches of the entries of before
+    unsigned long m_clears;
+  };
   
 protected:
   
   /**
-   * Removes from q those results whose score is lower than threshold
-   * (that should be alpha * ns_factor)
-   * @param q results from query
-   * @param threshold min value of the resting results
+   * Adds an entry to the database and looks for a loop with it, but does
+   * not store its keypoints and descriptors
+   * @param keys keypoints of the image
+   * @param descriptors descriptors associated to the given keypoints
+   * @param match (out) match or failing information
+   * @param given_bowvec bow vector of descriptors, or NULL to compute it
+   * @param given_featvec feature vector of descriptors at the di_levels 
+   *   level, or NULL to compute it if needed
    */
-  void removeLowScores(QueryResults &q, double threshold) const;
+  void processEntry(const std::vector<cv::KeyPoint> &keys, 
+    const std::vector<TDescriptor> &descriptors,
+    DetectionResult &match, const BowVector *given_bowvec = NULL,
+    const FeatureVector *given_featvec = NULL);
   
   /**
-   * Returns the islands of the given matches in ascending order of entry ids
-   * @param q 
-   * @param islands (out) computed islands
+   * Creates the replicas of the database again, empty 
+   * (Parameters::concurrent_reads)
    */
-  void computeIslands(QueryResults &q, vector<tIsland> &islands) const;
+  void resetReplicas();
   
   /**
-   * Returns the score of the island composed of the entries of q whose indices
-   * are in [i_first, i_last] (both included)
-   * @param q
-   * @param i_first first index of q of the island
-   * @param i_last last index of q of the island
-   * @return island score
+   * Brings the replica that views do not use up to date with the entries
+   * added, and makes new views use it, unless a view still holds it
+   * (Parameters::concurrent_reads)
    */
-  double calculateIslandScore(const QueryResults &q, unsigned int i_first, 
-    unsigned int i_last) const;
-
+  void publish();
+  
   /**
-   * Updates the temporal window by adding the given match <island, id>, such 
-   * that the window will contain only those islands which are consistent
-   * @param matched_island
-   * @param entry_id
+   * Finishes the addition of an entry: counts the growth of the 
+   * workspaces and publishes the entry for the views
    */
-  void updateTemporalWindow(const tIsland &matched_island, EntryId entry_id);
+  void finishEntry();
   
   /**
-   * Returns the number of consistent islands in the temporal window
+   * Returns the memory held by the buffers of the workspaces of the 
+   * calling thread and of the verification workers
+   * @return bytes
+   */
+  inline size_t workspaceFootprint() const
+  {
+    size_t bytes = m_workspace.footprint();
+    for(size_t i = 0; i < m_workers.size(); ++i) 
+      bytes += m_workers[i].footprint();
+    return bytes;
+  }
+  
+  /**
+   * Applies the feature budget to the features of the current entry. The
+   * kept ones are left in order of preference in ws.kept_keys and 
+   * kept_descriptors, and their indices in ws.ranked
+   * @param keys keypoints of the image
+   * @param descriptors descriptors associated to the given keypoints
+   * @param ws working memory
+   * @return true iff the kept features must be used instead of the given
+   *   ones
+   */
+  bool applyBudget(const std::vector<cv::KeyPoint> &keys, 
+    const std::vector<TDescriptor> &descriptors, tWorkspace &ws) const;
+  
+  /**
+   * Leaves the features of the current entry that the geometrical check
+   * uses (Parameters::max_verified_keys) in ws.verified_keys and 
+   * verified_descriptors, unless they are all of them
+   * @param keys keypoints of the current entry, in order of preference
+   * @param descriptors descriptors of the current entry
+   * @param ws working memory
+   * @return true iff the features of ws must be used instead of the given
+   *   ones
+   */
+  bool trimFeatures(const std::vector<cv::KeyPoint> &keys, 
+    const std::vector<TDescriptor> &descriptors, tWorkspace &ws) const;
+  
+  /**
+   * Looks for the stored entry that matches an image, without modifying 
+   * the detector
+   * @param keys keypoints of the image
+   * @param descriptors descriptors associated to the given keypoints
+   * @param match (out) match or failing information
+   * @param verify whether the candidates are checked geometrically
+   * @param ws working memory
+   */
+  void queryEntry(const std::vector<cv::KeyPoint> &keys, 
+    const std::vector<TDescriptor> &descriptors, DetectionResult &match,
+    bool verify, tWorkspace &ws) const;
+  
+  /**
+   * Prepares the workspaces of a query context for some queries
+   * @param context
+   * @param n number of workspaces needed
+   * @param view view of the entries that the queries read
+   */
+  void prepareContext(QueryContext &context, int n, const ReadView &view) 
+    const;
+  
+  /**
+   * Returns the database that the checks with a workspace read: that of
+   * its replica, if any, or that of the detector
+   * @param ws working memory
+   * @return database
+   */
+  inline const TemplatedDatabase<TDescriptor, F>& 
+  database(const tWorkspace &ws) const
+  {
+    if(ws.replica) return *ws.replica->db;
+    return *m_database;
+  }
+  
+  /**
+   * Returns the descriptors of a stored entry, from the replica of the
+   * workspace if any
+   * @param id entry id
+   * @param ws working memory
+   * @return descriptors
+   */
+  inline Span<TDescriptor> storedDescriptors(EntryId id, 
+    const tWorkspace &ws) const
+  {
+    return ws.replica ? ws.replica->descriptors[id] : 
+      m_image_descriptors[id];
+  }
+  
+  /**
+   * Returns the keypoints of a stored entry (KEYS_FULL only), from the 
+   * replica of the workspace if any
+   * @param id entry id
+   * @param ws working memory
+   * @return keypoints, or an empty span if only coordinates are stored
+   */
+  inline Span<cv::KeyPoint> storedKeys(EntryId id, const tWorkspace &ws) 
+    const
+  {
+    return ws.replica ? m_image_keys.keys(ws.replica->keys[id]) : 
+      m_image_keys.keys(id);
+  }
+  
+  /**
+   * Writes the coordinates of some keypoints of a stored entry as 
+   * KeyPointStore::getPoints does, from the replica of the workspace if any
+   * @param id entry id
+   * @param indices indices of the keypoints to get
+   * @param xy (out) 2N coordinates
+   * @param ws working memory
+   */
+  inline void storedCoordinates(EntryId id, 
+    const vector<unsigned int> &indices, vector<float> &xy, 
+    const tWorkspace &ws) const
+  {
+    if(ws.replica) m_image_keys.getPoints(ws.replica->keys[id], indices, xy);
+    else m_image_keys.getPoints(id, indices, xy);
+  }
+  
+  /**
+   * Returns the 3D points of a stored entry, from the replica of the 
+   * workspace if any
+   * @param id entry id
+   * @param ws working memory
+   * @return 3D points, or an empty span if they are not stored
+   */
+  inline Span<cv::Point3f> storedPoints3D(EntryId id, const tWorkspace &ws)
+    const
+  {
+    if(ws.replica) return ws.replica->points[id];
+    return id < m_image_points.size() ? m_image_points[id] : 
+      Span<cv::Point3f>();
+  }
+  
+  /**
+   * Returns the descriptors of a stored entry used by the geometrical 
+   * check (Parameters::max_verified_keys)
+   * @param id entry id
+   * @param ws working memory
+   * @return descriptors
+   */
+  inline Span<TDescriptor> verifiedDescriptors(EntryId id, 
+    const tWorkspace &ws) const
+  {
+    const Span<TDescriptor> d = storedDescriptors(id, ws);
+    if(m_params.max_verified_keys <= 0 || 
+      d.size() <= (size_t)m_params.max_verified_keys) return d;
+    return Span<TDescriptor>(d.data(), m_params.max_verified_keys);
+  }
+  
+  /**
+   * Removes from q those results whose score is lower than threshold
+   * (that should be alpha * ns_factor)
+   * @param q results from query
+   * @param threshold min value of the resting results
+   */
+  void removeLowScores(QueryResults &q, double threshold) const;
+  
+  /**
+   * Returns the islands of the given matches in ascending order of entry ids
+   * @param q 
+   * @param islands (out) computed islands
+   */
+  void computeIslands(QueryResults &q, vector<tIsland> &islands) const;
+  
+  /**
+   * Returns the score of the island composed of the entries of q whose indices
+   * are in [i_first, i_last] (both included)
+   * @param q
+   * @param i_first first index of q of the island
+   * @param i_last last index of q of the island
+   * @return island score
+   */
+  double calculateIslandScore(const QueryResults &q, unsigned int i_first, 
+    unsigned int i_last) const;
+
+  /**
+   * Updates the temporal window by adding the given match <island, id>, such 
+   * that the window will contain only those islands which are consistent
+   * @param matched_island
+   * @param entry_id
+   */
+  void updateTemporalWindow(const tIsland &matched_island, EntryId entry_id);
+  
+  /**
+   * Selects the entries to verify (Parameters::verify_islands and 
+   * verify_entries) and leaves them in ws.candidates, in order of 
+   * preference. The first one is the best entry of the best island
+   * @param q query results, in ascending order of ids
+   * @param islands islands of q
+   * @param ws working memory
+   */
+  void getCandidates(const QueryResults &q, const vector<tIsland> &islands,
+    tWorkspace &ws) const;
+  
+  /**
+   * Checks the candidates of m_workspace.candidates, concurrently if there
+   * are several threads, and finds the first one in order that is 
+   * geometrically consistent
+   * @param entry_id current entry
+   * @param keys current keypoints
+   * @param descriptors current descriptors
+   * @param featvec feature vector of the current entry
+   * @return index of the consistent candidate, -1 if none
+   */
+  int verifyCandidates(EntryId entry_id, 
+    const std::vector<cv::KeyPoint> &keys, 
+    const std::vector<TDescriptor> &descriptors, 
+    const FeatureVector &featvec);
+  
+  /**
+   * Checks if an old entry is geometrically consistent with the current 
+   * entry with the geometrical check in use
+   * @param island island of the old entry
+   * @param old_entry entry id of the stored image to check
+   * @param entry_id current entry
+   * @param keys current keypoints
+   * @param descriptors current descriptors
+   * @param featvec feature vector of the current entry
+   * @param ws working memory
+   * @param sequential whether the current entry follows the previous 
+   *   one, so that the model of the last loop can be reused
+   * @return true iff the entry is consistent
+   */
+  bool checkCandidate(const tIsland &island, EntryId old_entry, 
+    EntryId entry_id, const std::vector<cv::KeyPoint> &keys, 
+    const std::vector<TDescriptor> &descriptors, 
+    const FeatureVector &featvec, tWorkspace &ws, 
+    bool sequential = true) const;
+  
+  /**
+   * Returns the workspace of a worker of the verification
+   * @param w worker index (0 for the calling thread)
+   * @return workspace
+   */
+  inline tWorkspace& workspace(int w)
+  {
+    return w == 0 ? m_workspace : m_workers[w - 1];
+  }
+  
+  /**
+   * Returns the geometrical check in use, given by the policy
+   * @return geometrical check
+   */
+  inline GeometricalCheck geomCheck() const
+  {
+    return TGeomCheck::get(m_params.geom_check);
+  }
+  
+  /**
+   * Returns the number of consistent islands in the temporal window
    * @return number of temporal consistent islands
    */
   inline int getConsistentEntries() const
@@ -439,11 +1554,12 @@ protected:
    * @param keys current keypoints
    * @param descriptors current descriptors associated to the given keypoints
    * @param curvec feature vector of the current entry 
+   * @param ws working memory
    */
   bool isGeometricallyConsistent_DI(EntryId old_entry, 
     const std::vector<cv::KeyPoint> &keys, 
     const std::vector<TDescriptor> &descriptors, 
-    const FeatureVector &curvec) const;
+    const FeatureVector &curvec, tWorkspace &ws) const;
   
   /**
    * Checks if an old entry is geometrically consistent (by using FLANN and 
@@ -452,51 +1568,237 @@ protected:
    * @param old_entry entry id of the stored image to check
    * @param keys current keypoints
    * @param descriptors current descriptors
-   * @param flann_structure flann structure with the descriptors of the current entry
+   * @param ws working memory, whose flann structure must contain the 
+   *   descriptors of the current entry
    */
   bool isGeometricallyConsistent_Flann(EntryId old_entry,
     const std::vector<cv::KeyPoint> &keys, 
     const std::vector<TDescriptor> &descriptors,
-    cv::FlannBasedMatcher &flann_structure) const;
+    tWorkspace &ws) const;
+
+  /**
+   * Checks if an old entry is geometrically consistent (by using an index
+   * of the current descriptors with the neighbour ratio test and 
+   * computing a fundamental matrix) with the given set of keys and 
+   * descriptors
+   * @param old_entry entry id of the stored image to check
+   * @param keys current keypoints
+   * @param descriptors current descriptors
+   * @param ws working memory
+   */
+  bool isGeometricallyConsistent_LSH(EntryId old_entry,
+    const std::vector<cv::KeyPoint> &keys, 
+    const std::vector<TDescriptor> &descriptors, tWorkspace &ws) const;
+
+  /**
+   * Finishes a check with the matches current -> old of ws.table, found 
+   * with the index of the old entry: applies the cross check and computes
+   * the fundamental matrix
+   * @param old_entry entry id of the stored image to check
+   * @param keys current keypoints
+   * @param descriptors current descriptors
+   * @param ws working memory
+   * @return true iff the fundamental matrix was found
+   */
+  bool checkReverseMatches(EntryId old_entry,
+    const std::vector<cv::KeyPoint> &keys, 
+    const std::vector<TDescriptor> &descriptors, tWorkspace &ws) const;
 
   /**
    * Creates a flann structure from a set of descriptors to perform queries
    * @param descriptors
-   * @param flann_structure (out) flann matcher
+   * @param ws (out) working memory whose flann structure is built
    */
   void getFlannStructure(const std::vector<TDescriptor> &descriptors, 
-    cv::FlannBasedMatcher &flann_structure) const;
+    tWorkspace &ws) const;
 
   /**
    * Check if an old entry is geometrically consistent (by calculating a
    * fundamental matrix from left-right correspondences) with the given set 
    * of keys and descriptors,
    * without using the direct index
-   * @param old_keys keys of old entry
-   * @param old_descriptors descriptors of old keys
+   * @param old_entry entry id of the stored image to check
    * @param cur_keys keys of current entry
    * @param cur_descriptors descriptors of cur keys
+   * @param ws working memory
+   */
+  bool isGeometricallyConsistent_Exhaustive(EntryId old_entry,
+    const std::vector<cv::KeyPoint> &cur_keys,
+    const Span<TDescriptor> &cur_descriptors, tWorkspace &ws) const; 
+
+  /**
+   * Checks if an old entry is geometrically consistent with the current
+   * keys and descriptors by using the model of the last loop: only
+   * correspondences close to its epipolar lines are considered, and those
+   * that still support it are verified with a few RANSAC iterations
+   * @param old_entry entry id of the stored image to check
+   * @param keys current keypoints
+   * @param descriptors current descriptors
+   * @param ws working memory
+   * @return true iff the fundamental matrix was found
+   */
+  bool isGeometricallyConsistent_Guided(EntryId old_entry,
+    const std::vector<cv::KeyPoint> &keys, 
+    const std::vector<TDescriptor> &descriptors, tWorkspace &ws) const;
+
+  /**
+   * Says whether the model of the last loop can be used to check the given
+   * island, i.e. the island is consistent with the island of that loop
+   * and the query is close to its query
+   * @param island island to check
+   * @param entry_id current entry
+   * @return true iff the guided matching can be tried
+   */
+  bool continuesLastModel(const tIsland &island, EntryId entry_id) const;
+
+  /**
+   * Checks if there is a fundamental matrix supported by the given 
+   * correspondences between an old entry and the current keypoints
+   * @param old_entry entry id of the stored image
+   * @param i_old indices of the keypoints of the old entry
+   * @param cur_keys keypoints of the current entry
+   * @param i_cur indices of the corresponding keypoints in cur_keys
+   * @param ws working memory
+   * @return true iff the fundamental matrix was found
+   */
+  bool checkFundamentalMatrix(EntryId old_entry,
+    const vector<unsigned int> &i_old,
+    const std::vector<cv::KeyPoint> &cur_keys,
+    const vector<unsigned int> &i_cur, tWorkspace &ws) const;
+
+  /**
+   * Runs the tests of Parameters::cascade on some correspondences between
+   * an old entry and the current keypoints, whose coordinates are in 
+   * ws.old_points and ws.cur_points
+   * @param old_entry entry id of the stored image
+   * @param i_old indices of the keypoints of the old entry
+   * @param cur_keys keypoints of the current entry
+   * @param i_cur indices of the corresponding keypoints in cur_keys
+   * @param ws working memory
+   * @return stage that rejected the correspondences, STAGE_NONE if they
+   *   passed all the tests
    */
-  bool isGeometricallyConsistent_Exhaustive(
-    const std::vector<cv::KeyPoint> &old_keys,
-    const std::vector<TDescriptor> &old_descriptors,
+  VerificationStage checkCascade(EntryId old_entry,
+    const vector<unsigned int> &i_old,
     const std::vector<cv::KeyPoint> &cur_keys,
-    const std::vector<TDescriptor> &cur_descriptors) const; 
+    const vector<unsigned int> &i_cur, tWorkspace &ws) const;
+
+  /**
+   * Checks if there is a fundamental matrix supported by the 
+   * correspondences whose coordinates are in ws.old_points and 
+   * ws.cur_points, and whose descriptor distances are in ws.distances.
+   * With Parameters::reuse_last_model, the matrix and its inliers are left
+   * in ws.fmatrix and ws.i_inliers. The number of inliers is left in
+   * ws.inliers, if the estimator reports it
+   * @param i_old indices of the keypoints of the old entry
+   * @param ws working memory
+   * @param max_iterations max number of RANSAC iterations
+   * @return true iff the fundamental matrix was found
+   */
+  bool solveFundamentalMatrix(const vector<unsigned int> &i_old, 
+    tWorkspace &ws, int max_iterations) const;
+
+  /**
+   * Says whether the intrinsic parameters of the camera are valid, so 
+   * that pixels can be back-projected with them
+   * @return true iff the focal lengths are positive
+   */
+  inline bool hasIntrinsics() const
+  {
+    return m_params.fx > 0 && m_params.fy > 0;
+  }
+
+  /**
+   * Says whether the geometrical check against an old entry estimates its
+   * relative pose, i.e. MODEL_POSE is used with valid intrinsics and the 
+   * entry has 3D points
+   * @param old_entry entry id of the stored image
+   * @param ws working memory
+   * @return true iff solvePose must be used
+   */
+  inline bool usesPose(EntryId old_entry, const tWorkspace &ws) const
+  {
+    return m_params.model == MODEL_POSE && hasIntrinsics() &&
+      !storedPoints3D(old_entry, ws).empty();
+  }
+
+  /**
+   * Checks if there is a pose of the current camera supported by the 3D
+   * points of the old entry and the correspondences whose coordinates are
+   * in ws.cur_points. The pose is left in ws.R and ws.t, and the
+   * fundamental matrix it induces, its inliers and their number as in
+   * solveFundamentalMatrix
+   * @param old_entry entry id of the stored image
+   * @param i_old indices of the keypoints of the old entry
+   * @param ws working memory
+   * @param max_iterations max number of RANSAC iterations
+   * @return true iff the pose was found
+   */
+  bool solvePose(EntryId old_entry, const vector<unsigned int> &i_old, 
+    tWorkspace &ws, int max_iterations) const;
 
   /**
    * Calculate the matches between the descriptors A[i_A] and the descriptors
-   * B[i_B]. Applies a left-right matching without neighbour ratio 
+   * B[i_B] that pass the neighbour ratio test, and adds them to the table
+   * (queries are indices of A, targets are indices of B). If a descriptor 
+   * of B is matched several times, only the closest match is kept.
+   * With Parameters::cross_check, the matches found are also checked
+   * from B to A
+   * @param A set A of descriptors
+   * @param i_A only descriptors A[i_A] will be checked
+   * @param B set B of descriptors
+   * @param i_B only descriptors B[i_B] will be checked
+   * @param table table to add the matches to
+   * @param kernel distance kernel to use
+   */
+  void getMatches_neighratio(const Span<TDescriptor> &A, 
+    const vector<unsigned int> &i_A, const Span<TDescriptor> &B,
+    const vector<unsigned int> &i_B, MatchTable &table,
+    DistanceKernel<TDescriptor, F> &kernel) const;
+
+  /**
+   * Same as getMatches_neighratio, with the same result, but the 
+   * descriptors of A are compared in blocks with tiles of B, in parallel 
+   * (Parameters::exhaustive_threads and exhaustive_tile)
    * @param A set A of descriptors
    * @param i_A only descriptors A[i_A] will be checked
    * @param B set B of descriptors
    * @param i_B only descriptors B[i_B] will be checked
-   * @param i_match_A (out) indices of descriptors matched (s.t. A[i_match_A])
-   * @param i_match_B (out) indices of descriptors matched (s.t. B[i_match_B])
+   * @param table table to add the matches to
+   * @param ws working memory
+   */
+  void getMatches_tiled(const Span<TDescriptor> &A, 
+    const vector<unsigned int> &i_A, const Span<TDescriptor> &B,
+    const vector<unsigned int> &i_B, MatchTable &table, tWorkspace &ws) const;
+
+  /**
+   * Finds the two nearest descriptors T[i_T] of each descriptor Q[i_Q] by
+   * tiles, in parallel, and leaves them in ws.nn_j, nn_d1 and nn_d2, as
+   * DistanceKernel::nearest2 does
+   * @param Q query descriptors
+   * @param i_Q indices of the queries
+   * @param T candidate descriptors
+   * @param i_T indices of the candidates
+   * @param ws working memory
+   */
+  void nearestTiled(const Span<TDescriptor> &Q, 
+    const vector<unsigned int> &i_Q, const Span<TDescriptor> &T,
+    const vector<unsigned int> &i_T, tWorkspace &ws) const;
+
+  /**
+   * Rejects the matches of the table, from the given one on, whose query 
+   * descriptor A[query] is not the nearest one to B[target] among A[i_A]
+   * @param A set A of descriptors (queries)
+   * @param i_A candidate indices of A
+   * @param B set B of descriptors (targets)
+   * @param table matches
+   * @param first index of the first match of the table to check
+   * @param kernel distance kernel to use
    */
-  void getMatches_neighratio(const std::vector<TDescriptor> &A, 
-    const vector<unsigned int> &i_A, const vector<TDescriptor> &B,
-    const vector<unsigned int> &i_B,
-    vector<unsigned int> &i_match_A, vector<unsigned int> &i_match_B) const;
+  void crossCheckMatches(const Span<TDescriptor> &A,
+    const vector<unsigned int> &i_A, const Span<TDescriptor> &B,
+    MatchTable &table, size_t first, 
+    DistanceKernel<TDescriptor, F> &kernel) const;
 
 protected:
 
@@ -504,11 +1806,14 @@ protected:
   // The loop detector stores its own copy of the database
   TemplatedDatabase<TDescriptor,F> *m_database;
   
-  /// KeyPoints of images
-  vector<vector<cv::KeyPoint> > m_image_keys;
+  /// KeyPoints of images (or only their coordinates)
+  KeyPointStore m_image_keys;
   
-  /// Descriptors of images
-  vector<vector<TDescriptor> > m_image_descriptors;
+  /// Descriptors of images, packed contiguously per entry
+  PackedStore<TDescriptor> m_image_descriptors;
+  
+  /// 3D points of the keypoints of images, if given (MODEL_POSE)
+  PackedStore<cv::Point3f> m_image_points;
   
   /// Last bow vector added to database
   BowVector m_last_bowvec;
@@ -516,18 +1821,55 @@ protected:
   /// Temporal consistency window
   tTemporalWindow m_window;
   
+  /// Model of the last loop (with Parameters::reuse_last_model)
+  tVerifiedModel m_model;
+  
   /// Parameters of loop detector
   Parameters m_params;
   
   /// To compute the fundamental matrix
   DVision::FSolver m_fsolver;
   
+  /// Working memory of detectLoop
+  tWorkspace m_workspace;
+  
+  /// Working memory of the other workers of the verification (they are 
+  /// never moved)
+  std::deque<tWorkspace> m_workers;
+  
+  /// Workers of the verification
+  WorkerPool m_pool;
+  
+  /// Workers of the transformations of detectLoopBatch (not m_pool, which
+  /// its detections run)
+  WorkerPool m_batch_pool;
+  
+  /// Replicas of the entries for the views (Parameters::concurrent_reads)
+  mutable tReplica m_replicas[2];
+  
+  /// Replica that new views use
+  std::atomic<int> m_published;
+  
+  /// Vectors of the entries that some replica has not added yet (the 
+  /// first m_pending_size ones). The others are kept to reuse their nodes
+  std::vector<std::pair<BowVector, FeatureVector> > m_pending;
+  
+  /// Number of entries of m_pending
+  size_t m_pending_size;
+  
+  /// Entry of the first vectors of m_pending
+  EntryId m_pending_first;
+  
+  /// Number of times the detector has been cleared
+  unsigned long m_clears;
+  
 };
 
 // --------------------------------------------------------------------------
 
-template <class TDescriptor, class F> 
-TemplatedLoopDetector<TDescriptor,F>::Parameters::Parameters():
+template<class TDescriptor, class F, class TGeomCheck>
+TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::Parameters::Parameters():
+  image_rows(0), image_cols(0),
   use_nss(true), alpha(0.3), k(4), geom_check(GEOM_DI), di_levels(0)
 {
   set(1);
@@ -535,8 +1877,8 @@ TemplatedLoopDetector<TDescriptor,F>::Parameters::Parameters():
 
 // --------------------------------------------------------------------------
 
-template <class TDescriptor, class F> 
-TemplatedLoopDetector<TDescriptor,F>::Parameters::Parameters
+template<class TDescriptor, class F, class TGeomCheck>
+TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::Parameters::Parameters
   (int height, int width, float frequency, bool nss, float _alpha, 
   int _k, GeometricalCheck geom, int dilevels)
   : image_rows(height), image_cols(width), use_nss(nss), alpha(_alpha), k(_k),
@@ -547,12 +1889,13 @@ TemplatedLoopDetector<TDescriptor,F>::Parameters::Parameters
 
 // --------------------------------------------------------------------------
 
-template <class TDescriptor, class F> 
-void TemplatedLoopDetector<TDescriptor,F>::Parameters::set(float f)
+template<class TDescriptor, class F, class TGeomCheck>
+void TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::Parameters::set(float f)
 {
   dislocal = 20 * f;
   max_db_results = 50 * f;
   min_nss_factor = 0.005;
+  min_query_score = 0.05;
   min_matches_per_group = f;
   max_intragroup_gap = 3 * f;
   max_distance_between_groups = 3 * f;
@@ -562,75 +1905,124 @@ void TemplatedLoopDetector<TDescriptor,F>::Parameters::set(float f)
   max_ransac_iterations = 500;
   ransac_probability = 0.99;
   max_reprojection_error = 2.0;
+  estimator = ESTIMATOR_RANSAC;
+  estimator_threads = 1;
+  model = MODEL_FUNDAMENTAL;
+  fx = fy = 0;
+  cx = cy = 0;
+  
+  reuse_last_model = false;
+  guided_epipolar_distance = 8.0;
+  guided_ransac_iterations = 50;
+  
+  cascade = 0;
+  cascade_min_matches = 20;
+  cascade_bins = 12;
+  cascade_min_consistency = 0.3;
+  cascade_affine_iterations = 50;
+  cascade_affine_error = 20.0;
+  
+  verify_islands = 1;
+  verify_entries = 1;
+  verify_threads = 1;
+  batch_threads = 0;
   
   max_neighbor_ratio = 0.6;
+  cross_check = false;
+  exhaustive_threads = 1;
+  exhaustive_tile = 0;
+  
+  max_stored_keys = 0;
+  max_verified_keys = 0;
+  budget_grid = 8;
+  
+  key_storage = KEYS_FULL;
+  index_cache_size = 0;
+  concurrent_reads = false;
 }
 
 // --------------------------------------------------------------------------
 
-template<class TDescriptor, class F>
-TemplatedLoopDetector<TDescriptor,F>::TemplatedLoopDetector
+template<class TDescriptor, class F, class TGeomCheck>
+TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::TemplatedLoopDetector
   (const Parameters &params)
-  : m_database(NULL), m_params(params)
+  : m_database(NULL), 
+    m_image_keys(params.key_storage, 
+      std::max(params.image_rows, params.image_cols)),
+    m_params(params), m_published(0), m_pending_size(0),
+    m_pending_first(0), m_clears(0)
 {
 }
 
 // --------------------------------------------------------------------------
 
-template<class TDescriptor, class F>
-TemplatedLoopDetector<TDescriptor,F>::TemplatedLoopDetector
+template<class TDescriptor, class F, class TGeomCheck>
+TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::TemplatedLoopDetector
   (const TemplatedVocabulary<TDescriptor, F> &voc, const Parameters &params)
-  : m_params(params) 
+  : m_image_keys(params.key_storage, 
+      std::max(params.image_rows, params.image_cols)),
+    m_params(params), m_published(0), m_pending_size(0),
+    m_pending_first(0), m_clears(0)
 {
   m_database = new TemplatedDatabase<TDescriptor, F>(voc, 
-    params.geom_check == GEOM_DI, params.di_levels);
+    TGeomCheck::get(params.geom_check) == GEOM_DI, params.di_levels);
   
   m_fsolver.setImageSize(params.image_cols, params.image_rows);
+  resetReplicas();
 }
 
 // --------------------------------------------------------------------------
 
-template<class TDescriptor, class F>
-void TemplatedLoopDetector<TDescriptor,F>::setVocabulary
+template<class TDescriptor, class F, class TGeomCheck>
+void TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::setVocabulary
   (const TemplatedVocabulary<TDescriptor, F>& voc)
 {
   delete m_database;
   m_database = new TemplatedDatabase<TDescriptor, F>(voc, 
-    m_params.geom_check == GEOM_DI, m_params.di_levels);
+    geomCheck() == GEOM_DI, m_params.di_levels);
+  resetReplicas();
 }
 
 // --------------------------------------------------------------------------
 
-template<class TDescriptor, class F>
-TemplatedLoopDetector<TDescriptor, F>::TemplatedLoopDetector
+template<class TDescriptor, class F, class TGeomCheck>
+TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::TemplatedLoopDetector
   (const TemplatedDatabase<TDescriptor, F> &db, const Parameters &params)
-  : m_params(params)
+  : m_image_keys(params.key_storage, 
+      std::max(params.image_rows, params.image_cols)),
+    m_params(params), m_published(0), m_pending_size(0),
+    m_pending_first(0), m_clears(0)
 {
   m_database = new TemplatedDatabase<TDescriptor, F>(db.getVocabulary(),
-    params.geom_check == GEOM_DI, params.di_levels);
+    TGeomCheck::get(params.geom_check) == GEOM_DI, params.di_levels);
   
   m_fsolver.setImageSize(params.image_cols, params.image_rows);
+  resetReplicas();
 }
 
 // --------------------------------------------------------------------------
 
-template<class TDescriptor, class F>
+template<class TDescriptor, class F, class TGeomCheck>
 template<class T>
-TemplatedLoopDetector<TDescriptor, F>::TemplatedLoopDetector
+TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::TemplatedLoopDetector
   (const T &db, const Parameters &params)
-  : m_params(params)
+  : m_image_keys(params.key_storage, 
+      std::max(params.image_rows, params.image_cols)),
+    m_params(params), m_published(0), m_pending_size(0),
+    m_pending_first(0), m_clears(0)
 {
   m_database = new T(db);
   m_database->clear();
   
   m_fsolver.setImageSize(params.image_cols, params.image_rows);
+  resetReplicas();
 }
 
 // --------------------------------------------------------------------------
 
-template<class TDescriptor, class F>
+template<class TDescriptor, class F, class TGeomCheck>
 template<class T>
-void TemplatedLoopDetector<TDescriptor, F>::setDatabase(const T &db)
+void TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::setDatabase(const T &db)
 {
   delete m_database;
   m_database = new T(db);
@@ -639,8 +2031,8 @@ void TemplatedLoopDetector<TDescriptor, F>::setDatabase(const T &db)
 
 // --------------------------------------------------------------------------
 
-template<class TDescriptor, class F>
-TemplatedLoopDetector<TDescriptor, F>::~TemplatedLoopDetector(void)
+template<class TDescriptor, class F, class TGeomCheck>
+TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::~TemplatedLoopDetector(void)
 {
   delete m_database;
   m_database = NULL;
@@ -648,92 +2040,268 @@ TemplatedLoopDetector<TDescriptor, F>::~TemplatedLoopDetector(void)
 
 // --------------------------------------------------------------------------
 
-template<class TDescriptor, class F>
-void TemplatedLoopDetector<TDescriptor,F>::allocate
+template<class TDescriptor, class F, class TGeomCheck>
+void TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::allocate
   (int nentries, int nkeys)
 {
-  const int sz = (const int)m_image_keys.size();
-  
-  if(sz < nentries)
+  if(geomCheck() != GEOM_NONE)
   {
-    m_image_keys.resize(nentries);
-    m_image_descriptors.resize(nentries);
+    m_image_keys.reserve(nentries, nkeys);
+    m_image_descriptors.reserve(nentries, (size_t)nentries * nkeys);
+    if(m_params.model == MODEL_POSE)
+      m_image_points.reserve(nentries, (size_t)nentries * nkeys);
+    m_workspace.reserve(nkeys, m_params.max_db_results);
   }
-  
-  if(nkeys > 0)
+  else
   {
-    for(int i = sz; i < nentries; ++i)
-    {
-      m_image_keys[i].reserve(nkeys);
-      m_image_descriptors[i].reserve(nkeys);
-    }
+    m_workspace.reserve(0, m_params.max_db_results);
   }
   
+  // the reserved memory is not growth of a detection
+  m_workspace.last_footprint = workspaceFootprint();
+  
   m_database->allocate(nentries, nkeys);
 }
 
 // --------------------------------------------------------------------------
 
-template<class TDescriptor, class F>
+template<class TDescriptor, class F, class TGeomCheck>
 inline const TemplatedDatabase<TDescriptor, F>& 
-TemplatedLoopDetector<TDescriptor, F>::getDatabase() const
+TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::getDatabase() const
 {
   return *m_database;
 }
 
 // --------------------------------------------------------------------------
 
-template<class TDescriptor, class F>
+template<class TDescriptor, class F, class TGeomCheck>
 inline const TemplatedVocabulary<TDescriptor, F>& 
-TemplatedLoopDetector<TDescriptor, F>::getVocabulary() const
+TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::getVocabulary() const
 {
   return m_database->getVocabulary();
 }
 
 // --------------------------------------------------------------------------
 
-template<class TDescriptor, class F>
-bool TemplatedLoopDetector<TDescriptor, F>::detectLoop(
+template<class TDescriptor, class F, class TGeomCheck>
+bool TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::detectLoop(
   const std::vector<cv::KeyPoint> &keys, 
   const std::vector<TDescriptor> &descriptors,
   DetectionResult &match)
 {
-  EntryId entry_id = m_database->size();
-  match.query = entry_id;
+  const bool budget = applyBudget(keys, descriptors, m_workspace);
+  const std::vector<cv::KeyPoint> &k = 
+    (budget ? m_workspace.kept_keys : keys);
+  const std::vector<TDescriptor> &d = 
+    (budget ? m_workspace.kept_descriptors : descriptors);
   
-  BowVector bowvec;
-  FeatureVector featvec;
+  processEntry(k, d, match);
   
-  if(m_params.geom_check == GEOM_DI)
-    m_database->getVocabulary()->transform(descriptors, bowvec, featvec,
-      m_params.di_levels);
+  // update record (GEOM_NONE never reads it)
+  if(geomCheck() != GEOM_NONE)
+  {
+    m_image_keys.set(match.query, k);
+    m_image_descriptors.set(match.query, d);
+  }
+  
+  finishEntry();
+  return match.detection();
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TGeomCheck>
+bool TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::detectLoop(
+  const std::vector<cv::KeyPoint> &keys, 
+  const std::vector<TDescriptor> &descriptors,
+  const BowVector &bowvec, const FeatureVector *featvec, int di_levels,
+  DetectionResult &match)
+{
+  // a feature vector of another level cannot be used by the direct index
+  if(di_levels != m_params.di_levels) featvec = NULL;
+  
+  const bool budget = applyBudget(keys, descriptors, m_workspace);
+  
+  const std::vector<cv::KeyPoint> &k = 
+    (budget ? m_workspace.kept_keys : keys);
+  const std::vector<TDescriptor> &d = 
+    (budget ? m_workspace.kept_descriptors : descriptors);
+  
+  // the given vectors describe all the features: if some were dropped, the
+  // kept ones are transformed again; if they were only sorted, the bow 
+  // vector is still valid, but the feature vector does not index them
+  if(budget && d.size() < descriptors.size()) 
+    processEntry(k, d, match);
   else
-    m_database->getVocabulary()->transform(descriptors, bowvec);
+    processEntry(k, d, match, &bowvec, budget ? NULL : featvec);
+  
+  if(geomCheck() != GEOM_NONE)
+  {
+    m_image_keys.set(match.query, k);
+    m_image_descriptors.set(match.query, d);
+  }
+  
+  finishEntry();
+  return match.detection();
+}
 
-  if((int)entry_id <= m_params.dislocal)
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TGeomCheck>
+bool TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::detectLoop(
+  const std::vector<cv::KeyPoint> &keys, 
+  const std::vector<TDescriptor> &descriptors,
+  const std::vector<cv::Point3f> &points, DetectionResult &match)
+{
+  tWorkspace &ws = m_workspace;
+  const bool budget = applyBudget(keys, descriptors, m_workspace);
+  if(budget)
   {
-    // only add the entry to the database and finish
-    m_database->add(bowvec, featvec);
-    match.status = CLOSE_MATCHES_ONLY;
+    ws.kept_points.resize(ws.ranked.size());
+    for(size_t i = 0; i < ws.ranked.size(); ++i)
+      ws.kept_points[i] = (ws.ranked[i] < points.size() ? 
+        points[ws.ranked[i]] : cv::Point3f(0, 0, 0));
   }
-  else
+  
+  const std::vector<cv::KeyPoint> &k = (budget ? ws.kept_keys : keys);
+  const std::vector<TDescriptor> &d = 
+    (budget ? ws.kept_descriptors : descriptors);
+  
+  processEntry(k, d, match);
+  
+  if(geomCheck() != GEOM_NONE)
   {
-    int max_id = (int)entry_id - m_params.dislocal;
+    m_image_keys.set(match.query, k);
+    m_image_descriptors.set(match.query, d);
     
-    QueryResults qret;
-    m_database->query(bowvec, qret, m_params.max_db_results, max_id);
+    // the entries added without points have none
+    while(m_image_points.size() < match.query)
+      m_image_points.assign(m_image_points.size(), 0);
+    m_image_points.set(match.query, budget ? ws.kept_points : points);
+  }
+  
+  finishEntry();
+  return match.detection();
+}
 
-    // update database
-    m_database->add(bowvec, featvec); // returns entry_id
-    
-    if(!qret.empty())
-    {
-      // factor to compute normalized similarity score, if necessary
-      double ns_factor = 1.0;
-      
-      if(m_params.use_nss)
-      {
-        ns_factor = m_database->getVocabulary()->score(bowvec, m_last_bowvec);
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TGeomCheck>
+bool TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::detectLoop(
+  const std::vector<cv::KeyPoint> &keys, 
+  const std::vector<TDescriptor> &descriptors,
+  const std::vector<float> &depths, DetectionResult &match)
+{
+  tWorkspace &ws = m_workspace;
+  const bool budget = applyBudget(keys, descriptors, m_workspace);
+  if(budget)
+  {
+    ws.kept_depths.resize(ws.ranked.size());
+    for(size_t i = 0; i < ws.ranked.size(); ++i)
+      ws.kept_depths[i] = (ws.ranked[i] < depths.size() ? 
+        depths[ws.ranked[i]] : 0.f);
+  }
+  
+  const std::vector<cv::KeyPoint> &k = (budget ? ws.kept_keys : keys);
+  const std::vector<TDescriptor> &d = 
+    (budget ? ws.kept_descriptors : descriptors);
+  const std::vector<float> &z_k = (budget ? ws.kept_depths : depths);
+  
+  processEntry(k, d, match);
+  
+  if(geomCheck() != GEOM_NONE)
+  {
+    m_image_keys.set(match.query, k);
+    m_image_descriptors.set(match.query, d);
+    
+    while(m_image_points.size() < match.query)
+      m_image_points.assign(m_image_points.size(), 0);
+    
+    // back-projected straight into the store (no points without intrinsics)
+    const size_t n = (hasIntrinsics() ? std::min(k.size(), z_k.size()) : 0);
+    cv::Point3f *points = m_image_points.assign(match.query, n);
+    
+    for(size_t i = 0; i < n; ++i)
+    {
+      const float z = z_k[i];
+      if(z > 0)
+      {
+        points[i].x = z * (k[i].pt.x - m_params.cx) / m_params.fx;
+        points[i].y = z * (k[i].pt.y - m_params.cy) / m_params.fy;
+        points[i].z = z;
+      }
+      else
+      {
+        points[i] = cv::Point3f(0, 0, 0);
+      }
+    }
+  }
+  
+  finishEntry();
+  return match.detection();
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TGeomCheck>
+void TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::processEntry(
+  const std::vector<cv::KeyPoint> &keys, 
+  const std::vector<TDescriptor> &descriptors,
+  DetectionResult &match, const BowVector *given_bowvec,
+  const FeatureVector *given_featvec)
+{
+  EntryId entry_id = m_database->size();
+  match.query = entry_id;
+  match.inliers = 0;
+  match.has_pose = false;
+  match.rejected_by = STAGE_NONE;
+  
+  // buffers reused from previous calls
+  tWorkspace &ws = m_workspace;
+  QueryResults &qret = ws.qret;
+  
+  if(geomCheck() != GEOM_DI) ws.featvec.clear(); // not filled by transform
+  
+  // the given vectors are used if they are enough for the geometrical check
+  const bool given = given_bowvec != NULL && 
+    (geomCheck() != GEOM_DI || given_featvec != NULL);
+  
+  if(!given)
+  {
+    if(geomCheck() == GEOM_DI)
+      m_database->getVocabulary()->transform(descriptors, ws.bowvec, 
+        ws.featvec, m_params.di_levels);
+    else
+      m_database->getVocabulary()->transform(descriptors, ws.bowvec);
+  }
+  
+  const BowVector &bowvec = (given ? *given_bowvec : ws.bowvec);
+  const FeatureVector &featvec = 
+    (given && geomCheck() == GEOM_DI ? *given_featvec : ws.featvec);
+
+  if((int)entry_id <= m_params.dislocal)
+  {
+    // only add the entry to the database and finish
+    m_database->add(bowvec, featvec);
+    match.status = CLOSE_MATCHES_ONLY;
+  }
+  else
+  {
+    int max_id = (int)entry_id - m_params.dislocal;
+    
+    m_database->query(bowvec, qret, m_params.max_db_results, max_id);
+
+    // update database
+    m_database->add(bowvec, featvec); // returns entry_id
+    
+    if(!qret.empty())
+    {
+      // factor to compute normalized similarity score, if necessary
+      double ns_factor = 1.0;
+      
+      if(m_params.use_nss)
+      {
+        ns_factor = m_database->getVocabulary()->score(bowvec, m_last_bowvec);
       }
       
       if(!m_params.use_nss || ns_factor >= m_params.min_nss_factor)
@@ -752,13 +2320,14 @@ bool TemplatedLoopDetector<TDescriptor, F>::detectLoop(
           match.match = qret[0].Id;
           
           // compute islands
-          vector<tIsland> islands;
+          vector<tIsland> &islands = ws.islands;
           computeIslands(qret, islands); 
           // this modifies qret and changes the score order
           
           // get best island
           if(!islands.empty())
           {
+            // (the first one of getCandidates too)
             const tIsland& island = 
               *std::max_element(islands.begin(), islands.end());
             
@@ -772,41 +2341,49 @@ bool TemplatedLoopDetector<TDescriptor, F>::detectLoop(
             {
               // candidate loop detected
               // check geometry
-              bool detection;
-
-              if(m_params.geom_check == GEOM_DI)
-              {
-                // all the DI stuff is implicit in the database
-                detection = isGeometricallyConsistent_DI(island.best_entry, 
-                  keys, descriptors, featvec);
-              }
-              else if(m_params.geom_check == GEOM_FLANN)
-              {
-                cv::FlannBasedMatcher flann_structure;
-                getFlannStructure(descriptors, flann_structure);
-                            
-                detection = isGeometricallyConsistent_Flann(island.best_entry, 
-                  keys, descriptors, flann_structure);
-              }
-              else if(m_params.geom_check == GEOM_EXHAUSTIVE)
-              { 
-                detection = isGeometricallyConsistent_Exhaustive(
-                  m_image_keys[island.best_entry], 
-                  m_image_descriptors[island.best_entry],
-                  keys, descriptors);            
-              }
-              else // GEOM_NONE, accept the match
-              {
-                detection = true;
-              }
+              getCandidates(qret, islands, ws);
+              
+              const bool trim = trimFeatures(keys, descriptors, ws);
+              const int c = verifyCandidates(entry_id, 
+                trim ? ws.verified_keys : keys, 
+                trim ? ws.verified_descriptors : descriptors, featvec);
               
-              if(detection)
+              if(c >= 0)
               {
+                // the result is in the workspace that verified it
+                const tCandidate &cand = ws.candidates[c];
+                const tIsland &vi = islands[cand.island];
+                const tWorkspace &vws = workspace(ws.cand_worker[c]);
+                
                 match.status = LOOP_DETECTED;
+                match.match = cand.entry;
+                match.inliers = ws.cand_inliers[c];
+                
+                if(vws.has_pose)
+                {
+                  match.has_pose = true;
+                  std::copy(vws.R, vws.R + 9, match.R);
+                  std::copy(vws.t, vws.t + 3, match.t);
+                }
+                
+                if(m_params.reuse_last_model && geomCheck() != GEOM_NONE)
+                {
+                  m_model.valid = true;
+                  m_model.first = vi.first;
+                  m_model.last = vi.last;
+                  m_model.old_entry = cand.entry;
+                  m_model.query = entry_id;
+                  std::copy(vws.fmatrix, vws.fmatrix + 9, m_model.fmatrix);
+                  m_model.i_inliers.assign(vws.i_inliers.begin(), 
+                    vws.i_inliers.end());
+                }
               }
               else
               {
                 match.status = NO_GEOMETRICAL_CONSISTENCY;
+                match.inliers = ws.cand_inliers[0];
+                match.rejected_by = ws.cand_stage[0];
+                m_model.valid = false;
               }
               
             } // if enough temporal matches
@@ -837,350 +2414,1358 @@ bool TemplatedLoopDetector<TDescriptor, F>::detectLoop(
     }
   }
 
-  // update record
-  // m_image_keys and m_image_descriptors have the same length
-  if(m_image_keys.size() == entry_id)
-  {
-    m_image_keys.push_back(keys);
-    m_image_descriptors.push_back(descriptors);
-  }
-  else
+  // the replicas add the entry later (the maps reuse the nodes of some
+  // entry already added)
+  if(m_params.concurrent_reads)
   {
-    m_image_keys[entry_id] = keys;
-    m_image_descriptors[entry_id] = descriptors;
+    if(m_pending_size == m_pending.size()) 
+      m_pending.push_back(std::make_pair(bowvec, featvec));
+    else
+    {
+      m_pending[m_pending_size].first = bowvec;
+      m_pending[m_pending_size].second = featvec;
+    }
+    ++m_pending_size;
   }
-  
+
   // store this bowvec if we are going to use it in next iteratons
+  // (swapped instead of copied if it is ours, it is not used any more)
   if(m_params.use_nss && (int)entry_id + 1 > m_params.dislocal)
   {
-    m_last_bowvec = bowvec;
+    if(given) m_last_bowvec = bowvec;
+    else m_last_bowvec.swap(ws.bowvec);
   }
-
-  return match.detection();
 }
 
 // --------------------------------------------------------------------------
 
-template<class TDescriptor, class F>
-inline void TemplatedLoopDetector<TDescriptor, F>::clear()
+template<class TDescriptor, class F, class TGeomCheck>
+bool TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::transform(
+  const std::vector<cv::KeyPoint> &keys, 
+  const std::vector<TDescriptor> &descriptors, 
+  BowVector &bowvec, FeatureVector &featvec) const
 {
-  m_database->clear();
-  m_window.nentries = 0;
+  // the budget may drop features, or reorder those of the feature vector
+  const size_t n = std::min(keys.size(), descriptors.size());
+  if((m_params.max_stored_keys > 0 && n > (size_t)m_params.max_stored_keys)
+    || (geomCheck() == GEOM_DI && m_params.max_verified_keys > 0))
+    return false;
+  
+  if(geomCheck() == GEOM_DI)
+  {
+    m_database->getVocabulary()->transform(descriptors, bowvec, featvec,
+      m_params.di_levels);
+  }
+  else
+  {
+    m_database->getVocabulary()->transform(descriptors, bowvec);
+    featvec.clear();
+  }
+  return true;
 }
 
 // --------------------------------------------------------------------------
 
-template<class TDescriptor, class F>
-void TemplatedLoopDetector<TDescriptor, F>::computeIslands
-  (QueryResults &q, vector<tIsland> &islands) const
+template<class TDescriptor, class F, class TGeomCheck>
+unsigned int TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::
+detectLoopBatch(const std::vector<std::vector<cv::KeyPoint> > &keys, 
+  const std::vector<std::vector<TDescriptor> > &descriptors,
+  std::vector<DetectionResult> &matches)
 {
-  islands.clear();
+  const size_t n = std::min(keys.size(), descriptors.size());
+  matches.resize(n);
   
-  if(q.size() == 1)
-  {
-    islands.push_back(tIsland(q[0].Id, q[0].Id, calculateIslandScore(q, 0, 0)));
-    islands.back().best_entry = q[0].Id;
-    islands.back().best_score = q[0].Score;
-  }
-  else if(!q.empty())
+  int threads = m_params.batch_threads;
+  if(threads <= 0) 
+    threads = std::max((int)std::thread::hardware_concurrency(), 1);
+  
+  WorkerPool &pool = m_batch_pool;
+  pool.resize(threads);
+  
+  // the vectors of a chunk are kept at the same time
+  const size_t chunk = 32 * (size_t)threads;
+  vector<BowVector> bowvecs(std::min(chunk, n));
+  vector<FeatureVector> featvecs(bowvecs.size());
+  vector<unsigned char> transformed(bowvecs.size());
+  
+  unsigned int loops = 0;
+  
+  for(size_t c0 = 0; c0 < n; c0 += chunk)
   {
-    // sort query results in ascending order of ids
-    std::sort(q.begin(), q.end(), Result::ltId);
+    const size_t c1 = std::min(c0 + chunk, n);
     
-    // create long enough islands
-    QueryResults::const_iterator dit = q.begin();
-    int first_island_entry = dit->Id;
-    int last_island_entry = dit->Id;
-    
-    // these are indices of q
-    unsigned int i_first = 0;
-    unsigned int i_last = 0;
+    pool.run((int)(c1 - c0), [&](int i, int)
+    {
+      transformed[i] = transform(keys[c0 + i], descriptors[c0 + i], 
+        bowvecs[i], featvecs[i]);
+    });
     
-    double best_score = dit->Score;
-    EntryId best_entry = dit->Id;
-
-    ++dit;
-    for(unsigned int idx = 1; dit != q.end(); ++dit, ++idx)
+    for(size_t i = c0; i < c1; ++i)
     {
-      if((int)dit->Id - last_island_entry < m_params.max_intragroup_gap)
-      {
-        // go on until find the end of the island
-        last_island_entry = dit->Id;
-        i_last = idx;
-        if(dit->Score > best_score)
-        {
-          best_score = dit->Score;
-          best_entry = dit->Id;
-        }
-      }
+      const size_t k = i - c0;
+      if(transformed[k])
+        detectLoop(keys[i], descriptors[i], bowvecs[k], &featvecs[k], 
+          m_params.di_levels, matches[i]);
       else
-      {
-        // end of island reached
-        int length = last_island_entry - first_island_entry + 1;
-        if(length >= m_params.min_matches_per_group)
-        {
-          islands.push_back( tIsland(first_island_entry, last_island_entry,
-            calculateIslandScore(q, i_first, i_last)) );
-          
-          islands.back().best_score = best_score;
-          islands.back().best_entry = best_entry;
-        }
-        
-        // prepare next island
-        first_island_entry = last_island_entry = dit->Id;
-        i_first = i_last = idx;
-        best_score = dit->Score;
-        best_entry = dit->Id;
-      }
-    }
-    // add last island
-    if(last_island_entry - first_island_entry + 1 >= 
-      m_params.min_matches_per_group)
-    {
-      islands.push_back( tIsland(first_island_entry, last_island_entry,
-        calculateIslandScore(q, i_first, i_last)) );
-        
-      islands.back().best_score = best_score;
-      islands.back().best_entry = best_entry;
+        detectLoop(keys[i], descriptors[i], matches[i]);
+      
+      if(matches[i].detection()) ++loops;
     }
   }
   
+  return loops;
 }
 
 // --------------------------------------------------------------------------
 
-template<class TDescriptor, class F>
-double TemplatedLoopDetector<TDescriptor, F>::calculateIslandScore(
-  const QueryResults &q, unsigned int i_first, unsigned int i_last) const
+template<class TDescriptor, class F, class TGeomCheck>
+bool TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::query(
+  const std::vector<cv::KeyPoint> &keys, 
+  const std::vector<TDescriptor> &descriptors, DetectionResult &match,
+  QueryContext &context, bool verify) const
 {
-  // get the sum of the scores
-  double sum = 0;
-  while(i_first <= i_last) sum += q[i_first++].Score;
-  return sum;
+  // (an invalid view without concurrent_reads reads the detector)
+  ReadView view = read();
+  prepareContext(context, 1, view);
+  
+  queryEntry(keys, descriptors, match, verify, context.m_workspaces[0]);
+  return match.detection();
 }
 
 // --------------------------------------------------------------------------
 
-template<class TDescriptor, class F>
-void TemplatedLoopDetector<TDescriptor, F>::updateTemporalWindow
-  (const tIsland &matched_island, EntryId entry_id)
+template<class TDescriptor, class F, class TGeomCheck>
+unsigned int TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::queryBatch(
+  const std::vector<std::vector<cv::KeyPoint> > &keys, 
+  const std::vector<std::vector<TDescriptor> > &descriptors,
+  std::vector<DetectionResult> &matches, QueryContext &context, 
+  bool verify) const
 {
-  // if m_window.nentries > 0, island > m_window.last_matched_island and
-  // entry_id > m_window.last_query_id hold
+  const size_t n = std::min(keys.size(), descriptors.size());
+  matches.resize(n);
   
-  if(m_window.nentries == 0 || int(entry_id - m_window.last_query_id)
-    > m_params.max_distance_between_queries)
-  {
-    m_window.nentries = 1;
-  }
-  else
+  int threads = m_params.batch_threads;
+  if(threads <= 0) 
+    threads = std::max((int)std::thread::hardware_concurrency(), 1);
+  threads = (int)std::min<size_t>(threads, std::max<size_t>(n, 1));
+  
+  context.m_pool.resize(threads);
+  
+  // a workspace per worker, reused by its queries, which read the same 
+  // view of the entries
+  ReadView view = read();
+  prepareContext(context, threads, view);
+  
+  context.m_pool.run((int)n, [&](int i, int w)
   {
-    EntryId a1 = m_window.last_matched_island.first;
-    EntryId a2 = m_window.last_matched_island.last;
-    EntryId b1 = matched_island.first;
-    EntryId b2 = matched_island.last;
-    
-    bool fit = (b1 <= a1 && a1 <= b2) || (a1 <= b1 && b1 <= a2);
+    queryEntry(keys[i], descriptors[i], matches[i], verify, 
+      context.m_workspaces[w]);
+  });
+  
+  unsigned int found = 0;
+  for(size_t i = 0; i < n; ++i) if(matches[i].detection()) ++found;
+  return found;
+}
 
-    if(!fit)
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TGeomCheck>
+void TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::prepareContext(
+  QueryContext &context, int n, const ReadView &view) const
+{
+  while((int)context.m_workspaces.size() < n) 
+    context.m_workspaces.emplace_back();
+  
+  // the ids of the cached entries may belong to other entries now
+  const bool cleared = context.m_clears != m_clears;
+  context.m_clears = m_clears;
+  
+  for(size_t i = 0; i < context.m_workspaces.size(); ++i)
+  {
+    tWorkspace &ws = context.m_workspaces[i];
+    if(cleared)
     {
-      int d1 = (int)a1 - (int)b2;
-      int d2 = (int)b1 - (int)a2;
-      int gap = (d1 > d2 ? d1 : d2);
-      
-      fit = (gap <= m_params.max_distance_between_groups);
+      ws.flann_cache.clear();
+      ws.index_cache.clear();
     }
-    
-    if(fit) m_window.nentries++;
-    else m_window.nentries = 1;
+    ws.replica = view.m_replica;
   }
-  
-  m_window.last_matched_island = matched_island;
-  m_window.last_query_id = entry_id;
 }
 
 // --------------------------------------------------------------------------
 
-template<class TDescriptor, class F>
-bool TemplatedLoopDetector<TDescriptor, F>::isGeometricallyConsistent_DI(
-  EntryId old_entry, const std::vector<cv::KeyPoint> &keys, 
-  const std::vector<TDescriptor> &descriptors, 
-  const FeatureVector &bowvec) const
+template<class TDescriptor, class F, class TGeomCheck>
+void TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::queryEntry(
+  const std::vector<cv::KeyPoint> &keys, 
+  const std::vector<TDescriptor> &descriptors, DetectionResult &match,
+  bool verify, tWorkspace &ws) const
 {
-  const FeatureVector &oldvec = m_database->retrieveFeatures(old_entry);
+  const EntryId entry_id = database(ws).size();
+  match.query = entry_id;
+  match.match = 0;
+  match.inliers = 0;
+  match.has_pose = false;
+  match.rejected_by = STAGE_NONE;
   
-  // for each word in common, get the closest descriptors
+  // the same features as if the image were added
+  const bool budget = applyBudget(keys, descriptors, ws);
+  const std::vector<cv::KeyPoint> &k = (budget ? ws.kept_keys : keys);
+  const std::vector<TDescriptor> &d = 
+    (budget ? ws.kept_descriptors : descriptors);
   
-  vector<unsigned int> i_old, i_cur;
+  if(geomCheck() == GEOM_DI)
+  {
+    m_database->getVocabulary()->transform(d, ws.bowvec, ws.featvec, 
+      m_params.di_levels);
+  }
+  else
+  {
+    m_database->getVocabulary()->transform(d, ws.bowvec);
+    ws.featvec.clear();
+  }
   
-  FeatureVector::const_iterator old_it, cur_it; 
-  const FeatureVector::const_iterator old_end = oldvec.end();
-  const FeatureVector::const_iterator cur_end = bowvec.end();
+  QueryResults &qret = ws.qret;
+  database(ws).query(ws.bowvec, qret, m_params.max_db_results, -1);
   
-  old_it = oldvec.begin();
-  cur_it = bowvec.begin();
+  if(qret.empty())
+  {
+    match.status = NO_DB_RESULTS;
+    return;
+  }
   
-  while(old_it != old_end && cur_it != cur_end)
+  // (without a previous image, the raw scores are compared directly)
+  removeLowScores(qret, 
+    m_params.use_nss ? m_params.min_query_score : m_params.alpha);
+  
+  if(qret.empty())
   {
-    if(old_it->first == cur_it->first)
-    {
-      // compute matches between 
-      // features old_it->second of m_image_keys[old_entry] and
-      // features cur_it->second of keys
-      vector<unsigned int> i_old_now, i_cur_now;
-      
-      getMatches_neighratio(
-        m_image_descriptors[old_entry], old_it->second, 
-        descriptors, cur_it->second,  
-        i_old_now, i_cur_now);
-      
-      i_old.insert(i_old.end(), i_old_now.begin(), i_old_now.end());
-      i_cur.insert(i_cur.end(), i_cur_now.begin(), i_cur_now.end());
-      
-      // move old_it and cur_it forward
-      ++old_it;
-      ++cur_it;
-    }
-    else if(old_it->first < cur_it->first)
-    {
-      // move old_it forward
-      old_it = oldvec.lower_bound(cur_it->first);
-      // old_it = (first element >= cur_it.id)
-    }
-    else
-    {
-      // move cur_it forward
-      cur_it = bowvec.lower_bound(old_it->first);
-      // cur_it = (first element >= old_it.id)
-    }
+    match.status = LOW_SCORES;
+    return;
   }
   
+  match.match = qret[0].Id;
+  
+  computeIslands(qret, ws.islands);
+  
+  if(ws.islands.empty())
+  {
+    match.status = NO_GROUPS;
+    return;
+  }
+  
+  getCandidates(qret, ws.islands, ws);
+  match.match = ws.candidates[0].entry;
+  
+  if(!verify || geomCheck() == GEOM_NONE)
+  {
+    match.status = LOOP_DETECTED;
+    return;
+  }
+  
+  const bool trim = trimFeatures(k, d, ws);
+  const std::vector<cv::KeyPoint> &vk = (trim ? ws.verified_keys : k);
+  const std::vector<TDescriptor> &vd = (trim ? ws.verified_descriptors : d);
+  
+  // the flann structure of a previous query must not be reused
+  ws.flann_entry = -1;
+  
+  for(size_t i = 0; i < ws.candidates.size(); ++i)
+  {
+    const tCandidate &c = ws.candidates[i];
+    
+    const bool ok = checkCandidate(ws.islands[c.island], c.entry, entry_id,
+      vk, vd, ws.featvec, ws, false);
+    
+    if(ok)
+    {
+      match.status = LOOP_DETECTED;
+      match.match = c.entry;
+      match.inliers = ws.inliers;
+      if(ws.has_pose)
+      {
+        match.has_pose = true;
+        std::copy(ws.R, ws.R + 9, match.R);
+        std::copy(ws.t, ws.t + 3, match.t);
+      }
+      return;
+    }
+    
+    if(i == 0)
+    {
+      match.inliers = ws.inliers;
+      match.rejected_by = ws.stage;
+    }
+  }
+  
+  match.status = NO_GEOMETRICAL_CONSISTENCY;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TGeomCheck>
+bool TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::trimFeatures(
+  const std::vector<cv::KeyPoint> &keys, 
+  const std::vector<TDescriptor> &descriptors, tWorkspace &ws) const
+{
+  // the first features are the preferred ones
+  const size_t nv = m_params.max_verified_keys;
+  if(nv == 0 || keys.size() <= nv) return false;
+  
+  ws.verified_keys.assign(keys.begin(), keys.begin() + nv);
+  ws.verified_descriptors.assign(descriptors.begin(), 
+    descriptors.begin() + std::min(nv, descriptors.size()));
+  return true;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TGeomCheck>
+bool TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::applyBudget(
+  const std::vector<cv::KeyPoint> &keys, 
+  const std::vector<TDescriptor> &descriptors, tWorkspace &ws) const
+{
+  // the order only matters if the geometrical check uses a part of them
+  const bool ranked = m_params.max_verified_keys > 0 && 
+    geomCheck() != GEOM_NONE;
+  
+  if(m_params.max_stored_keys <= 0 && !ranked) return false;
+  
+  const size_t n = std::min(keys.size(), descriptors.size());
+  if(!ranked && n <= (size_t)m_params.max_stored_keys) return false;
+  
+  ws.budget.setGrid(m_params.image_rows, m_params.image_cols, 
+    m_params.budget_grid);
+  ws.budget.rank(keys, ws.ranked);
+  
+  // (ranked only keeps indices of descriptors)
+  ws.ranked.erase(std::remove_if(ws.ranked.begin(), ws.ranked.end(),
+    [n](unsigned int i) { return i >= n; }), ws.ranked.end());
+  if(m_params.max_stored_keys > 0 && 
+    ws.ranked.size() > (size_t)m_params.max_stored_keys)
+    ws.ranked.resize(m_params.max_stored_keys);
+  
+  ws.kept_keys.resize(ws.ranked.size());
+  ws.kept_descriptors.resize(ws.ranked.size());
+  for(size_t i = 0; i < ws.ranked.size(); ++i)
+  {
+    ws.kept_keys[i] = keys[ws.ranked[i]];
+    ws.kept_descriptors[i] = descriptors[ws.ranked[i]];
+  }
+  
+  return true;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TGeomCheck>
+void TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::getCandidates(
+  const QueryResults &q, const vector<tIsland> &islands, tWorkspace &ws) const
+{
+  // stable, so that ties keep the order of max_element
+  vector<unsigned int> &order = ws.island_order;
+  order.resize(islands.size());
+  for(unsigned int i = 0; i < order.size(); ++i) order[i] = i;
+  std::stable_sort(order.begin(), order.end(), 
+    [&islands](unsigned int a, unsigned int b)
+    { return islands[a].score > islands[b].score; });
+  
+  const unsigned int nislands = (unsigned int)std::min<size_t>(
+    std::max(m_params.verify_islands, 1), order.size());
+  
+  ws.candidates.resize(0);
+  
+  for(unsigned int k = 0; k < nislands; ++k)
+  {
+    const tIsland &island = islands[order[k]];
+    
+    tCandidate c;
+    c.island = order[k];
+    
+    if(m_params.verify_entries <= 1)
+    {
+      c.entry = island.best_entry;
+      c.score = island.best_score;
+      ws.candidates.push_back(c);
+      continue;
+    }
+    
+    // entries of the island by descending score
+    const size_t c0 = ws.candidates.size();
+    
+    QueryResults::const_iterator qit = std::lower_bound(q.begin(), q.end(),
+      Result(island.first, 0), Result::ltId);
+    for(; qit != q.end() && qit->Id <= island.last; ++qit)
+    {
+      c.entry = qit->Id;
+      c.score = qit->Score;
+      ws.candidates.push_back(c);
+    }
+    
+    std::stable_sort(ws.candidates.begin() + c0, ws.candidates.end(),
+      [](const tCandidate &a, const tCandidate &b)
+      { return a.score > b.score; });
+    
+    if(ws.candidates.size() - c0 > (size_t)m_params.verify_entries)
+      ws.candidates.resize(c0 + m_params.verify_entries);
+  }
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TGeomCheck>
+int TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::verifyCandidates(
+  EntryId entry_id, const std::vector<cv::KeyPoint> &keys, 
+  const std::vector<TDescriptor> &descriptors, const FeatureVector &featvec)
+{
+  tWorkspace &ws = m_workspace;
+  const int n = (int)ws.candidates.size();
+  
+  ws.cand_worker.assign(n, -1);
+  ws.cand_inliers.assign(n, 0);
+  ws.cand_stage.assign(n, STAGE_NONE);
+  
+  if(n > 1)
+  {
+    m_pool.resize(std::min(m_params.verify_threads, n));
+    while((int)m_workers.size() + 1 < m_pool.size()) m_workers.emplace_back();
+  }
+  
+  // index of the first consistent candidate so far
+  std::atomic<int> winner(n);
+  
+  auto task = [&](int i, int w)
+  {
+    // cancelled by a better candidate
+    if(i > winner.load()) return;
+    
+    tWorkspace &wws = workspace(w);
+    const tCandidate &c = ws.candidates[i];
+    
+    const bool ok = checkCandidate(ws.islands[c.island], c.entry, entry_id,
+      keys, descriptors, featvec, wws);
+    
+    ws.cand_worker[i] = w;
+    ws.cand_inliers[i] = wws.inliers;
+    ws.cand_stage[i] = (ok ? STAGE_NONE : wws.stage);
+    
+    if(ok)
+    {
+      int cur = winner.load();
+      while(i < cur && !winner.compare_exchange_weak(cur, i)) {}
+    }
+  };
+  
+  if(n == 1) task(0, 0);
+  else m_pool.run(n, task);
+  
+  return winner < n ? winner.load() : -1;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TGeomCheck>
+bool TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::checkCandidate(
+  const tIsland &island, EntryId old_entry, EntryId entry_id, 
+  const std::vector<cv::KeyPoint> &keys, 
+  const std::vector<TDescriptor> &descriptors, 
+  const FeatureVector &featvec, tWorkspace &ws, bool sequential) const
+{
+  ws.inliers = 0;
+  ws.has_pose = false;
+  ws.stage = STAGE_MATCHES; // until the model is estimated
+  
+  if(sequential && continuesLastModel(island, entry_id) &&
+    isGeometricallyConsistent_Guided(old_entry, keys, descriptors, ws))
+  {
+    // the full check is not necessary
+    return true;
+  }
+  else if(geomCheck() == GEOM_DI)
+  {
+    // all the DI stuff is implicit in the database
+    return isGeometricallyConsistent_DI(old_entry, keys, descriptors, 
+      featvec, ws);
+  }
+  else if(geomCheck() == GEOM_FLANN)
+  {
+    // (with the cache, the structure of the old entry is used)
+    if(m_params.index_cache_size <= 0 && ws.flann_entry != (int)entry_id)
+    {
+      getFlannStructure(descriptors, ws);
+      ws.flann_entry = entry_id;
+    }
+    
+    return isGeometricallyConsistent_Flann(old_entry, keys, descriptors, 
+      ws);
+  }
+  else if(geomCheck() == GEOM_EXHAUSTIVE)
+  { 
+    return isGeometricallyConsistent_Exhaustive(old_entry, keys, 
+      descriptors, ws);
+  }
+  else if(geomCheck() == GEOM_LSH)
+  {
+    return isGeometricallyConsistent_LSH(old_entry, keys, descriptors, ws);
+  }
+  
+  // GEOM_NONE, accept the match
+  return true;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TGeomCheck>
+inline void TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::clear()
+{
+  ++m_clears;
+  m_database->clear();
+  m_image_keys.clear();
+  m_image_descriptors.clear();
+  m_image_points.clear();
+  m_workspace.flann_cache.clear();
+  m_workspace.index_cache.clear();
+  m_workspace.flann_entry = -1;
+  for(size_t i = 0; i < m_workers.size(); ++i)
+  {
+    m_workers[i].flann_cache.clear();
+    m_workers[i].index_cache.clear();
+    m_workers[i].flann_entry = -1;
+  }
+  m_window.nentries = 0;
+  m_model.valid = false;
+  resetReplicas();
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TGeomCheck>
+typename TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::ReadView
+TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::read() const
+{
+  if(!m_params.concurrent_reads || m_replicas[0].db == NULL) 
+    return ReadView();
+  
+  // the replica may stop being published before the view holds it; then
+  // the writer may be updating it
+  for(;;)
+  {
+    const int r = m_published.load();
+    m_replicas[r].readers.fetch_add(1);
+    if(m_published.load() == r) return ReadView(&m_replicas[r]);
+    m_replicas[r].readers.fetch_sub(1);
+  }
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TGeomCheck>
+void TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::resetReplicas()
+{
+  if(!m_params.concurrent_reads || m_database == NULL) return;
+  
+  for(int r = 0; r < 2; ++r)
+  {
+    tReplica &replica = m_replicas[r];
+    delete replica.db;
+    replica.db = new ReplicaDatabase<TDescriptor, F>(*m_database);
+    replica.key_store = &m_image_keys;
+    replica.keys.clear();
+    replica.descriptors.clear();
+    replica.points.clear();
+  }
+  
+  m_published = 0;
+  m_pending.clear();
+  m_pending_size = 0;
+  m_pending_first = 0;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TGeomCheck>
+void TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::finishEntry()
+{
+  // (compared between calls, so that the feature budget is counted too)
+  const size_t footprint = workspaceFootprint();
+  if(footprint > m_workspace.last_footprint) ++m_workspace.growths;
+  m_workspace.last_footprint = footprint;
+  
+  publish();
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TGeomCheck>
+void TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::publish()
+{
+  if(!m_params.concurrent_reads || m_replicas[0].db == NULL) return;
+  
+  const int w = 1 - m_published.load();
+  tReplica &replica = m_replicas[w];
+  
+  // held by a view: tried again with the next entry
+  if(replica.readers.load() != 0) return;
+  
+  const size_t n = m_pending_first + m_pending_size;
+  for(size_t i = replica.descriptors.size(); i < n; ++i)
+  {
+    const std::pair<BowVector, FeatureVector> &v = 
+      m_pending[i - m_pending_first];
+    replica.db->add(v.first, v.second);
+    
+    replica.keys.push_back(i < m_image_keys.size() ? m_image_keys.view(i) :
+      KeyPointStore::EntryView());
+    replica.descriptors.push_back(i < m_image_descriptors.size() ? 
+      m_image_descriptors[i] : Span<TDescriptor>());
+    replica.points.push_back(i < m_image_points.size() ? 
+      m_image_points[i] : Span<cv::Point3f>());
+  }
+  
+  m_published = w;
+  
+  // the vectors that both replicas have added are not needed any more
+  const size_t done = std::min(m_replicas[0].descriptors.size(), 
+    m_replicas[1].descriptors.size());
+  if(done > m_pending_first)
+  {
+    const size_t k = done - m_pending_first;
+    std::rotate(m_pending.begin(), m_pending.begin() + k, 
+      m_pending.begin() + m_pending_size);
+    m_pending_size -= k;
+    m_pending_first = done;
+  }
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TGeomCheck>
+void TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::computeIslands
+  (QueryResults &q, vector<tIsland> &islands) const
+{
+  islands.clear();
+  
+  if(q.size() == 1)
+  {
+    islands.push_back(tIsland(q[0].Id, q[0].Id, calculateIslandScore(q, 0, 0)));
+    islands.back().best_entry = q[0].Id;
+    islands.back().best_score = q[0].Score;
+  }
+  else if(!q.empty())
+  {
+    // sort query results in ascending order of ids
+    std::sort(q.begin(), q.end(), Result::ltId);
+    
+    // create long enough islands
+    QueryResults::const_iterator dit = q.begin();
+    int first_island_entry = dit->Id;
+    int last_island_entry = dit->Id;
+    
+    // these are indices of q
+    unsigned int i_first = 0;
+    unsigned int i_last = 0;
+    
+    double best_score = dit->Score;
+    EntryId best_entry = dit->Id;
+
+    ++dit;
+    for(unsigned int idx = 1; dit != q.end(); ++dit, ++idx)
+    {
+      if((int)dit->Id - last_island_entry < m_params.max_intragroup_gap)
+      {
+        // go on until find the end of the island
+        last_island_entry = dit->Id;
+        i_last = idx;
+        if(dit->Score > best_score)
+        {
+          best_score = dit->Score;
+          best_entry = dit->Id;
+        }
+      }
+      else
+      {
+        // end of island reached
+        int length = last_island_entry - first_island_entry + 1;
+        if(length >= m_params.min_matches_per_group)
+        {
+          islands.push_back( tIsland(first_island_entry, last_island_entry,
+            calculateIslandScore(q, i_first, i_last)) );
+          
+          islands.back().best_score = best_score;
+          islands.back().best_entry = best_entry;
+        }
+        
+        // prepare next island
+        first_island_entry = last_island_entry = dit->Id;
+        i_first = i_last = idx;
+        best_score = dit->Score;
+        best_entry = dit->Id;
+      }
+    }
+    // add last island
+    if(last_island_entry - first_island_entry + 1 >= 
+      m_params.min_matches_per_group)
+    {
+      islands.push_back( tIsland(first_island_entry, last_island_entry,
+        calculateIslandScore(q, i_first, i_last)) );
+        
+      islands.back().best_score = best_score;
+      islands.back().best_entry = best_entry;
+    }
+  }
+  
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TGeomCheck>
+double TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::calculateIslandScore(
+  const QueryResults &q, unsigned int i_first, unsigned int i_last) const
+{
+  // get the sum of the scores
+  double sum = 0;
+  while(i_first <= i_last) sum += q[i_first++].Score;
+  return sum;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TGeomCheck>
+void TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::updateTemporalWindow
+  (const tIsland &matched_island, EntryId entry_id)
+{
+  // if m_window.nentries > 0, island > m_window.last_matched_island and
+  // entry_id > m_window.last_query_id hold
+  
+  if(m_window.nentries == 0 || int(entry_id - m_window.last_query_id)
+    > m_params.max_distance_between_queries)
+  {
+    m_window.nentries = 1;
+  }
+  else
+  {
+    EntryId a1 = m_window.last_matched_island.first;
+    EntryId a2 = m_window.last_matched_island.last;
+    EntryId b1 = matched_island.first;
+    EntryId b2 = matched_island.last;
+    
+    bool fit = (b1 <= a1 && a1 <= b2) || (a1 <= b1 && b1 <= a2);
+
+    if(!fit)
+    {
+      int d1 = (int)a1 - (int)b2;
+      int d2 = (int)b1 - (int)a2;
+      int gap = (d1 > d2 ? d1 : d2);
+      
+      fit = (gap <= m_params.max_distance_between_groups);
+    }
+    
+    if(fit) m_window.nentries++;
+    else m_window.nentries = 1;
+  }
+  
+  m_window.last_matched_island = matched_island;
+  m_window.last_query_id = entry_id;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TGeomCheck>
+bool TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::isGeometricallyConsistent_DI(
+  EntryId old_entry, const std::vector<cv::KeyPoint> &keys, 
+  const std::vector<TDescriptor> &descriptors, 
+  const FeatureVector &bowvec, tWorkspace &ws) const
+{
+  const FeatureVector &oldvec = database(ws).retrieveFeatures(old_entry);
+  
+  // for each word in common, get the closest descriptors
+  
+  vector<unsigned int> &i_old = ws.i_old, &i_cur = ws.i_cur;
+  const Span<TDescriptor> old_descriptors = verifiedDescriptors(old_entry, ws);
+  
+  // the features of each word are disjoint, so that a single table keeps
+  // the matches of all of them
+  ws.table.reset(descriptors.size());
+  
+  FeatureVector::const_iterator old_it, cur_it; 
+  const FeatureVector::const_iterator old_end = oldvec.end();
+  const FeatureVector::const_iterator cur_end = bowvec.end();
+  
+  old_it = oldvec.begin();
+  cur_it = bowvec.begin();
+  
+  while(old_it != old_end && cur_it != cur_end)
+  {
+    if(old_it->first == cur_it->first)
+    {
+      // compute matches between 
+      // features old_it->second of m_image_keys[old_entry] and
+      // features cur_it->second of keys
+      if(m_params.max_verified_keys <= 0)
+      {
+        getMatches_neighratio(old_descriptors, old_it->second, 
+          descriptors, cur_it->second, ws.table, ws.kernel);
+      }
+      else
+      {
+        // only the features within the verification budget
+        ws.di_old.resize(0);
+        ws.di_cur.resize(0);
+        for(size_t i = 0; i < old_it->second.size(); ++i)
+          if(old_it->second[i] < old_descriptors.size()) 
+            ws.di_old.push_back(old_it->second[i]);
+        for(size_t i = 0; i < cur_it->second.size(); ++i)
+          if(cur_it->second[i] < descriptors.size()) 
+            ws.di_cur.push_back(cur_it->second[i]);
+        
+        getMatches_neighratio(old_descriptors, ws.di_old, 
+          descriptors, ws.di_cur, ws.table, ws.kernel);
+      }
+      
+      // move old_it and cur_it forward
+      ++old_it;
+      ++cur_it;
+    }
+    else if(old_it->first < cur_it->first)
+    {
+      // move old_it forward
+      old_it = oldvec.lower_bound(cur_it->first);
+      // old_it = (first element >= cur_it.id)
+    }
+    else
+    {
+      // move cur_it forward
+      cur_it = bowvec.lower_bound(old_it->first);
+      // cur_it = (first element >= old_it.id)
+    }
+  }
+  
+  ws.table.get(i_old, i_cur, &ws.distances);
+  
   // calculate now the fundamental matrix
   if((int)i_old.size() >= m_params.min_Fpoints)
   {
-    vector<cv::Point2f> old_points, cur_points;
+    return checkFundamentalMatrix(old_entry, i_old, keys, i_cur, ws);
+  }
+  
+  return false;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TGeomCheck>
+bool TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::
+isGeometricallyConsistent_Exhaustive(EntryId old_entry,
+  const std::vector<cv::KeyPoint> &cur_keys,
+  const Span<TDescriptor> &cur_descriptors, tWorkspace &ws) const
+{
+  const Span<TDescriptor> old_descriptors = verifiedDescriptors(old_entry, ws);
+  
+  vector<unsigned int> &i_old = ws.i_old, &i_cur = ws.i_cur;
+  vector<unsigned int> &i_all_old = ws.i_all_old, &i_all_cur = ws.i_all_cur;
+  
+  i_all_old.resize(old_descriptors.size());
+  i_all_cur.resize(cur_keys.size());
+  
+  for(unsigned int i = 0; i < old_descriptors.size(); ++i)
+  {
+    i_all_old[i] = i;
+  }
+  
+  for(unsigned int i = 0; i < cur_keys.size(); ++i)
+  {
+    i_all_cur[i] = i;
+  }
+  
+  ws.table.reset(cur_descriptors.size());
+  if(m_params.exhaustive_threads > 1 || m_params.exhaustive_tile > 0)
+    getMatches_tiled(old_descriptors, i_all_old, cur_descriptors, i_all_cur,
+      ws.table, ws);
+  else
+    getMatches_neighratio(old_descriptors, i_all_old, 
+      cur_descriptors, i_all_cur, ws.table, ws.kernel);
+  ws.table.get(i_old, i_cur, &ws.distances);
+  
+  if((int)i_old.size() >= m_params.min_Fpoints)
+  {
+    return checkFundamentalMatrix(old_entry, i_old, cur_keys, i_cur, ws);
+  }
+  
+  return false;
+} 
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TGeomCheck>
+bool TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::checkFundamentalMatrix(
+  EntryId old_entry, const vector<unsigned int> &i_old,
+  const std::vector<cv::KeyPoint> &cur_keys,
+  const vector<unsigned int> &i_cur, tWorkspace &ws) const
+{
+  storedCoordinates(old_entry, i_old, ws.old_points, ws);
+  KeyPointStore::getPoints(cur_keys, i_cur, ws.cur_points);
+  
+  if(m_params.cascade != 0)
+  {
+    ws.stage = checkCascade(old_entry, i_old, cur_keys, i_cur, ws);
+    if(ws.stage != STAGE_NONE) return false;
+  }
+  ws.stage = STAGE_MODEL;
+  
+  if(usesPose(old_entry, ws))
+    return solvePose(old_entry, i_old, ws, m_params.max_ransac_iterations);
+  
+  return solveFundamentalMatrix(i_old, ws, m_params.max_ransac_iterations);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TGeomCheck>
+VerificationStage TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::
+checkCascade(EntryId old_entry, const vector<unsigned int> &i_old,
+  const std::vector<cv::KeyPoint> &cur_keys,
+  const vector<unsigned int> &i_cur, tWorkspace &ws) const
+{
+  const int n = (int)i_old.size();
+  
+  if((m_params.cascade & CASCADE_MATCHES) && 
+    n < m_params.cascade_min_matches)
+  {
+    return STAGE_MATCHES;
+  }
+  
+  // the orientation and size of the old keypoints are only kept with 
+  // KEYS_FULL
+  const Span<cv::KeyPoint> old_keys = storedKeys(old_entry, ws);
+  
+  if((m_params.cascade & CASCADE_ORIENTATION) && !old_keys.empty() &&
+    m_params.cascade_bins >= 3)
+  {
+    ws.dangle.resize(n);
+    ws.dscale.resize(n);
+    ws.hist.resize(2 * m_params.cascade_bins);
+    
+    for(int k = 0; k < n; ++k)
+    {
+      const cv::KeyPoint &a = old_keys[i_old[k]];
+      const cv::KeyPoint &b = cur_keys[i_cur[k]];
+      
+      // keypoints without orientation (-1) or size count as unchanged
+      ws.dangle[k] = (a.angle >= 0 && b.angle >= 0 ? b.angle - a.angle : 0);
+      ws.dscale[k] = (a.size > 0 && b.size > 0 ? 
+        std::log(b.size / a.size) / std::log(2.f) : 0);
+    }
+    
+    const int consistent = Cascade::consistentChanges(&ws.dangle[0],
+      &ws.dscale[0], n, m_params.cascade_bins, &ws.hist[0]);
+    
+    if(consistent < m_params.min_Fpoints || 
+      consistent < m_params.cascade_min_consistency * n)
+    {
+      return STAGE_ORIENTATION;
+    }
+  }
+  
+  if(m_params.cascade & CASCADE_AFFINE)
+  {
+    const int inliers = Cascade::affineConsensus(
+      n > 0 ? &ws.old_points[0] : NULL, n > 0 ? &ws.cur_points[0] : NULL, n,
+      m_params.cascade_affine_iterations, m_params.cascade_affine_error,
+      m_params.min_Fpoints);
+    
+    if(inliers < m_params.min_Fpoints) return STAGE_AFFINE;
+  }
+  
+  return STAGE_NONE;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TGeomCheck>
+bool TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::solveFundamentalMatrix(
+  const vector<unsigned int> &i_old, tWorkspace &ws, 
+  int max_iterations) const
+{
+  // the matrices only wrap the reused buffers
+  cv::Mat oldMat, curMat;
+  if(!i_old.empty())
+  {
+    oldMat = cv::Mat((int)i_old.size(), 2, CV_32F, &ws.old_points[0]);
+    curMat = cv::Mat((int)i_old.size(), 2, CV_32F, &ws.cur_points[0]);
+  }
+  
+  const bool prosac = (m_params.estimator == ESTIMATOR_PROSAC);
+  
+  // (without valid intrinsics, fundamental matrices are estimated instead)
+  const bool essential = 
+    (m_params.model == MODEL_ESSENTIAL && hasIntrinsics());
+  
+  if(prosac || essential)
+  {
+    if(prosac)
+    {
+      // by increasing descriptor distance (ties by position, to be 
+      // repeatable)
+      const vector<double> &d = ws.distances;
+      ws.order.resize(i_old.size());
+      for(unsigned int k = 0; k < ws.order.size(); ++k) ws.order[k] = k;
+      if(d.size() == i_old.size())
+      {
+        std::sort(ws.order.begin(), ws.order.end(), 
+          [&d](unsigned int a, unsigned int b)
+          { return d[a] < d[b] || (d[a] == d[b] && a < b); });
+      }
+    }
+    
+    if(essential)
+      ws.prosac.useEssential(m_params.fx, m_params.fy, m_params.cx, 
+        m_params.cy);
+    else
+      ws.prosac.useFundamental();
+    
+    ws.prosac_pool.resize(m_params.estimator_threads);
+    ws.prosac.setPool(&ws.prosac_pool);
+    ws.inliers = ws.prosac.solve(oldMat.empty() ? NULL : &ws.old_points[0],
+      curMat.empty() ? NULL : &ws.cur_points[0], (int)i_old.size(), 
+      prosac && !ws.order.empty() ? &ws.order[0] : NULL, 
+      m_params.max_reprojection_error, m_params.ransac_probability, 
+      max_iterations, ws.fmatrix, &ws.status);
     
-    // add matches to the vectors to calculate the fundamental matrix
-    vector<unsigned int>::const_iterator oit, cit;
-    oit = i_old.begin();
-    cit = i_cur.begin();
+    if(ws.inliers < m_params.min_Fpoints) return false;
     
-    for(; oit != i_old.end(); ++oit, ++cit)
+    if(m_params.reuse_last_model)
     {
-      const cv::KeyPoint &old_k = m_image_keys[old_entry][*oit];
-      const cv::KeyPoint &cur_k = keys[*cit];
-      
-      old_points.push_back(old_k.pt);
-      cur_points.push_back(cur_k.pt);
+      ws.i_inliers.resize(0);
+      for(unsigned int k = 0; k < i_old.size(); ++k)
+      {
+        if(ws.status[k]) ws.i_inliers.push_back(i_old[k]);
+      }
     }
+    return true;
+  }
   
-    cv::Mat oldMat(old_points.size(), 2, CV_32F, &old_points[0]);
-    cv::Mat curMat(cur_points.size(), 2, CV_32F, &cur_points[0]);
-    
+  if(!m_params.reuse_last_model)
+  {
     return m_fsolver.checkFundamentalMat(oldMat, curMat, 
       m_params.max_reprojection_error, m_params.min_Fpoints,
-      m_params.ransac_probability, m_params.max_ransac_iterations);
+      m_params.ransac_probability, max_iterations);
   }
   
-  return false;
+  // keep the matrix and its inliers for the next queries
+  cv::Mat Fm = m_fsolver.findFundamentalMat(oldMat, curMat,
+    m_params.max_reprojection_error, m_params.min_Fpoints, &ws.status, 
+    true, m_params.ransac_probability, max_iterations);
+  
+  if(Fm.empty()) return false;
+  
+  for(int r = 0; r < 3; ++r)
+    for(int c = 0; c < 3; ++c)
+      ws.fmatrix[r * 3 + c] = (Fm.type() == CV_32F ? 
+        (double)Fm.at<float>(r, c) : Fm.at<double>(r, c));
+  
+  ws.i_inliers.resize(0);
+  for(unsigned int k = 0; k < ws.status.size() && k < i_old.size(); ++k)
+  {
+    if(ws.status[k]) ws.i_inliers.push_back(i_old[k]);
+  }
+  ws.inliers = (int)ws.i_inliers.size();
+  
+  return ws.inliers >= m_params.min_Fpoints;
 }
 
 // --------------------------------------------------------------------------
 
-template<class TDescriptor, class F>
-bool TemplatedLoopDetector<TDescriptor, F>::
-isGeometricallyConsistent_Exhaustive(
-  const std::vector<cv::KeyPoint> &old_keys,
-  const std::vector<TDescriptor> &old_descriptors,
-  const std::vector<cv::KeyPoint> &cur_keys,
-  const std::vector<TDescriptor> &cur_descriptors) const
+template<class TDescriptor, class F, class TGeomCheck>
+bool TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::solvePose(
+  EntryId old_entry, const vector<unsigned int> &i_old, tWorkspace &ws, 
+  int max_iterations) const
 {
-  vector<unsigned int> i_old, i_cur;
-  vector<unsigned int> i_all_old, i_all_cur;
+  const Span<cv::Point3f> points = storedPoints3D(old_entry, ws);
   
-  i_all_old.reserve(old_keys.size());
-  i_all_cur.reserve(cur_keys.size());
+  // only the correspondences whose old point is known
+  ws.pose_points.resize(0);
+  ws.pose_keys.resize(0);
+  ws.pose_index.resize(0);
   
-  for(unsigned int i = 0; i < old_keys.size(); ++i)
+  for(unsigned int k = 0; k < i_old.size(); ++k)
   {
-    i_all_old.push_back(i);
+    if(i_old[k] >= points.size()) continue;
+    
+    const cv::Point3f &P = points[i_old[k]];
+    if(!(P.z > 0)) continue; // also NaN
+    
+    ws.pose_points.push_back(P.x);
+    ws.pose_points.push_back(P.y);
+    ws.pose_points.push_back(P.z);
+    ws.pose_keys.push_back(ws.cur_points[2 * k]);
+    ws.pose_keys.push_back(ws.cur_points[2 * k + 1]);
+    ws.pose_index.push_back(k);
   }
   
-  for(unsigned int i = 0; i < cur_keys.size(); ++i)
+  const int n = (int)ws.pose_index.size();
+  if(n < m_params.min_Fpoints) return false;
+  
+  ws.pose.setCamera(m_params.fx, m_params.fy, m_params.cx, m_params.cy);
+  ws.inliers = ws.pose.solve(&ws.pose_points[0], &ws.pose_keys[0], n, 
+    m_params.max_reprojection_error, m_params.ransac_probability, 
+    max_iterations, ws.R, ws.t, &ws.status);
+  
+  if(ws.inliers < m_params.min_Fpoints) return false;
+  
+  ws.has_pose = true;
+  
+  // F = K^-T * [t]x * R * K^-1, for the guided matching
+  const double *R = ws.R, *t = ws.t;
+  const double E[9] = {
+    -t[2] * R[3] + t[1] * R[6], -t[2] * R[4] + t[1] * R[7], 
+    -t[2] * R[5] + t[1] * R[8],
+     t[2] * R[0] - t[0] * R[6],  t[2] * R[1] - t[0] * R[7],
+     t[2] * R[2] - t[0] * R[8],
+    -t[1] * R[0] + t[0] * R[3], -t[1] * R[1] + t[0] * R[4],
+    -t[1] * R[2] + t[0] * R[5] };
+  
+  const double Ki[9] = { 1. / m_params.fx, 0, -m_params.cx / m_params.fx,
+    0, 1. / m_params.fy, -m_params.cy / m_params.fy, 0, 0, 1 };
+  
+  double M[9]; // E * K^-1
+  for(int r = 0; r < 3; ++r)
+    for(int c = 0; c < 3; ++c)
+      M[r * 3 + c] = E[r * 3] * Ki[c] + E[r * 3 + 1] * Ki[3 + c] +
+        E[r * 3 + 2] * Ki[6 + c];
+  
+  for(int r = 0; r < 3; ++r)
+    for(int c = 0; c < 3; ++c)
+      ws.fmatrix[r * 3 + c] = Ki[r] * M[c] + Ki[3 + r] * M[3 + c] +
+        Ki[6 + r] * M[6 + c];
+  
+  if(m_params.reuse_last_model)
+  {
+    ws.i_inliers.resize(0);
+    for(int k = 0; k < n; ++k)
+    {
+      if(ws.status[k]) ws.i_inliers.push_back(i_old[ws.pose_index[k]]);
+    }
+  }
+  
+  return true;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TGeomCheck>
+bool TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::continuesLastModel(
+  const tIsland &island, EntryId entry_id) const
+{
+  if(!m_model.valid || !m_params.reuse_last_model || 
+    int(entry_id - m_model.query) > m_params.max_distance_between_queries)
   {
-    i_all_cur.push_back(i);
+    return false;
   }
   
-  getMatches_neighratio(old_descriptors, i_all_old, 
-    cur_descriptors, i_all_cur,  i_old, i_cur);
+  // same test as the temporal window
+  const EntryId a1 = m_model.first, a2 = m_model.last;
+  const EntryId b1 = island.first, b2 = island.last;
   
-  if((int)i_old.size() >= m_params.min_Fpoints)
+  if((b1 <= a1 && a1 <= b2) || (a1 <= b1 && b1 <= a2)) return true;
+  
+  const int d1 = (int)a1 - (int)b2;
+  const int d2 = (int)b1 - (int)a2;
+  
+  return (d1 > d2 ? d1 : d2) <= m_params.max_distance_between_groups;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TGeomCheck>
+bool TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::
+isGeometricallyConsistent_Guided(EntryId old_entry,
+  const std::vector<cv::KeyPoint> &keys, 
+  const std::vector<TDescriptor> &descriptors, tWorkspace &ws) const
+{
+  const Span<TDescriptor> old_descriptors = verifiedDescriptors(old_entry, ws);
+  
+  vector<unsigned int> &i_old = ws.i_old, &i_cur = ws.i_cur;
+  vector<unsigned int> &i_all_old = ws.i_all_old, &i_all_cur = ws.i_all_cur;
+  vector<unsigned int> &i_cand = ws.i_cand;
+  
+  // with the same old entry, only its features that were inliers are 
+  // looked for
+  if(old_entry == m_model.old_entry)
+  {
+    i_all_old.assign(m_model.i_inliers.begin(), m_model.i_inliers.end());
+  }
+  else
+  {
+    i_all_old.resize(old_descriptors.size());
+    for(unsigned int i = 0; i < i_all_old.size(); ++i) i_all_old[i] = i;
+  }
+  
+  i_all_cur.resize(keys.size());
+  for(unsigned int i = 0; i < i_all_cur.size(); ++i) i_all_cur[i] = i;
+  
+  storedCoordinates(old_entry, i_all_old, ws.old_points, ws);
+  KeyPointStore::getPoints(keys, i_all_cur, ws.cur_points);
+  
+  const double r = m_params.guided_epipolar_distance;
+  const float *cur_points = ws.cur_points.empty() ? NULL : &ws.cur_points[0];
+  
+  ws.table.reset(keys.size());
+  
+  for(unsigned int k = 0; k < i_all_old.size(); ++k)
   {
-    // add matches to the vectors to calculate the fundamental matrix
-    vector<unsigned int>::const_iterator oit, cit;
-    oit = i_old.begin();
-    cit = i_cur.begin();
+    // candidates along the epipolar line of the old feature
+    double l[3];
+    Epipolar::line2(m_model.fmatrix, ws.old_points[2 * k], 
+      ws.old_points[2 * k + 1], l);
+    
+    i_cand.resize(0);
+    for(unsigned int j = 0; j < keys.size(); ++j)
+    {
+      const double d = l[0] * cur_points[2 * j] + 
+        l[1] * cur_points[2 * j + 1] + l[2];
+      if(std::fabs(d) <= r) i_cand.push_back(j);
+    }
+    
+    if(i_cand.empty()) continue;
     
-    vector<cv::Point2f> old_points, cur_points;
-    old_points.reserve(i_old.size());
-    cur_points.reserve(i_cur.size());
+    int best_j;
+    double best_dist_1, best_dist_2;
     
-    for(; oit != i_old.end(); ++oit, ++cit)
+    ws.kernel.setCandidates(&descriptors[0], i_cand);
+    ws.kernel.nearest2(old_descriptors[i_all_old[k]], best_j, best_dist_1,
+      best_dist_2);
+    
+    if(best_j >= 0 && 
+      best_dist_1 / best_dist_2 <= m_params.max_neighbor_ratio)
     {
-      const cv::KeyPoint &old_k = old_keys[*oit];
-      const cv::KeyPoint &cur_k = cur_keys[*cit];
-      
-      old_points.push_back(old_k.pt);
-      cur_points.push_back(cur_k.pt);
+      ws.table.offer(i_all_old[k], i_cand[best_j], best_dist_1);
     }
+  }
+  
+  if(m_params.cross_check)
+  {
+    crossCheckMatches(old_descriptors, i_all_old, descriptors, ws.table, 0,
+      ws.kernel);
+  }
   
-    cv::Mat oldMat(old_points.size(), 2, CV_32F, &old_points[0]);
-    cv::Mat curMat(cur_points.size(), 2, CV_32F, &cur_points[0]);
+  ws.table.get(i_old, i_cur, &ws.distances);
+  
+  if((int)i_old.size() < m_params.min_Fpoints) return false;
+  
+  // keep the correspondences that still support the last model, so that
+  // a few iterations are enough to find the new one
+  storedCoordinates(old_entry, i_old, ws.old_points, ws);
+  KeyPointStore::getPoints(keys, i_cur, ws.cur_points);
+  
+  const double r2 = r * r;
+  unsigned int n = 0;
+  
+  for(unsigned int k = 0; k < i_old.size(); ++k)
+  {
+    const float *p = &ws.old_points[2 * k];
+    const float *q = &ws.cur_points[2 * k];
     
-    return m_fsolver.checkFundamentalMat(oldMat, curMat, 
-      m_params.max_reprojection_error, m_params.min_Fpoints,
-      m_params.ransac_probability, m_params.max_ransac_iterations);
+    if(Epipolar::sampson2(m_model.fmatrix, p[0], p[1], q[0], q[1]) <= r2)
+    {
+      i_old[n] = i_old[k];
+      i_cur[n] = i_cur[k];
+      ws.distances[n] = ws.distances[k];
+      ws.old_points[2 * n] = p[0]; ws.old_points[2 * n + 1] = p[1];
+      ws.cur_points[2 * n] = q[0]; ws.cur_points[2 * n + 1] = q[1];
+      ++n;
+    }
   }
   
-  return false;
-} 
+  i_old.resize(n);
+  i_cur.resize(n);
+  ws.distances.resize(n);
+  
+  if((int)n < m_params.min_Fpoints) return false;
+  
+  if(usesPose(old_entry, ws))
+    return solvePose(old_entry, i_old, ws, m_params.guided_ransac_iterations);
+  
+  return solveFundamentalMatrix(i_old, ws, m_params.guided_ransac_iterations);
+}
 
 // --------------------------------------------------------------------------
 
-template<class TDescriptor, class F>
-void TemplatedLoopDetector<TDescriptor, F>::getFlannStructure(
-  const std::vector<TDescriptor> &descriptors, 
-  cv::FlannBasedMatcher &flann_structure) const
+template<class TDescriptor, class F, class TGeomCheck>
+void TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::getFlannStructure(
+  const std::vector<TDescriptor> &descriptors, tWorkspace &ws) const
 {
-  vector<cv::Mat> features(1);
+  vector<cv::Mat> &features = ws.flann_features;
+  features.resize(1);
   F::toMat32F(descriptors, features[0]);
   
-  flann_structure.clear();
-  flann_structure.add(features);
-  flann_structure.train();
+  ws.flann.clear();
+  ws.flann.add(features);
+  ws.flann.train();
 }
 
 // --------------------------------------------------------------------------
 
-template<class TDescriptor, class F>
-bool TemplatedLoopDetector<TDescriptor, F>::isGeometricallyConsistent_Flann
+template<class TDescriptor, class F, class TGeomCheck>
+bool TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::isGeometricallyConsistent_Flann
   (EntryId old_entry,
   const std::vector<cv::KeyPoint> &keys, 
-  const std::vector<TDescriptor> &descriptors,
-  cv::FlannBasedMatcher &flann_structure) const
+  const std::vector<TDescriptor> &descriptors, tWorkspace &ws) const
 {
-  vector<unsigned int> i_old, i_cur; // indices of correspondences
+  // indices of correspondences
+  vector<unsigned int> &i_old = ws.i_old, &i_cur = ws.i_cur;
+  
+  const Span<TDescriptor> old_span = verifiedDescriptors(old_entry, ws);
   
-  const vector<cv::KeyPoint>& old_keys = m_image_keys[old_entry];
-  const vector<TDescriptor>& old_descs = m_image_descriptors[old_entry];
-  const vector<cv::KeyPoint>& cur_keys = keys;
+  if(m_params.index_cache_size > 0)
+  {
+    // query the structure of the old entry with the current descriptors
+    if(ws.flann_cache.capacity() != (size_t)m_params.index_cache_size)
+      ws.flann_cache.setCapacity(m_params.index_cache_size);
+    
+    bool hit;
+    cv::FlannBasedMatcher &flann = ws.flann_cache.get(old_entry, hit);
+    
+    if(!hit)
+    {
+      ws.flann_old.assign(old_span.begin(), old_span.end());
+      ws.flann_features.resize(1);
+      ws.flann_features[0] = cv::Mat(); // the structure keeps the old one
+      F::toMat32F(ws.flann_old, ws.flann_features[0]);
+      
+      flann.clear();
+      flann.add(ws.flann_features);
+      flann.train();
+    }
+    
+    F::toMat32F(descriptors, ws.flann_query);
+    
+    vector<vector<cv::DMatch> > &matches = ws.flann_matches;
+    flann.knnMatch(ws.flann_query, matches, 2);
+    
+    ws.table.reset(old_span.size());
+    
+    for(int cur_idx = 0; cur_idx < (int)matches.size(); ++cur_idx)
+    {
+      if(!matches[cur_idx].empty())
+      {
+        float dist = matches[cur_idx][0].distance;
+        bool ok = matches[cur_idx].size() < 2 || 
+          dist / matches[cur_idx][1].distance <= m_params.max_neighbor_ratio;
+        
+        if(ok) ws.table.offer(cur_idx, matches[cur_idx][0].trainIdx, dist);
+      }
+    }
+    
+    return checkReverseMatches(old_entry, keys, descriptors, ws);
+  }
   
-  vector<cv::Mat> queryDescs_v(1);
-  F::toMat32F(old_descs, queryDescs_v[0]);
+  ws.table.reset(descriptors.size());
+  // F::toMat32F takes a vector
+  ws.flann_old.assign(old_span.begin(), old_span.end());
+  F::toMat32F(ws.flann_old, ws.flann_query);
   
-  vector<vector<cv::DMatch> > matches;
+  vector<vector<cv::DMatch> > &matches = ws.flann_matches;
   
-  flann_structure.knnMatch(queryDescs_v[0], matches, 2);
+  ws.flann.knnMatch(ws.flann_query, matches, 2);
   
   for(int old_idx = 0; old_idx < (int)matches.size(); ++old_idx)
   {
@@ -1196,54 +3781,137 @@ bool TemplatedLoopDetector<TDescriptor, F>::isGeometricallyConsistent_Flann
         ok = dist_ratio <= m_params.max_neighbor_ratio;
       }
       
-      if(ok)
-      {
-        vector<unsigned int>::iterator cit =
-          std::find(i_cur.begin(), i_cur.end(), cur_idx);
-        
-        if(cit == i_cur.end())
-        {
-          i_old.push_back(old_idx);
-          i_cur.push_back(cur_idx);
-        }
-        else
-        {
-          int idx = i_old[ cit - i_cur.begin() ];
-          if(dist < matches[idx][0].distance)
-          {
-            i_old[ cit - i_cur.begin() ] = old_idx;
-          }
-        }
-      }
+      if(ok) ws.table.offer(old_idx, cur_idx, dist);
     }
   }
   
+  if(m_params.cross_check)
+  {
+    vector<unsigned int> &i_all_old = ws.i_all_old;
+    i_all_old.resize(old_span.size());
+    for(unsigned int i = 0; i < old_span.size(); ++i) i_all_old[i] = i;
+    
+    crossCheckMatches(old_span, i_all_old, descriptors, ws.table, 0, 
+      ws.kernel);
+  }
+  
+  ws.table.get(i_old, i_cur, &ws.distances);
+  
   if((int)i_old.size() >= m_params.min_Fpoints)
   {
-    // add matches to the vectors for calculating the fundamental matrix
-    vector<unsigned int>::const_iterator oit, cit;
-    oit = i_old.begin();
-    cit = i_cur.begin();
+    return checkFundamentalMatrix(old_entry, i_old, keys, i_cur, ws);
+  }
+  
+  return false;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TGeomCheck>
+bool TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::isGeometricallyConsistent_LSH
+  (EntryId old_entry,
+  const std::vector<cv::KeyPoint> &keys, 
+  const std::vector<TDescriptor> &descriptors, tWorkspace &ws) const
+{
+  vector<unsigned int> &i_old = ws.i_old, &i_cur = ws.i_cur;
+  
+  const Span<TDescriptor> old_descriptors = verifiedDescriptors(old_entry, ws);
+  
+  if(m_params.index_cache_size > 0)
+  {
+    // query the index of the old entry with the current descriptors
+    if(ws.index_cache.capacity() != (size_t)m_params.index_cache_size)
+      ws.index_cache.setCapacity(m_params.index_cache_size);
+    
+    bool hit;
+    DescriptorIndex<TDescriptor, F> &index = 
+      ws.index_cache.get(old_entry, hit);
     
-    vector<cv::Point2f> old_points, cur_points;
-    old_points.reserve(i_old.size());
-    cur_points.reserve(i_cur.size());
+    // the stored descriptors do not move until the detector is cleared
+    if(!hit) index.build(old_descriptors);
     
-    for(; oit != i_old.end(); ++oit, ++cit)
+    ws.table.reset(old_descriptors.size());
+    
+    for(unsigned int cur_idx = 0; cur_idx < descriptors.size(); ++cur_idx)
     {
-      const cv::KeyPoint &old_k = old_keys[*oit];
-      const cv::KeyPoint &cur_k = cur_keys[*cit];
+      int old_idx;
+      double best_dist_1, best_dist_2;
+      
+      index.nearest2(descriptors[cur_idx], old_idx, best_dist_1, 
+        best_dist_2);
       
-      old_points.push_back(old_k.pt);
-      cur_points.push_back(cur_k.pt);
+      if(old_idx >= 0 && 
+        best_dist_1 / best_dist_2 <= m_params.max_neighbor_ratio)
+      {
+        ws.table.offer(cur_idx, old_idx, best_dist_1);
+      }
+    }
+    
+    return checkReverseMatches(old_entry, keys, descriptors, ws);
+  }
+  
+  ws.table.reset(descriptors.size());
+  ws.index.build(descriptors);
+  
+  for(unsigned int old_idx = 0; old_idx < old_descriptors.size(); ++old_idx)
+  {
+    int cur_idx;
+    double best_dist_1, best_dist_2;
+    
+    ws.index.nearest2(old_descriptors[old_idx], cur_idx, best_dist_1, 
+      best_dist_2);
+    
+    if(cur_idx >= 0 && 
+      best_dist_1 / best_dist_2 <= m_params.max_neighbor_ratio)
+    {
+      ws.table.offer(old_idx, cur_idx, best_dist_1);
     }
+  }
+  
+  if(m_params.cross_check)
+  {
+    vector<unsigned int> &i_all_old = ws.i_all_old;
+    i_all_old.resize(old_descriptors.size());
+    for(unsigned int i = 0; i < old_descriptors.size(); ++i) i_all_old[i] = i;
     
-    cv::Mat oldMat(old_points.size(), 2, CV_32F, &old_points[0]);
-    cv::Mat curMat(cur_points.size(), 2, CV_32F, &cur_points[0]);
+    crossCheckMatches(old_descriptors, i_all_old, descriptors, ws.table, 0, 
+      ws.kernel);
+  }
+  
+  ws.table.get(i_old, i_cur, &ws.distances);
+  
+  if((int)i_old.size() >= m_params.min_Fpoints)
+  {
+    return checkFundamentalMatrix(old_entry, i_old, keys, i_cur, ws);
+  }
+  
+  return false;
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TGeomCheck>
+bool TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::checkReverseMatches(
+  EntryId old_entry, const std::vector<cv::KeyPoint> &keys, 
+  const std::vector<TDescriptor> &descriptors, tWorkspace &ws) const
+{
+  vector<unsigned int> &i_old = ws.i_old, &i_cur = ws.i_cur;
+  
+  if(m_params.cross_check)
+  {
+    vector<unsigned int> &i_all_cur = ws.i_all_cur;
+    i_all_cur.resize(descriptors.size());
+    for(unsigned int i = 0; i < descriptors.size(); ++i) i_all_cur[i] = i;
     
-    return m_fsolver.checkFundamentalMat(oldMat, curMat, 
-      m_params.max_reprojection_error, m_params.min_Fpoints,
-      m_params.ransac_probability, m_params.max_ransac_iterations);
+    crossCheckMatches(descriptors, i_all_cur, 
+      verifiedDescriptors(old_entry, ws), ws.table, 0, ws.kernel);
+  }
+  
+  ws.table.get(i_cur, i_old, &ws.distances);
+  
+  if((int)i_old.size() >= m_params.min_Fpoints)
+  {
+    return checkFundamentalMatrix(old_entry, i_old, keys, i_cur, ws);
   }
   
   return false;
@@ -1251,72 +3919,185 @@ bool TemplatedLoopDetector<TDescriptor, F>::isGeometricallyConsistent_Flann
 
 // --------------------------------------------------------------------------
 
-template<class TDescriptor, class F>
-void TemplatedLoopDetector<TDescriptor, F>::getMatches_neighratio(
-  const vector<TDescriptor> &A, const vector<unsigned int> &i_A,
-  const vector<TDescriptor> &B, const vector<unsigned int> &i_B,
-  vector<unsigned int> &i_match_A, vector<unsigned int> &i_match_B) const 
+template<class TDescriptor, class F, class TGeomCheck>
+void TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::getMatches_neighratio(
+  const Span<TDescriptor> &A, const vector<unsigned int> &i_A,
+  const Span<TDescriptor> &B, const vector<unsigned int> &i_B,
+  MatchTable &table, DistanceKernel<TDescriptor, F> &kernel) const 
+{
+  const size_t first = table.size();
+  
+  // the distance kernel is vectorized for some descriptor classes
+  kernel.setCandidates(B.data(), i_B);
+  
+  vector<unsigned int>::const_iterator ait;
+  for(ait = i_A.begin(); ait != i_A.end(); ++ait)
+  {
+    int best_j_now;
+    double best_dist_1, best_dist_2;
+    
+    kernel.nearest2(A[*ait], best_j_now, best_dist_1, best_dist_2);
+    
+    if(best_dist_1 / best_dist_2 <= m_params.max_neighbor_ratio)
+    {
+      // conflicts with previous matches are solved by the table
+      table.offer(*ait, i_B[best_j_now], best_dist_1);
+    }
+  }
+  
+  if(m_params.cross_check)
+    crossCheckMatches(A, i_A, B, table, first, kernel);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TGeomCheck>
+void TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::getMatches_tiled(
+  const Span<TDescriptor> &A, const vector<unsigned int> &i_A,
+  const Span<TDescriptor> &B, const vector<unsigned int> &i_B,
+  MatchTable &table, tWorkspace &ws) const 
 {
-  i_match_A.resize(0);
-  i_match_B.resize(0);
-  i_match_A.reserve( min(i_A.size(), i_B.size()) );
-  i_match_B.reserve( min(i_A.size(), i_B.size()) );
+  const size_t first = table.size();
+  
+  nearestTiled(A, i_A, B, i_B, ws);
+  
+  // offered in the same order as getMatches_neighratio, so that the table
+  // solves the conflicts in the same way
+  for(unsigned int k = 0; k < i_A.size(); ++k)
+  {
+    if(ws.nn_j[k] >= 0 && 
+      ws.nn_d1[k] / ws.nn_d2[k] <= m_params.max_neighbor_ratio)
+    {
+      table.offer(i_A[k], i_B[ws.nn_j[k]], ws.nn_d1[k]);
+    }
+  }
   
-  vector<unsigned int>::const_iterator ait, bit;
-  unsigned int i, j;
-  i = 0;
-  for(ait = i_A.begin(); ait != i_A.end(); ++ait, ++i)
+  if(!m_params.cross_check || first == table.size()) return;
+  
+  // the same test as crossCheckMatches
+  ws.cc_targets.resize(0);
+  for(size_t k = first; k < table.size(); ++k)
+    ws.cc_targets.push_back(table[k].target);
+  
+  nearestTiled(B, ws.cc_targets, A, i_A, ws);
+  
+  for(size_t k = first; k < table.size(); ++k)
   {
-    int best_j_now = -1;
-    double best_dist_1 = 1e9;
-    double best_dist_2 = 1e9;
+    const MatchTable::tMatch &m = table[k];
+    const int best_j = ws.nn_j[k - first];
     
-    j = 0;
-    for(bit = i_B.begin(); bit != i_B.end(); ++bit, ++j)
+    // ties with the query descriptor are accepted
+    if(best_j < 0 || (i_A[best_j] != m.query && 
+      ws.nn_d1[k - first] < F::distance(A[m.query], B[m.target])))
     {
-      double d = F::distance(A[*ait], B[*bit]);
-            
-      // in i
-      if(d < best_dist_1)
-      {
-        best_j_now = j;
-        best_dist_2 = best_dist_1;
-        best_dist_1 = d;
-      }
-      else if(d < best_dist_2)
-      {
-        best_dist_2 = d;
-      }
+      table.reject(k);
     }
+  }
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TGeomCheck>
+void TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::nearestTiled(
+  const Span<TDescriptor> &Q, const vector<unsigned int> &i_Q,
+  const Span<TDescriptor> &T, const vector<unsigned int> &i_T, 
+  tWorkspace &ws) const
+{
+  const int nq = (int)i_Q.size();
+  const int nt = (int)i_T.size();
+  const int threads = std::max(m_params.exhaustive_threads, 1);
+  
+  // with several threads and no tile size, the candidates are split in 
+  // tiles anyway so that each one fits in the L2 cache of its core
+  int tile = m_params.exhaustive_tile;
+  if(tile <= 0) tile = (threads > 1 ? 512 : std::max(nt, 1));
+  
+  const int ntiles = (nt + tile - 1) / tile;
+  ws.tiles.resize(ntiles);
+  for(int t = 0; t < ntiles; ++t)
+    ws.tiles[t].assign(i_T.begin() + t * tile, 
+      i_T.begin() + std::min(nt, (t + 1) * tile));
+  
+  ws.nn_j.assign(nq, -1);
+  ws.nn_d1.assign(nq, 1e9);
+  ws.nn_d2.assign(nq, 1e9);
+  
+  // blocks of queries small enough to go through a tile while it is hot
+  const int block = 64;
+  const int nblocks = (nq + block - 1) / block;
+  
+  ws.matcher_pool.resize(std::min(threads, std::max(nblocks, 1)));
+  while((int)ws.tile_kernels.size() + 1 < ws.matcher_pool.size())
+    ws.tile_kernels.emplace_back();
+  
+  auto task = [&](int b, int w)
+  {
+    DistanceKernel<TDescriptor, F> &kernel = 
+      (w == 0 ? ws.kernel : ws.tile_kernels[w - 1]);
+    const int q0 = b * block, q1 = std::min(nq, q0 + block);
     
-    if(best_dist_1 / best_dist_2 <= m_params.max_neighbor_ratio)
+    for(int t = 0; t < ntiles; ++t)
     {
-      unsigned int idx_B = i_B[best_j_now];
-      bit = find(i_match_B.begin(), i_match_B.end(), idx_B);
+      kernel.setCandidates(T.data(), ws.tiles[t]);
       
-      if(bit == i_match_B.end())
-      {
-        i_match_B.push_back(idx_B);
-        i_match_A.push_back(*ait);
-      }
-      else
+      for(int q = q0; q < q1; ++q)
       {
-        unsigned int idx_A = i_match_A[ bit - i_match_B.begin() ];
-        double d = F::distance(A[idx_A], B[idx_B]);
-        if(best_dist_1 < d)
+        int j;
+        double d1, d2;
+        kernel.nearest2(Q[i_Q[q]], j, d1, d2);
+        if(j < 0) continue;
+        
+        // merged as if the tiles were one set (ties keep the first one)
+        if(d1 < ws.nn_d1[q])
+        {
+          ws.nn_d2[q] = std::min(ws.nn_d1[q], d2);
+          ws.nn_d1[q] = d1;
+          ws.nn_j[q] = t * tile + j;
+        }
+        else
         {
-          i_match_A[ bit - i_match_B.begin() ] = *ait;
+          ws.nn_d2[q] = std::min(ws.nn_d2[q], d1);
         }
       }
-        
+    }
+  };
+  
+  ws.matcher_pool.run(nblocks, task);
+}
+
+// --------------------------------------------------------------------------
+
+template<class TDescriptor, class F, class TGeomCheck>
+void TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::crossCheckMatches(
+  const Span<TDescriptor> &A, const vector<unsigned int> &i_A,
+  const Span<TDescriptor> &B, MatchTable &table, size_t first, 
+  DistanceKernel<TDescriptor, F> &kernel) const
+{
+  if(first == table.size()) return;
+  
+  kernel.setCandidates(A.data(), i_A);
+  
+  for(size_t k = first; k < table.size(); ++k)
+  {
+    const MatchTable::tMatch &m = table[k];
+    
+    int best_j;
+    double best_dist_1, best_dist_2;
+    kernel.nearest2(B[m.target], best_j, best_dist_1, best_dist_2);
+    
+    // ties with the query descriptor are accepted
+    if(best_j < 0 || (i_A[best_j] != m.query && 
+      best_dist_1 < F::distance(A[m.query], B[m.target])))
+    {
+      table.reject(k);
     }
   }
 }
 
 // --------------------------------------------------------------------------
 
-template<class TDescriptor, class F>
-void TemplatedLoopDetector<TDescriptor, F>::removeLowScores(QueryResults &q,
+template<class TDescriptor, class F, class TGeomCheck>
+void TemplatedLoopDetector<TDescriptor, F, TGeomCheck>::removeLowScores(QueryResults &q,
   double threshold) const
 {
   // remember scores in q are in descending order now
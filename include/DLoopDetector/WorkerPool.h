@@ -0,0 +1,197 @@
+/**
+ * File: WorkerPool.h
+ * Date: October 2026
+ * Author: agent
+ * Description: persistent pool of worker threads that run indexed tasks
+ * License: see the LICENSE.txt file
+ *
+ */
+
+#ifndef __D_T_WORKER_POOL__
+#define __D_T_WORKER_POOL__
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+namespace DLoopDetector {
+
+/// Runs the tasks 0..n-1 of a job on a set of workers: the calling thread
+/// (worker 0) and some threads that are kept alive between jobs, so that
+/// starting a job does not create threads. Tasks are taken in increasing
+/// order, and each worker runs its tasks in increasing order too. The
+/// pool only refers to the task of a job while it runs, so that running
+/// a job does not allocate memory
+class WorkerPool
+{
+public:
+
+  /**
+   * Creates a pool with the calling thread only
+   */
+  WorkerPool(): m_job(NULL), m_call(NULL), m_n(0), m_busy(0), m_generation(0),
+    m_stop(false) {}
+
+  /**
+   * Stops the threads
+   */
+  ~WorkerPool() { resize(1); }
+
+  /**
+   * Returns the number of workers, including the calling thread
+   * @return number of workers
+   */
+  inline int size() const { return (int)m_threads.size() + 1; }
+
+  /**
+   * Sets the number of workers. It must not be called during a job
+   * @param n number of workers, including the calling thread (>= 1)
+   */
+  void resize(int n);
+
+  /**
+   * Runs a job and waits for all its tasks to finish
+   * @param n number of tasks
+   * @param task callable object called as task(i, w) for each task i, 
+   *   where w is the index of the worker that runs it (0 for the calling 
+   *   thread)
+   */
+  template<class T>
+  void run(int n, const T &task);
+
+protected:
+
+  /**
+   * Runs tasks of the current job until there are no more
+   * @param w worker index
+   */
+  inline void work(int w)
+  {
+    for(int i = m_next++; i < m_n; i = m_next++) m_call(m_job, i, w);
+  }
+
+  /**
+   * Calls a task of a job
+   * @param job task given to run
+   * @param i task index
+   * @param w worker index
+   */
+  template<class T>
+  static void call(const void *job, int i, int w)
+  {
+    (*static_cast<const T*>(job))(i, w);
+  }
+
+  /**
+   * Main loop of a thread
+   * @param w worker index
+   * @param seen generation of the last job when the thread was created
+   */
+  void loop(int w, unsigned long seen);
+
+protected:
+
+  /// Threads (workers 1..n-1)
+  std::vector<std::thread> m_threads;
+  /// Task of the job being run
+  const void *m_job;
+  /// Calls the task of the job
+  void (*m_call)(const void *, int, int);
+  /// Number of tasks of the job
+  int m_n;
+  /// Next task to run
+  std::atomic<int> m_next;
+  /// Threads that have not finished the job yet
+  int m_busy;
+  /// Number of jobs started
+  unsigned long m_generation;
+  /// Whether the threads must exit
+  bool m_stop;
+  /// Protects the job state
+  std::mutex m_mutex;
+  /// Signals a new job or the exit
+  std::condition_variable m_start;
+  /// Signals the end of a job
+  std::condition_variable m_done;
+};
+
+// --------------------------------------------------------------------------
+
+inline void WorkerPool::resize(int n)
+{
+  if(n < 1) n = 1;
+  if(n == size()) return;
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_start.notify_all();
+  for(size_t i = 0; i < m_threads.size(); ++i) m_threads[i].join();
+  m_threads.clear();
+  m_stop = false;
+
+  m_threads.reserve(n - 1);
+  for(int w = 1; w < n; ++w)
+    m_threads.push_back(std::thread(&WorkerPool::loop, this, w,
+      m_generation));
+}
+
+// --------------------------------------------------------------------------
+
+template<class T>
+void WorkerPool::run(int n, const T &task)
+{
+  if(m_threads.empty() || n <= 1)
+  {
+    for(int i = 0; i < n; ++i) task(i, 0);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_job = &task;
+    m_call = &WorkerPool::call<T>;
+    m_n = n;
+    m_next = 0;
+    m_busy = (int)m_threads.size();
+    ++m_generation;
+  }
+  m_start.notify_all();
+
+  work(0);
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_done.wait(lock, [this]() { return m_busy == 0; });
+  m_job = NULL;
+  m_call = NULL;
+}
+
+// --------------------------------------------------------------------------
+
+inline void WorkerPool::loop(int w, unsigned long seen)
+{
+  for(;;)
+  {
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_start.wait(lock, [this, seen]()
+        { return m_stop || m_generation != seen; });
+      if(m_stop) return;
+      seen = m_generation;
+    }
+
+    work(w);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(--m_busy == 0) m_done.notify_one();
+  }
+}
+
+// --------------------------------------------------------------------------
+
+} // namespace DLoopDetector
+
+#endif
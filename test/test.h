@@ -0,0 +1,90 @@
+/**
+ * File: test.h
+ * Date: October 2026
+ * Author: agent
+ * Description: checks shared by the parts of the test program
+ * License: see the LICENSE.txt file
+ */
+
+#ifndef __D_T_TEST__
+#define __D_T_TEST__
+
+#include <iostream>
+#include <stdint.h>
+
+/// Number of checks that failed
+extern int g_failures;
+
+/// Checks a condition, printing it if it does not hold
+#define CHECK(cond) \
+  do \
+  { \
+    if(!(cond)) \
+    { \
+      ++g_failures; \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond \
+        ") failed" << std::endl; \
+    } \
+  } while(0)
+
+/// Pseudo-random numbers with a fixed sequence (xorshift64*)
+class TestRandom
+{
+public:
+
+  /**
+   * Creates a generator
+   * @param seed
+   */
+  TestRandom(uint64_t seed = 1): m_state(seed ? seed : 1) {}
+
+  /**
+   * Returns 64 random bits
+   * @return bits
+   */
+  inline uint64_t bits()
+  {
+    m_state ^= m_state >> 12;
+    m_state ^= m_state << 25;
+    m_state ^= m_state >> 27;
+    return m_state * 2685821657736338717ULL;
+  }
+
+  /**
+   * Returns a value in [a, b)
+   * @param a
+   * @param b
+   * @return value
+   */
+  inline double uniform(double a, double b)
+  {
+    return a + (b - a) * ((bits() >> 11) * (1.0 / 9007199254740992.0));
+  }
+
+protected:
+
+  /// State
+  uint64_t m_state;
+};
+
+// Parts of the test program
+
+void testHammingKernel();
+void testL2Kernel();
+void testHammingIndex();
+void testBriefKernel();
+void testSurfKernel();
+void testTiledMatches();
+void testMatchTable();
+void testLRUCache();
+void testProsacSolver();
+void testFivePoint();
+void testPoseSolver();
+void testWorkerPool();
+void testSpscQueue();
+void testDetectLoopEquivalence();
+void testQueryScores();
+void testConcurrentReads();
+void testQueryIsolation();
+
+#endif
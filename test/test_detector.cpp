@@ -0,0 +1,525 @@
+/**
+ * File: test_detector.cpp
+ * Date: October 2026
+ * Author: agent
+ * Description: checks that the ways of adding a sequence to a loop detector
+ *   and of querying it give the same results
+ * License: see the LICENSE.txt file
+ */
+
+#include <vector>
+#include <future>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+
+#include <DBoW2/TemplatedVocabulary.h>
+
+#include "TemplatedLoopDetector.h"
+#include "AsyncLoopDetector.h"
+#include "FBrief256.h"
+
+#include "test.h"
+
+using namespace DLoopDetector;
+using namespace std;
+
+typedef TemplatedLoopDetector<FBrief256::TDescriptor, FBrief256>
+  TestDetector;
+
+// ----------------------------------------------------------------------------
+
+/// Images of a camera that goes through some places and then revisits the
+/// first ones. Each place is a set of 3D points with their own descriptors
+struct TestSequence
+{
+  /// Keypoints of each image
+  vector<vector<cv::KeyPoint> > keys;
+  /// Descriptors of each image
+  vector<vector<FBrief256::TDescriptor> > descriptors;
+  /// Place seen by each image
+  vector<int> places;
+};
+
+// ----------------------------------------------------------------------------
+
+/**
+ * Creates a sequence
+ * @param rnd generator
+ * @param n_places number of places
+ * @param n_revisited number of places revisited at the end
+ * @param shots number of images of each visit
+ * @param sequence (out)
+ */
+static void makeSequence(TestRandom &rnd, int n_places, int n_revisited,
+  int shots, TestSequence &sequence)
+{
+  const int n_points = 150;
+  const double f = 500, cx = 320, cy = 240;
+
+  vector<vector<double> > points(n_places);
+  vector<vector<FBrief256::TDescriptor> > words(n_places);
+  for(int p = 0; p < n_places; ++p)
+  {
+    points[p].resize(3 * n_points);
+    words[p].resize(n_points);
+    for(int k = 0; k < n_points; ++k)
+    {
+      points[p][3 * k] = rnd.uniform(-3, 3);
+      points[p][3 * k + 1] = rnd.uniform(-2, 2);
+      points[p][3 * k + 2] = rnd.uniform(5, 10);
+      for(int w = 0; w < FBrief256::W; ++w) words[p][k].words[w] = rnd.bits();
+    }
+  }
+
+  sequence.keys.clear();
+  sequence.descriptors.clear();
+  sequence.places.clear();
+
+  for(int visit = 0; visit < n_places + n_revisited; ++visit)
+  {
+    const int p = visit % n_places;
+    const int pass = visit / n_places;
+
+    for(int s = 0; s < shots; ++s)
+    {
+      // the camera moves sideways, a bit differently on each pass
+      const double tx = 0.1 * s + 0.05 * pass, ty = 0.03 * pass;
+      const double yaw = 0.01 * s - 0.02 * pass;
+      const double c = cos(yaw), sn = sin(yaw);
+
+      vector<cv::KeyPoint> keys;
+      vector<FBrief256::TDescriptor> descriptors;
+      for(int k = 0; k < n_points; ++k)
+      {
+        const double *X = &points[p][3 * k];
+        const double x = c * X[0] + sn * X[2] - tx;
+        const double y = X[1] - ty;
+        const double z = -sn * X[0] + c * X[2];
+
+        cv::KeyPoint kp;
+        kp.pt.x = (float)(f * x / z + cx + rnd.uniform(-0.3, 0.3));
+        kp.pt.y = (float)(f * y / z + cy + rnd.uniform(-0.3, 0.3));
+        if(kp.pt.x < 0 || kp.pt.x >= 640 || kp.pt.y < 0 || kp.pt.y >= 480)
+          continue;
+        kp.size = 31;
+        kp.angle = 0;
+        kp.response = (float)rnd.uniform(0, 1);
+        kp.octave = 0;
+        kp.class_id = -1;
+
+        // a few bits change between images
+        FBrief256::TDescriptor d = words[p][k];
+        for(int b = 0; b < 4; ++b)
+        {
+          const int bit = (int)(rnd.bits() % FBrief256::L);
+          d.words[bit / 64] ^= (uint64_t)1 << (bit % 64);
+        }
+
+        keys.push_back(kp);
+        descriptors.push_back(d);
+      }
+
+      sequence.keys.push_back(keys);
+      sequence.descriptors.push_back(descriptors);
+      sequence.places.push_back(p);
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+/**
+ * Checks if two results are the same
+ * @param a
+ * @param b
+ * @return true iff the status, the ids and the inliers are the same (the
+ *   match id is only compared if there were candidates)
+ */
+static bool sameResult(const DetectionResult &a, const DetectionResult &b)
+{
+  if(a.status != b.status || a.query != b.query || a.inliers != b.inliers)
+    return false;
+
+  const bool candidates = (a.status == LOOP_DETECTED ||
+    a.status >= NO_GROUPS);
+  return !candidates || a.match == b.match;
+}
+
+// ----------------------------------------------------------------------------
+
+/**
+ * Adds a sequence to detectors one image at a time, in a batch and through
+ * the asynchronous pipeline, and checks that the results are the same
+ * @param voc vocabulary
+ * @param params parameters of the detectors
+ * @param sequence
+ * @param first_revisit index of the first image that revisits a place
+ * @return number of loops detected
+ */
+static int checkEquivalence(
+  const TemplatedVocabulary<FBrief256::TDescriptor, FBrief256> &voc,
+  const TestDetector::Parameters &params, const TestSequence &sequence,
+  int first_revisit)
+{
+  const int n = (int)sequence.keys.size();
+
+  // one by one
+  vector<DetectionResult> single(n);
+  {
+    TestDetector detector(voc, params);
+    for(int i = 0; i < n; ++i)
+      detector.detectLoop(sequence.keys[i], sequence.descriptors[i],
+        single[i]);
+  }
+
+  // the loops found are the revisits of their places
+  int loops = 0;
+  for(int i = 0; i < n; ++i)
+  {
+    if(!single[i].detection()) continue;
+    ++loops;
+    CHECK(i >= first_revisit);
+    CHECK(sequence.places[single[i].match] == sequence.places[i]);
+    CHECK(single[i].inliers >= params.min_Fpoints);
+  }
+
+  // batch
+  {
+    TestDetector detector(voc, params);
+    vector<DetectionResult> batch;
+    const unsigned int batch_loops = detector.detectLoopBatch(sequence.keys,
+      sequence.descriptors, batch);
+
+    CHECK((int)batch.size() == n);
+    CHECK((int)batch_loops == loops);
+    for(int i = 0; i < n && i < (int)batch.size(); ++i)
+      CHECK(sameResult(single[i], batch[i]));
+  }
+
+  // asynchronous pipeline
+  {
+    TestDetector detector(voc, params);
+    vector<DetectionResult> delivered;
+    vector<future<DetectionResult> > results(n);
+    {
+      AsyncLoopDetector<FBrief256::TDescriptor, FBrief256> async(detector, 4,
+        [&](const DetectionResult &r) { delivered.push_back(r); });
+
+      for(int i = 0; i < n; ++i)
+      {
+        vector<cv::KeyPoint> keys = sequence.keys[i];
+        vector<FBrief256::TDescriptor> descriptors = sequence.descriptors[i];
+        results[i] = async.push(std::move(keys), std::move(descriptors));
+      }
+      async.flush();
+      CHECK(async.pending() == 0);
+    }
+
+    CHECK((int)delivered.size() == n);
+    for(int i = 0; i < n; ++i)
+    {
+      CHECK(sameResult(single[i], results[i].get()));
+      if(i < (int)delivered.size()) CHECK(sameResult(single[i], delivered[i]));
+    }
+  }
+
+  return loops;
+}
+
+// ----------------------------------------------------------------------------
+
+void testDetectLoopEquivalence()
+{
+  TestRandom rnd(23);
+  TestSequence sequence;
+  const int n_places = 8, n_revisited = 4, shots = 6;
+  makeSequence(rnd, n_places, n_revisited, shots, sequence);
+
+  // vocabulary of the first pass
+  vector<vector<FBrief256::TDescriptor> > training(
+    sequence.descriptors.begin(),
+    sequence.descriptors.begin() + n_places * shots);
+  TemplatedVocabulary<FBrief256::TDescriptor, FBrief256>
+    voc(10, 3, DBoW2::TF_IDF, DBoW2::L1_NORM);
+  voc.create(training);
+
+  TestDetector::Parameters params(480, 640, 1, true, 0.3, 3,
+    GEOM_EXHAUSTIVE);
+  params.estimator = ESTIMATOR_PROSAC;
+  params.batch_threads = 3;
+
+  // (the features of a place are compared exhaustively, so that its
+  // revisits must be found)
+  CHECK(checkEquivalence(voc, params, sequence, n_places * shots) > 0);
+
+  // transformations given to detectLoop by the batch and the pipeline
+  params.geom_check = GEOM_DI;
+  params.di_levels = 2;
+  checkEquivalence(voc, params, sequence, n_places * shots);
+}
+
+// ----------------------------------------------------------------------------
+
+void testQueryScores()
+{
+  TestRandom rnd(25);
+  TestSequence sequence, unrelated;
+  const int n_places = 8, n_revisited = 2, shots = 6;
+  makeSequence(rnd, n_places, n_revisited, shots, sequence);
+  makeSequence(rnd, 1, 0, 1, unrelated);
+
+  vector<vector<FBrief256::TDescriptor> > training(
+    sequence.descriptors.begin(),
+    sequence.descriptors.begin() + n_places * shots);
+  TemplatedVocabulary<FBrief256::TDescriptor, FBrief256>
+    voc(10, 3, DBoW2::TF_IDF, DBoW2::L1_NORM);
+  voc.create(training);
+
+  TestDetector::Parameters params(480, 640, 1, true, 0.3, 3,
+    GEOM_EXHAUSTIVE);
+  params.estimator = ESTIMATOR_PROSAC;
+  // (unrelated images share many words in such a small vocabulary)
+  params.min_query_score = 0.3;
+
+  TestDetector detector(voc, params);
+  DetectionResult match;
+  for(int i = 0; i < n_places * shots; ++i)
+    detector.detectLoop(sequence.keys[i], sequence.descriptors[i], match);
+
+  TestDetector::QueryContext context;
+
+  // an unrelated image is not a loop, even without verification
+  for(int verify = 0; verify < 2; ++verify)
+  {
+    CHECK(!detector.query(unrelated.keys[0], unrelated.descriptors[0], match,
+      context, verify != 0));
+    CHECK(match.status == LOW_SCORES || match.status == NO_GROUPS);
+    CHECK(match.query == (EntryId)(n_places * shots));
+  }
+
+  // a revisit is found
+  const int i = n_places * shots + 2;
+  for(int verify = 0; verify < 2; ++verify)
+  {
+    CHECK(detector.query(sequence.keys[i], sequence.descriptors[i], match,
+      context, verify != 0));
+    CHECK(match.detection());
+    CHECK(sequence.places[match.match] == sequence.places[i]);
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+void testConcurrentReads()
+{
+  TestRandom rnd(24);
+  TestSequence sequence;
+  const int n_places = 8, n_revisited = 3, shots = 6;
+  makeSequence(rnd, n_places, n_revisited, shots, sequence);
+  const int n = (int)sequence.keys.size();
+  const int first_revisit = n_places * shots;
+
+  vector<vector<FBrief256::TDescriptor> > training(
+    sequence.descriptors.begin(),
+    sequence.descriptors.begin() + first_revisit);
+  TemplatedVocabulary<FBrief256::TDescriptor, FBrief256>
+    voc(10, 3, DBoW2::TF_IDF, DBoW2::L1_NORM);
+  voc.create(training);
+
+  TestDetector::Parameters params(480, 640, 1, true, 0.3, 3,
+    GEOM_EXHAUSTIVE);
+  params.estimator = ESTIMATOR_PROSAC;
+  params.min_query_score = 0.3;
+  params.concurrent_reads = true;
+
+  TestDetector detector(voc, params);
+
+  // the reader queries the revisits while the entries are added, and 
+  // keeps each result with the number of entries it saw (match.query)
+  struct tRecord { int image; DetectionResult match; };
+  vector<tRecord> records;
+  std::atomic<bool> done(false);
+  int stale_views = 0, wrong_views = 0;
+
+  std::thread reader([&]()
+  {
+    TestDetector::QueryContext context;
+    for(int round = 0; !done.load() || round < 2; ++round)
+    {
+      // a view held across several queries does not change
+      TestDetector::ReadView view = detector.read();
+      if(!view.valid()) { ++wrong_views; break; }
+      const size_t size = view.size();
+
+      for(int i = first_revisit; i < n; i += shots / 2)
+      {
+        tRecord r;
+        r.image = i;
+        detector.query(sequence.keys[i], sequence.descriptors[i], r.match,
+          context);
+        records.push_back(r);
+      }
+
+      if(view.size() != size) ++stale_views;
+      for(size_t id = 0; id < size; ++id)
+      {
+        const Span<FBrief256::TDescriptor> d = view.getDescriptors(id);
+        const vector<FBrief256::TDescriptor> &e = sequence.descriptors[id];
+        if(d.size() != e.size() || 
+          !std::equal(e.begin(), e.end(), d.begin(), 
+            [](const FBrief256::TDescriptor &a, 
+              const FBrief256::TDescriptor &b) 
+            { return FBrief256::distance(a, b) == 0; }))
+          ++wrong_views;
+      }
+    }
+  });
+
+  DetectionResult match;
+  for(int i = 0; i < n; ++i)
+    detector.detectLoop(sequence.keys[i], sequence.descriptors[i], match);
+  done.store(true);
+  reader.join();
+
+  CHECK(stale_views == 0);
+  CHECK(wrong_views == 0);
+  CHECK(!records.empty());
+
+  // each result is the one of a detector frozen at the size it saw
+  std::stable_sort(records.begin(), records.end(), 
+    [](const tRecord &a, const tRecord &b) 
+    { return a.match.query < b.match.query; });
+
+  params.concurrent_reads = false;
+  TestDetector frozen(voc, params);
+  TestDetector::QueryContext context;
+  int added = 0;
+  for(size_t k = 0; k < records.size(); ++k)
+  {
+    const tRecord &r = records[k];
+    CHECK((int)r.match.query <= n);
+    for(; added < (int)r.match.query && added < n; ++added)
+      frozen.detectLoop(sequence.keys[added], sequence.descriptors[added], 
+        match);
+
+    frozen.query(sequence.keys[r.image], sequence.descriptors[r.image], 
+      match, context);
+    CHECK(sameResult(match, r.match));
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+/**
+ * Checks that queryBatch gives the same results as one query at a time,
+ * with and without verification
+ * @param detector
+ * @param keys keypoints of the images to query
+ * @param descriptors descriptors of the images to query
+ */
+static void checkQueryBatch(const TestDetector &detector,
+  const vector<vector<cv::KeyPoint> > &keys,
+  const vector<vector<FBrief256::TDescriptor> > &descriptors)
+{
+  const int n = (int)keys.size();
+  TestDetector::QueryContext context, batch_context;
+  DetectionResult match;
+
+  for(int verify = 0; verify < 2; ++verify)
+  {
+    vector<DetectionResult> batch;
+    const unsigned int found = detector.queryBatch(keys, descriptors, 
+      batch, batch_context, verify != 0);
+    CHECK((int)batch.size() == n);
+
+    unsigned int single_found = 0;
+    for(int i = 0; i < n && i < (int)batch.size(); ++i)
+    {
+      if(detector.query(keys[i], descriptors[i], match, context, 
+        verify != 0)) ++single_found;
+      CHECK(sameResult(match, batch[i]));
+    }
+    CHECK(found == single_found);
+    CHECK(found > 0);
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+void testQueryIsolation()
+{
+  TestRandom rnd(26);
+  TestSequence sequence, unrelated;
+  const int n_places = 8, n_revisited = 3, shots = 6;
+  makeSequence(rnd, n_places, n_revisited, shots, sequence);
+  makeSequence(rnd, 2, 0, 2, unrelated);
+  const int n = (int)sequence.keys.size();
+  const int first_revisit = n_places * shots;
+
+  vector<vector<FBrief256::TDescriptor> > training(
+    sequence.descriptors.begin(),
+    sequence.descriptors.begin() + first_revisit);
+  TemplatedVocabulary<FBrief256::TDescriptor, FBrief256>
+    voc(10, 3, DBoW2::TF_IDF, DBoW2::L1_NORM);
+  voc.create(training);
+
+  TestDetector::Parameters params(480, 640, 1, true, 0.3, 3,
+    GEOM_EXHAUSTIVE);
+  params.estimator = ESTIMATOR_PROSAC;
+  params.min_query_score = 0.3;
+  params.batch_threads = 3;
+
+  // images to query: all the revisits and the unrelated ones
+  vector<vector<cv::KeyPoint> > qkeys(sequence.keys.begin() + first_revisit,
+    sequence.keys.end());
+  vector<vector<FBrief256::TDescriptor> > qdescriptors(
+    sequence.descriptors.begin() + first_revisit, 
+    sequence.descriptors.end());
+  qkeys.insert(qkeys.end(), unrelated.keys.begin(), unrelated.keys.end());
+  qdescriptors.insert(qdescriptors.end(), unrelated.descriptors.begin(),
+    unrelated.descriptors.end());
+  const int nq = (int)qkeys.size();
+
+  for(int concurrent = 0; concurrent < 2; ++concurrent)
+  {
+    params.concurrent_reads = (concurrent != 0);
+
+    // queries between the additions do not change their results
+    vector<DetectionResult> plain(n), queried(n);
+    {
+      TestDetector detector(voc, params);
+      for(int i = 0; i < n; ++i)
+        detector.detectLoop(sequence.keys[i], sequence.descriptors[i],
+          plain[i]);
+    }
+
+    TestDetector detector(voc, params);
+    TestDetector::QueryContext context;
+    DetectionResult match;
+    for(int i = 0; i < n; ++i)
+    {
+      // (before the revisits are added, since an image is not verified
+      // against itself)
+      if(i == first_revisit) checkQueryBatch(detector, qkeys, qdescriptors);
+
+      for(int q = i % 4; q < nq; q += 4)
+      {
+        detector.query(qkeys[q], qdescriptors[q], match, context, 
+          q % 2 == 0);
+        CHECK(match.query == (EntryId)i);
+      }
+      detector.detectLoop(sequence.keys[i], sequence.descriptors[i],
+        queried[i]);
+    }
+
+    int loops = 0;
+    for(int i = 0; i < n; ++i)
+    {
+      CHECK(sameResult(plain[i], queried[i]));
+      if(plain[i].detection()) ++loops;
+    }
+    CHECK(loops > 0);
+  }
+}
@@ -0,0 +1,503 @@
+/**
+ * File: test_kernels.cpp
+ * Date: October 2026
+ * Author: agent
+ * Description: checks of the distance kernels against the scalar distances
+ *   of the descriptor classes
+ * License: see the LICENSE.txt file
+ */
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include "FBrief256.h"
+#include "FSurf64Fixed.h"
+#include "HammingKernel.h"
+#include "HammingIndex.h"
+#include "L2Kernel.h"
+#include "DistanceKernel.h"
+#include "DLoopDetector.h"
+
+#include "test.h"
+
+using namespace DLoopDetector;
+using namespace std;
+
+// ----------------------------------------------------------------------------
+
+/**
+ * Finds the two nearest candidates with F::distance
+ * @param a query
+ * @param B candidates
+ * @param best_j (out)
+ * @param best_d1 (out)
+ * @param best_d2 (out)
+ */
+template<class TDescriptor, class F>
+static void nearest2Reference(const TDescriptor &a, 
+  const vector<TDescriptor> &B, int &best_j, double &best_d1, 
+  double &best_d2)
+{
+  best_j = -1;
+  best_d1 = best_d2 = 1e9;
+  for(unsigned int j = 0; j < B.size(); ++j)
+  {
+    const double d = F::distance(a, B[j]);
+    if(d < best_d1)
+    {
+      best_j = j;
+      best_d2 = best_d1;
+      best_d1 = d;
+    }
+    else if(d < best_d2)
+    {
+      best_d2 = d;
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+/**
+ * Checks an implementation of the Hamming kernel against FBrief256::hamming
+ * @param kernel
+ * @param q query
+ * @param B candidates
+ */
+static void checkHamming(
+  void (*kernel)(const uint64_t *, const uint64_t *, int, int *),
+  const FBrief256::TDescriptor &q, const vector<FBrief256::TDescriptor> &B)
+{
+  const int n = (int)B.size();
+  vector<uint64_t> train(4 * n + 1);
+  for(int j = 0; j < n; ++j)
+    std::copy(B[j].words, B[j].words + 4, train.begin() + 4 * j);
+
+  vector<int> dist(n + 1, -1);
+  kernel(q.words, &train[0], n, &dist[0]);
+
+  for(int j = 0; j < n; ++j) CHECK(dist[j] == FBrief256::hamming(q, B[j]));
+  CHECK(dist[n] == -1);
+}
+
+// ----------------------------------------------------------------------------
+
+void testHammingKernel()
+{
+  TestRandom rnd(3);
+
+  // sizes around the widths of the vector implementations
+  const int sizes[] = { 0, 1, 3, 4, 5, 7, 8, 9, 15, 16, 17, 100 };
+
+  for(unsigned int s = 0; s < sizeof(sizes) / sizeof(int); ++s)
+  {
+    const int n = sizes[s];
+
+    FBrief256::TDescriptor q;
+    for(int w = 0; w < FBrief256::W; ++w) q.words[w] = rnd.bits();
+
+    // some candidates close to the query, some equal to each other
+    vector<FBrief256::TDescriptor> B(n);
+    for(int j = 0; j < n; ++j)
+    {
+      for(int w = 0; w < FBrief256::W; ++w)
+      {
+        B[j].words[w] = (j % 3 == 0 ? q.words[w] ^ (rnd.bits() & 
+          rnd.bits() & rnd.bits()) : rnd.bits());
+      }
+      if(j % 5 == 4) B[j] = B[j - 1];
+    }
+
+    checkHamming(&HammingKernelImpl::kernelScalar, q, B);
+#ifdef DLOOPDETECTOR_X86_DISPATCH
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("popcnt"))
+      checkHamming(&HammingKernelImpl::kernelPopcnt, q, B);
+    if(__builtin_cpu_supports("avx2"))
+      checkHamming(&HammingKernelImpl::kernelAVX2, q, B);
+    if(__builtin_cpu_supports("avx512f") &&
+      __builtin_cpu_supports("avx512vpopcntdq"))
+      checkHamming(&HammingKernelImpl::kernelAVX512, q, B);
+#endif
+
+    // the kernel of the detector, with the same ties as F::distance
+    vector<unsigned int> i_B(n);
+    for(int j = 0; j < n; ++j) i_B[j] = j;
+
+    DistanceKernel<FBrief256::TDescriptor, FBrief256> kernel;
+    kernel.setCandidates(n ? &B[0] : NULL, i_B);
+
+    int j1, j2;
+    double a1, a2, b1, b2;
+    kernel.nearest2(q, j1, a1, a2);
+    nearest2Reference<FBrief256::TDescriptor, FBrief256>(q, B, j2, b1, b2);
+
+    CHECK(j1 == j2);
+    CHECK(a1 == b1);
+    CHECK(a2 == b2);
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+void testHammingIndex()
+{
+  TestRandom rnd(12);
+  const int W = HammingIndex::W;
+
+  HammingIndex index;
+  int j;
+  double d1, d2;
+
+  // empty index
+  index.build(NULL, 0);
+  uint64_t q[W] = { rnd.bits(), rnd.bits(), rnd.bits(), rnd.bits() };
+  index.nearest2(q, j, d1, d2);
+  CHECK(j == -1 && d1 == 1e9 && d2 == 1e9);
+
+  // near-duplicates share most of their bytes with their original, so the
+  // nearest descriptor is always a candidate. The second one may not be,
+  // so that it can only be farther than the exact one
+  const int sizes[] = { 1, 2, 50, 1000 };
+  for(unsigned int s = 0; s < sizeof(sizes) / sizeof(int); ++s)
+  {
+    const int n = sizes[s];
+    vector<uint64_t> train((size_t)n * W);
+    for(size_t k = 0; k < train.size(); ++k) train[k] = rnd.bits();
+    index.build(&train[0], n);
+    CHECK(index.size() == n);
+
+    vector<int> dist(n);
+    for(int i = 0; i < 200; ++i)
+    {
+      const uint64_t *orig = &train[(size_t)(rnd.bits() % n) * W];
+      for(int w = 0; w < W; ++w) q[w] = orig[w];
+      const int flips = (int)(rnd.bits() % 11);
+      for(int f = 0; f < flips; ++f) 
+        q[rnd.bits() % W] ^= (uint64_t)1 << (rnd.bits() % 64);
+
+      int ej;
+      double e1, e2;
+      HammingKernel::nearest2(q, &train[0], n, &dist[0], ej, e1, e2);
+      index.nearest2(q, j, d1, d2);
+
+      CHECK(j >= 0 && j < n);
+      CHECK(d1 == e1);
+      CHECK(j >= 0 && dist[j] == (int)e1);
+      CHECK(d2 >= e2);
+    }
+  }
+
+  // no byte of the query in any table: no candidates
+  const int n = 100;
+  vector<uint64_t> train((size_t)n * W);
+  for(size_t k = 0; k < train.size(); ++k) 
+    train[k] = rnd.bits() & 0x7F7F7F7F7F7F7F7FULL;
+  index.build(&train[0], n);
+  for(int w = 0; w < W; ++w) q[w] = ~(uint64_t)0;
+  index.nearest2(q, j, d1, d2);
+  CHECK(j == -1 && d1 == 1e9 && d2 == 1e9);
+
+  // one shared byte is enough
+  q[2] = (q[2] & ~(uint64_t)0xFF00) | (train[5 * W + 2] & 0xFF00);
+  index.nearest2(q, j, d1, d2);
+  CHECK(j >= 0 && d1 < 1e9);
+}
+
+// ----------------------------------------------------------------------------
+
+/**
+ * Creates a random BRIEF bitset
+ * @param rnd generator
+ * @param L number of bits
+ * @param bits (out)
+ */
+static void randomBitset(TestRandom &rnd, int L, FBrief::TDescriptor &bits)
+{
+  bits.resize(L);
+  for(int i = 0; i < L; ++i) bits[i] = (rnd.bits() & 1);
+}
+
+// ----------------------------------------------------------------------------
+
+void testBriefKernel()
+{
+  TestRandom rnd(30);
+
+  const int sizes[] = { 0, 1, 5, 16, 100 };
+  // bitsets of FBrief256::L bits are packed, the others are not
+  const int lengths[] = { FBrief256::L, 128 };
+
+  for(unsigned int l = 0; l < 2; ++l)
+  {
+    for(unsigned int s = 0; s < sizeof(sizes) / sizeof(int); ++s)
+    {
+      const int n = sizes[s], L = lengths[l];
+
+      FBrief::TDescriptor q;
+      randomBitset(rnd, L, q);
+
+      // some candidates close to the query, some equal to each other
+      vector<FBrief::TDescriptor> B(n);
+      for(int j = 0; j < n; ++j)
+      {
+        if(j % 5 == 4) B[j] = B[j - 1];
+        else if(j % 3 == 0)
+        {
+          B[j] = q;
+          for(int k = 0; k < 10; ++k) B[j].flip(rnd.bits() % L);
+        }
+        else randomBitset(rnd, L, B[j]);
+      }
+
+      // (a subset, in another order)
+      vector<unsigned int> i_B;
+      for(int j = n - 1; j >= 0; --j) if(j % 7 != 6) i_B.push_back(j);
+      vector<FBrief::TDescriptor> C(i_B.size());
+      for(unsigned int j = 0; j < i_B.size(); ++j) C[j] = B[i_B[j]];
+
+      DistanceKernel<FBrief::TDescriptor, FBrief> kernel;
+      kernel.setCandidates(n ? &B[0] : NULL, i_B);
+
+      int j1, j2;
+      double a1, a2, b1, b2;
+      kernel.nearest2(q, j1, a1, a2);
+      nearest2Reference<FBrief::TDescriptor, FBrief>(q, C, j2, b1, b2);
+
+      CHECK(j1 == j2);
+      CHECK(a1 == b1);
+      CHECK(a2 == b2);
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+/**
+ * Says whether two distances are equal but for the rounding of the sums
+ * @param a
+ * @param b
+ * @return true iff close
+ */
+static bool closeDistances(double a, double b)
+{
+  return std::fabs(a - b) <= 1e-4 * std::max(1., std::fabs(b));
+}
+
+// ----------------------------------------------------------------------------
+
+void testSurfKernel()
+{
+  TestRandom rnd(40);
+
+  const int sizes[] = { 0, 1, 5, 33 };
+  // descriptors of FSurf64::L values take the vector kernel, the others
+  // (also empty ones) are compared with FSurf64::distance
+  const int lengths[] = { FSurf64::L, 16, 0 };
+
+  for(unsigned int l = 0; l < 3; ++l)
+  {
+    for(unsigned int s = 0; s < sizeof(sizes) / sizeof(int); ++s)
+    {
+      const int n = sizes[s], L = lengths[l];
+
+      FSurf64::TDescriptor q(L);
+      for(int k = 0; k < L; ++k) q[k] = rnd.uniform(-1, 1);
+
+      vector<FSurf64::TDescriptor> B(n, FSurf64::TDescriptor(L));
+      for(int j = 0; j < n; ++j)
+      {
+        const double spread = (j % 3 == 0 ? 0.05 : 1.);
+        for(int k = 0; k < L; ++k) B[j][k] = q[k] + 
+          rnd.uniform(-spread, spread);
+      }
+
+      // (a subset, in another order)
+      vector<unsigned int> i_B;
+      for(int j = n - 1; j >= 0; --j) if(j % 4 != 3) i_B.push_back(j);
+      vector<FSurf64::TDescriptor> C(i_B.size());
+      for(unsigned int j = 0; j < i_B.size(); ++j) C[j] = B[i_B[j]];
+
+      DistanceKernel<FSurf64::TDescriptor, FSurf64> kernel;
+      kernel.setCandidates(n ? &B[0] : NULL, i_B);
+
+      int j1, j2;
+      double a1, a2, b1, b2;
+      kernel.nearest2(q, j1, a1, a2);
+      nearest2Reference<FSurf64::TDescriptor, FSurf64>(q, C, j2, b1, b2);
+
+      CHECK(j1 == j2);
+      CHECK(closeDistances(a1, b1));
+      CHECK(closeDistances(a2, b2));
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+void testL2Kernel()
+{
+  TestRandom rnd(4);
+
+  const int sizes[] = { 0, 1, 2, 3, 8, 33, 200 };
+
+  for(unsigned int s = 0; s < sizeof(sizes) / sizeof(int); ++s)
+  {
+    const int n = sizes[s];
+
+    FSurf64Fixed::TDescriptor q;
+    for(int k = 0; k < FSurf64Fixed::L; ++k) q[k] = rnd.uniform(-1, 1);
+
+    // some candidates close to the query, so that the others are abandoned
+    vector<FSurf64Fixed::TDescriptor> B(n);
+    for(int j = 0; j < n; ++j)
+    {
+      const double spread = (j % 4 == 0 ? 0.05 : 1.);
+      for(int k = 0; k < FSurf64Fixed::L; ++k)
+        B[j][k] = q[k] + rnd.uniform(-spread, spread);
+    }
+
+    vector<unsigned int> i_B(n);
+    for(int j = 0; j < n; ++j) i_B[j] = j;
+
+    DistanceKernel<FSurf64Fixed::TDescriptor, FSurf64Fixed> kernel;
+    kernel.setCandidates(n ? &B[0] : NULL, i_B);
+
+    int j1, j2;
+    double a1, a2, b1, b2;
+    kernel.nearest2(q, j1, a1, a2);
+    nearest2Reference<FSurf64Fixed::TDescriptor, FSurf64Fixed>(q, B, 
+      j2, b1, b2);
+
+    CHECK(j1 == j2);
+    CHECK(closeDistances(a1, b1));
+    CHECK(closeDistances(a2, b2));
+
+    // a length that the vector code does not take
+    const int L = 20;
+    vector<const float*> train(n);
+    for(int j = 0; j < n; ++j) train[j] = B[j].v;
+
+    L2Kernel::nearest2(q.v, n ? &train[0] : NULL, n, L, j1, a1, a2);
+
+    j2 = -1;
+    b1 = b2 = 1e9;
+    for(int j = 0; j < n; ++j)
+    {
+      double d = 0;
+      for(int k = 0; k < L; ++k) d += (q[k] - B[j][k]) * (q[k] - B[j][k]);
+      L2KernelImpl::update2(d, j, j2, b1, b2);
+    }
+
+    CHECK(j1 == j2);
+    CHECK(closeDistances(a1, b1));
+    CHECK(closeDistances(a2, b2));
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+/// Detector that exposes its exhaustive matchers
+class TestMatcher: 
+  public TemplatedLoopDetector<FBrief256::TDescriptor, FBrief256>
+{
+public:
+
+  typedef TemplatedLoopDetector<FBrief256::TDescriptor, FBrief256> Base;
+  typedef Base::tWorkspace Workspace;
+
+  /**
+   * Creates the matcher
+   * @param params
+   */
+  TestMatcher(const Parameters &params): Base(params) {}
+
+  using Base::getMatches_neighratio;
+  using Base::getMatches_tiled;
+};
+
+// ----------------------------------------------------------------------------
+
+/**
+ * Says whether two match tables have the same matches in the same order
+ * @param a
+ * @param b
+ * @return true iff equal
+ */
+static bool sameMatches(const MatchTable &a, const MatchTable &b)
+{
+  if(a.size() != b.size()) return false;
+  for(size_t k = 0; k < a.size(); ++k)
+  {
+    if(a[k].query != b[k].query || a[k].target != b[k].target ||
+      a[k].distance != b[k].distance || a[k].valid != b[k].valid)
+      return false;
+  }
+  return true;
+}
+
+// ----------------------------------------------------------------------------
+
+void testTiledMatches()
+{
+  TestRandom rnd(20);
+
+  // descriptors near a few bases, so that there are many ties and many
+  // queries compete for the same targets
+  const int nbases = 40, nA = 300, nB = 500;
+  vector<FBrief256::TDescriptor> bases(nbases);
+  for(int i = 0; i < nbases; ++i)
+    for(int w = 0; w < FBrief256::W; ++w) bases[i].words[w] = rnd.bits();
+
+  vector<FBrief256::TDescriptor> A(nA), B(nB);
+  for(int i = 0; i < nA + nB; ++i)
+  {
+    FBrief256::TDescriptor &d = (i < nA ? A[i] : B[i - nA]);
+    d = bases[rnd.bits() % nbases];
+    if(rnd.bits() % 2) d.words[rnd.bits() % FBrief256::W] ^= 
+      (uint64_t)1 << (rnd.bits() % 64);
+  }
+
+  // (subsets, in another order)
+  vector<unsigned int> i_A, i_B;
+  for(int i = nA - 1; i >= 0; --i) if(i % 5 != 2) i_A.push_back(i);
+  for(int j = 0; j < nB; ++j) if(j % 7 != 3) i_B.push_back(j);
+
+  const Span<FBrief256::TDescriptor> sA(&A[0], A.size()), sB(&B[0], 
+    B.size());
+
+  const int tiles[] = { 0, 1, 7, 64, 1000 };
+  const int threads[] = { 1, 2, 4 };
+  const double ratios[] = { 0.6, 1. };
+
+  for(int c = 0; c < 2; ++c)
+    for(int r = 0; r < 2; ++r)
+      for(int t = 0; t < 5; ++t)
+        for(int h = 0; h < 3; ++h)
+        {
+          TestMatcher::Parameters params;
+          params.cross_check = (c == 1);
+          params.max_neighbor_ratio = ratios[r];
+          params.exhaustive_tile = tiles[t];
+          params.exhaustive_threads = threads[h];
+
+          TestMatcher matcher(params);
+          TestMatcher::Workspace ws;
+
+          MatchTable expected, tiled;
+          expected.reset(nB);
+          tiled.reset(nB);
+
+          // twice, to check the workspace is reused right
+          matcher.getMatches_neighratio(sA, i_A, sB, i_B, expected, 
+            ws.kernel);
+          for(int k = 0; k < 2; ++k)
+          {
+            tiled.reset(nB);
+            matcher.getMatches_tiled(sA, i_A, sB, i_B, tiled, ws);
+            CHECK(sameMatches(tiled, expected));
+          }
+          CHECK(expected.size() > 0);
+        }
+}
@@ -0,0 +1,117 @@
+/**
+ * File: test_lru_cache.cpp
+ * Date: October 2026
+ * Author: agent
+ * Description: checks of the replacement policy of LRUCache
+ * License: see the LICENSE.txt file
+ */
+
+#include <vector>
+
+#include "LRUCache.h"
+
+#include "test.h"
+
+using namespace DLoopDetector;
+using namespace std;
+
+// ----------------------------------------------------------------------------
+
+/**
+ * Checks the keys of a cache, from the most recently used one
+ * @param cache
+ * @param keys expected keys
+ * @return true iff they are the same
+ */
+static bool sameOrder(const LRUCache<int, vector<int> > &cache,
+  const vector<int> &keys)
+{
+  if(cache.size() != keys.size()) return false;
+
+  LRUCache<int, vector<int> >::const_iterator it = cache.begin();
+  for(unsigned int i = 0; i < keys.size(); ++i, ++it)
+  {
+    if(it->first != keys[i]) return false;
+  }
+  return it == cache.end();
+}
+
+// ----------------------------------------------------------------------------
+
+void testLRUCache()
+{
+  LRUCache<int, vector<int> > cache(3);
+  bool hit;
+
+  // misses give new values
+  for(int k = 1; k <= 3; ++k)
+  {
+    vector<int> &v = cache.get(k, hit);
+    CHECK(!hit && v.empty());
+    v.assign(k, k);
+  }
+  CHECK(sameOrder(cache, vector<int>{3, 2, 1}));
+
+  // a hit returns the value and makes the key the most recent one
+  {
+    vector<int> &v = cache.get(1, hit);
+    CHECK(hit && v == vector<int>(1, 1));
+  }
+  CHECK(sameOrder(cache, vector<int>{1, 3, 2}));
+
+  // at capacity, a miss takes the value of the least recently used key
+  {
+    vector<int> &v = cache.get(4, hit);
+    CHECK(!hit && v == vector<int>(2, 2));
+    v.assign(4, 4);
+  }
+  CHECK(sameOrder(cache, vector<int>{4, 1, 3}));
+  cache.get(2, hit);
+  CHECK(!hit);
+  CHECK(sameOrder(cache, vector<int>{2, 4, 1}));
+
+  CHECK(cache.hits() == 1 && cache.misses() == 5);
+
+  // shrinking evicts the least recently used keys
+  cache.setCapacity(1);
+  CHECK(cache.capacity() == 1);
+  CHECK(sameOrder(cache, vector<int>{2}));
+  cache.setCapacity(2);
+  CHECK(sameOrder(cache, vector<int>{2}));
+  cache.get(4, hit);
+  CHECK(!hit);
+  CHECK(sameOrder(cache, vector<int>{4, 2}));
+
+  // clearing keeps the counters
+  cache.clear();
+  CHECK(cache.size() == 0);
+  CHECK(cache.hits() == 1 && cache.misses() == 6);
+  {
+    vector<int> &v = cache.get(4, hit);
+    CHECK(!hit && v.empty());
+  }
+
+  // same keys as a reference list of recent keys
+  TestRandom rnd(13);
+  cache.clear();
+  cache.setCapacity(8);
+  vector<int> recent;
+  for(int i = 0; i < 2000; ++i)
+  {
+    const int k = (int)(rnd.bits() % 20);
+    vector<int> &v = cache.get(k, hit);
+
+    vector<int>::iterator it = recent.begin();
+    while(it != recent.end() && *it != k) ++it;
+    CHECK(hit == (it != recent.end()));
+    if(hit)
+    {
+      CHECK(v.size() == 1 && v[0] == k);
+      recent.erase(it);
+    }
+    else if(recent.size() == 8) recent.pop_back();
+    recent.insert(recent.begin(), k);
+    v.assign(1, k);
+  }
+  CHECK(sameOrder(cache, recent));
+}
@@ -0,0 +1,47 @@
+/**
+ * File: test_main.cpp
+ * Date: October 2026
+ * Author: agent
+ * Description: test program of DLoopDetector
+ * License: see the LICENSE.txt file
+ */
+
+#include <iostream>
+
+#include "test.h"
+
+using namespace std;
+
+int g_failures = 0;
+
+// ----------------------------------------------------------------------------
+
+int main()
+{
+  testHammingKernel();
+  testL2Kernel();
+  testHammingIndex();
+  testBriefKernel();
+  testSurfKernel();
+  testTiledMatches();
+  testMatchTable();
+  testLRUCache();
+  testProsacSolver();
+  testFivePoint();
+  testPoseSolver();
+  testWorkerPool();
+  testSpscQueue();
+  testDetectLoopEquivalence();
+  testQueryScores();
+  testConcurrentReads();
+  testQueryIsolation();
+
+  if(g_failures > 0)
+  {
+    cout << g_failures << " checks failed" << endl;
+    return 1;
+  }
+
+  cout << "All checks passed" << endl;
+  return 0;
+}
@@ -0,0 +1,100 @@
+/**
+ * File: test_match_table.cpp
+ * Date: October 2026
+ * Author: agent
+ * Description: checks of the resolution of match conflicts
+ * License: see the LICENSE.txt file
+ */
+
+#include <vector>
+
+#include "MatchTable.h"
+
+#include "test.h"
+
+using namespace DLoopDetector;
+using namespace std;
+
+// ----------------------------------------------------------------------------
+
+void testMatchTable()
+{
+  MatchTable table;
+  vector<unsigned int> i_query, i_target;
+  vector<double> distances;
+
+  table.reset(10);
+  table.offer(0, 5, 3.);
+  table.offer(1, 2, 1.);
+  table.offer(2, 5, 2.); // closer: replaces query 0, keeps the position
+  table.offer(3, 5, 2.); // tie: the first one stays
+  table.offer(4, 7, 4.);
+  table.offer(5, 2, 1.5); // farther: ignored
+
+  CHECK(table.size() == 3);
+  table.get(i_query, i_target, &distances);
+  CHECK(i_query.size() == 3);
+  if(i_query.size() == 3)
+  {
+    CHECK(i_query[0] == 2 && i_target[0] == 5 && distances[0] == 2.);
+    CHECK(i_query[1] == 1 && i_target[1] == 2 && distances[1] == 1.);
+    CHECK(i_query[2] == 4 && i_target[2] == 7 && distances[2] == 4.);
+  }
+
+  // a rejected match keeps its target
+  table.reject(0);
+  table.offer(6, 5, 0.5);
+  table.get(i_query, i_target);
+  CHECK(i_query.size() == 2);
+  if(i_query.size() == 2)
+  {
+    CHECK(i_query[0] == 1 && i_target[0] == 2);
+    CHECK(i_query[1] == 4 && i_target[1] == 7);
+  }
+
+  // reset frees the used slots and grows the table
+  table.reset(20);
+  CHECK(table.size() == 0);
+  table.offer(0, 5, 9.);
+  table.offer(1, 19, 1.);
+  table.get(i_query, i_target, &distances);
+  CHECK(i_query.size() == 2);
+  if(i_query.size() == 2)
+  {
+    CHECK(i_query[0] == 0 && i_target[0] == 5 && distances[0] == 9.);
+    CHECK(i_query[1] == 1 && i_target[1] == 19);
+  }
+
+  // same result as keeping the closest query of each target by brute force
+  TestRandom rnd(11);
+  const unsigned int nq = 300, nt = 50;
+  vector<int> best_q(nt, -1);
+  vector<double> best_d(nt, 1e9);
+  vector<int> first(nt, -1);
+  int order = 0;
+
+  table.reset(nt);
+  for(unsigned int q = 0; q < nq; ++q)
+  {
+    const unsigned int t = (unsigned int)(rnd.bits() % nt);
+    const double d = (double)(rnd.bits() % 20);
+    table.offer(q, t, d);
+
+    if(first[t] < 0) first[t] = order++;
+    if(d < best_d[t])
+    {
+      best_d[t] = d;
+      best_q[t] = q;
+    }
+  }
+
+  table.get(i_query, i_target, &distances);
+  CHECK((int)i_query.size() == order);
+  for(unsigned int i = 0; i < i_query.size(); ++i)
+  {
+    const unsigned int t = i_target[i];
+    CHECK(first[t] == (int)i);
+    CHECK(best_q[t] == (int)i_query[i]);
+    CHECK(best_d[t] == distances[i]);
+  }
+}
@@ -0,0 +1,375 @@
+/**
+ * File: test_solvers.cpp
+ * Date: October 2026
+ * Author: agent
+ * Description: checks of the geometric solvers on synthetic scenes
+ * License: see the LICENSE.txt file
+ */
+
+#include <vector>
+#include <cmath>
+
+#include "Epipolar.h"
+#include "FivePoint.h"
+#include "P3P.h"
+#include "ProsacSolver.h"
+
+#include "test.h"
+
+using namespace DLoopDetector;
+using namespace std;
+
+// ----------------------------------------------------------------------------
+
+/// Two views of random points, some of whose correspondences are wrong
+struct TestScene
+{
+  /// Intrinsic parameters of both cameras
+  double fx, fy, cx, cy;
+  /// Pose of camera 2 w.r.t. camera 1 (X2 = R * X1 + t)
+  double R[9], t[3];
+  /// Points in the frame of camera 1 (x, y, z)
+  vector<float> P;
+  /// Keypoints (pixels)
+  vector<float> x1, x2;
+  /// Whether each correspondence is right
+  vector<unsigned char> good;
+};
+
+// ----------------------------------------------------------------------------
+
+/**
+ * Computes a rotation matrix from an axis-angle vector
+ * @param w rotation vector (radians)
+ * @param R (out) rotation (row-major)
+ */
+static void rodrigues(const double *w, double *R)
+{
+  const double a = sqrt(w[0] * w[0] + w[1] * w[1] + w[2] * w[2]);
+  const double x = w[0] / a, y = w[1] / a, z = w[2] / a;
+  const double c = cos(a), s = sin(a), v = 1 - c;
+
+  R[0] = c + x * x * v;     R[1] = x * y * v - z * s; R[2] = x * z * v + y * s;
+  R[3] = y * x * v + z * s; R[4] = c + y * y * v;     R[5] = y * z * v - x * s;
+  R[6] = z * x * v - y * s; R[7] = z * y * v + x * s; R[8] = c + z * z * v;
+}
+
+// ----------------------------------------------------------------------------
+
+/**
+ * Creates a scene whose first correspondences are right
+ * @param rnd generator
+ * @param n number of correspondences
+ * @param n_good number of right correspondences
+ * @param noise max error of the keypoints (pixels)
+ * @param scene (out)
+ */
+static void makeScene(TestRandom &rnd, int n, int n_good, double noise,
+  TestScene &scene)
+{
+  scene.fx = scene.fy = 500;
+  scene.cx = 320; scene.cy = 240;
+
+  const double w[3] = { 0.05, -0.1, 0.02 };
+  rodrigues(w, scene.R);
+  scene.t[0] = -0.6; scene.t[1] = 0.1; scene.t[2] = 0.05;
+
+  scene.P.resize(3 * n);
+  scene.x1.resize(2 * n);
+  scene.x2.resize(2 * n);
+  scene.good.resize(n);
+
+  for(int k = 0; k < n; ++k)
+  {
+    const double X[3] = { rnd.uniform(-2, 2), rnd.uniform(-1.5, 1.5),
+      rnd.uniform(4, 8) };
+    double Y[3];
+    for(int i = 0; i < 3; ++i)
+      Y[i] = scene.R[3 * i] * X[0] + scene.R[3 * i + 1] * X[1] +
+        scene.R[3 * i + 2] * X[2] + scene.t[i];
+
+    for(int i = 0; i < 3; ++i) scene.P[3 * k + i] = (float)X[i];
+
+    scene.x1[2 * k] = (float)(scene.fx * X[0] / X[2] + scene.cx +
+      rnd.uniform(-noise, noise));
+    scene.x1[2 * k + 1] = (float)(scene.fy * X[1] / X[2] + scene.cy +
+      rnd.uniform(-noise, noise));
+
+    scene.good[k] = (k < n_good);
+    if(scene.good[k])
+    {
+      scene.x2[2 * k] = (float)(scene.fx * Y[0] / Y[2] + scene.cx +
+        rnd.uniform(-noise, noise));
+      scene.x2[2 * k + 1] = (float)(scene.fy * Y[1] / Y[2] + scene.cy +
+        rnd.uniform(-noise, noise));
+    }
+    else
+    {
+      scene.x2[2 * k] = (float)rnd.uniform(0, 640);
+      scene.x2[2 * k + 1] = (float)rnd.uniform(0, 480);
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------
+
+/**
+ * Checks the model found by a solver of fundamental matrices
+ * @param scene
+ * @param F model
+ * @param inliers number of inliers returned
+ * @param status inlier flags returned
+ * @param max_error inlier threshold used
+ */
+static void checkFundamental(const TestScene &scene, const double *F,
+  int inliers, const vector<unsigned char> &status, double max_error)
+{
+  const int n = (int)scene.good.size();
+
+  int n_good = 0, found = 0, flagged = 0;
+  double error = 0;
+  for(int k = 0; k < n; ++k)
+  {
+    if(status[k]) ++flagged;
+    if(!scene.good[k]) continue;
+
+    ++n_good;
+    if(status[k]) ++found;
+    error += Epipolar::sampson2(F, scene.x1[2 * k], scene.x1[2 * k + 1],
+      scene.x2[2 * k], scene.x2[2 * k + 1]);
+  }
+
+  CHECK(flagged == inliers);
+  CHECK(found >= n_good * 95 / 100);
+  // (some wrong correspondences may lie on their epipolar lines)
+  CHECK(inliers - found <= (n - n_good) / 10);
+  CHECK(error / n_good < max_error * max_error);
+
+  // the SIMD count agrees with the Sampson distance
+  vector<float> x1(n), y1(n), x2(n), y2(n);
+  int count = 0;
+  for(int k = 0; k < n; ++k)
+  {
+    x1[k] = scene.x1[2 * k]; y1[k] = scene.x1[2 * k + 1];
+    x2[k] = scene.x2[2 * k]; y2[k] = scene.x2[2 * k + 1];
+
+    const double d = Epipolar::sampson2(F, x1[k], y1[k], x2[k], y2[k]);
+    // (ignores the points too close to the threshold for float precision)
+    if(fabs(d - max_error * max_error) < 1e-3) continue;
+    count += (d <= max_error * max_error);
+  }
+  vector<unsigned char> simd(n);
+  const int simd_count = Epipolar::countInliers(F, &x1[0], &y1[0], &x2[0],
+    &y2[0], n, max_error, &simd[0]);
+  CHECK(abs(simd_count - count) <= 1);
+}
+
+// ----------------------------------------------------------------------------
+
+void testProsacSolver()
+{
+  TestRandom rnd(15);
+  TestScene scene;
+  makeScene(rnd, 200, 140, 0.5, scene);
+  const int n = (int)scene.good.size();
+
+  ProsacSolver solver;
+  double F[9];
+  vector<unsigned char> status;
+
+  // RANSAC
+  int inliers = solver.solve(&scene.x1[0], &scene.x2[0], n, NULL, 2., 0.99,
+    2000, F, &status);
+  checkFundamental(scene, F, inliers, status, 2.);
+
+  // PROSAC, with the right correspondences ranked first
+  vector<unsigned int> order(n);
+  for(int k = 0; k < n; ++k) order[k] = k;
+  inliers = solver.solve(&scene.x1[0], &scene.x2[0], n, &order[0], 2., 0.99,
+    2000, F, &status);
+  checkFundamental(scene, F, inliers, status, 2.);
+
+  // same result with several workers, also when the pool is reused
+  double Ft[9];
+  vector<unsigned char> status_t;
+  WorkerPool pool;
+  pool.resize(4);
+  solver.setPool(&pool);
+  for(int r = 0; r < 2; ++r)
+  {
+    const int inliers_t = solver.solve(&scene.x1[0], &scene.x2[0], n,
+      &order[0], 2., 0.99, 2000, Ft, &status_t);
+    CHECK(inliers_t == inliers);
+    CHECK(status_t == status);
+  }
+  solver.setPool(NULL);
+
+  // too few correspondences
+  CHECK(solver.solve(&scene.x1[0], &scene.x2[0], ProsacSolver::SAMPLE - 1,
+    NULL, 2., 0.99, 2000, F, &status) == 0);
+}
+
+// ----------------------------------------------------------------------------
+
+void testFivePoint()
+{
+  TestRandom rnd(16);
+  TestScene scene;
+  makeScene(rnd, 200, 140, 0., scene);
+  const int n = (int)scene.good.size();
+
+  // true essential matrix [t]x * R, normalized
+  const double *R = scene.R, *t = scene.t;
+  double E0[9];
+  for(int j = 0; j < 3; ++j)
+  {
+    E0[j] = -t[2] * R[3 + j] + t[1] * R[6 + j];
+    E0[3 + j] = t[2] * R[j] - t[0] * R[6 + j];
+    E0[6 + j] = -t[1] * R[j] + t[0] * R[3 + j];
+  }
+  double norm = 0;
+  for(int i = 0; i < 9; ++i) norm += E0[i] * E0[i];
+  for(int i = 0; i < 9; ++i) E0[i] /= sqrt(norm);
+
+  // one of the solutions of 5 exact correspondences is the true one
+  double x1[10], x2[10];
+  for(int k = 0; k < 5; ++k)
+  {
+    x1[2 * k] = (scene.x1[2 * k] - scene.cx) / scene.fx;
+    x1[2 * k + 1] = (scene.x1[2 * k + 1] - scene.cy) / scene.fy;
+    x2[2 * k] = (scene.x2[2 * k] - scene.cx) / scene.fx;
+    x2[2 * k + 1] = (scene.x2[2 * k + 1] - scene.cy) / scene.fy;
+  }
+
+  double E[10 * 9];
+  const int ns = FivePoint::solve(x1, x2, E);
+  CHECK(ns > 0);
+
+  double best = 1e9;
+  for(int s = 0; s < ns; ++s)
+  {
+    const double *Es = E + 9 * s;
+
+    // the 5 correspondences satisfy the epipolar constraint
+    for(int k = 0; k < 5; ++k)
+    {
+      const double u1 = x1[2 * k], v1 = x1[2 * k + 1];
+      const double u2 = x2[2 * k], v2 = x2[2 * k + 1];
+      const double r = u2 * (Es[0] * u1 + Es[1] * v1 + Es[2]) +
+        v2 * (Es[3] * u1 + Es[4] * v1 + Es[5]) +
+        (Es[6] * u1 + Es[7] * v1 + Es[8]);
+      CHECK(fabs(r) < 1e-6);
+    }
+
+    double dp = 0, dm = 0;
+    for(int i = 0; i < 9; ++i)
+    {
+      dp += (Es[i] - E0[i]) * (Es[i] - E0[i]);
+      dm += (Es[i] + E0[i]) * (Es[i] + E0[i]);
+    }
+    best = min(best, min(dp, dm));
+  }
+  CHECK(best < 1e-8);
+
+  // essential mode of the PROSAC solver, with noise and wrong matches
+  makeScene(rnd, 200, 140, 0.5, scene);
+
+  ProsacSolver solver;
+  solver.useEssential(scene.fx, scene.fy, scene.cx, scene.cy);
+
+  vector<unsigned int> order(n);
+  for(int k = 0; k < n; ++k) order[k] = k;
+
+  double F[9];
+  vector<unsigned char> status;
+  const int inliers = solver.solve(&scene.x1[0], &scene.x2[0], n, &order[0],
+    2., 0.99, 2000, F, &status);
+  checkFundamental(scene, F, inliers, status, 2.);
+
+  // (5 correspondences are enough)
+  CHECK(solver.solve(&scene.x1[0], &scene.x2[0], 5, NULL, 2., 0.99, 100, F,
+    &status) == 5);
+
+  // without valid intrinsics, fundamental matrices are estimated instead
+  CHECK(!solver.useEssential(0, scene.fy, scene.cx, scene.cy));
+  CHECK(solver.solve(&scene.x1[0], &scene.x2[0], 5, NULL, 2., 0.99, 100, F,
+    &status) == 0);
+  const int inliers_f = solver.solve(&scene.x1[0], &scene.x2[0], n, 
+    &order[0], 2., 0.99, 2000, F, &status);
+  checkFundamental(scene, F, inliers_f, status, 2.);
+}
+
+// ----------------------------------------------------------------------------
+
+/**
+ * Returns the difference between two poses
+ * @param R1
+ * @param t1
+ * @param R2
+ * @param t2
+ * @return max absolute difference of their entries
+ */
+static double poseDifference(const double *R1, const double *t1,
+  const double *R2, const double *t2)
+{
+  double d = 0;
+  for(int i = 0; i < 9; ++i) d = max(d, fabs(R1[i] - R2[i]));
+  for(int i = 0; i < 3; ++i) d = max(d, fabs(t1[i] - t2[i]));
+  return d;
+}
+
+// ----------------------------------------------------------------------------
+
+void testPoseSolver()
+{
+  TestRandom rnd(17);
+  TestScene scene;
+  makeScene(rnd, 200, 140, 0., scene);
+  const int n = (int)scene.good.size();
+
+  // one of the poses of 3 exact correspondences is the true one
+  double f[9], P[9];
+  for(int k = 0; k < 3; ++k)
+  {
+    const double u = (scene.x2[2 * k] - scene.cx) / scene.fx;
+    const double v = (scene.x2[2 * k + 1] - scene.cy) / scene.fy;
+    const double s = 1. / sqrt(u * u + v * v + 1);
+    f[3 * k] = u * s; f[3 * k + 1] = v * s; f[3 * k + 2] = s;
+    for(int i = 0; i < 3; ++i) P[3 * k + i] = scene.P[3 * k + i];
+  }
+
+  double R[4 * 9], t[4 * 3];
+  const int ns = P3P::solve(f, P, R, t);
+  CHECK(ns > 0);
+
+  double best = 1e9;
+  for(int s = 0; s < ns; ++s)
+    best = min(best, poseDifference(R + 9 * s, t + 3 * s, scene.R, scene.t));
+  CHECK(best < 1e-4);
+
+  // RANSAC, with noise and wrong matches
+  makeScene(rnd, 200, 140, 0.5, scene);
+
+  PoseSolver solver;
+  solver.setCamera(scene.fx, scene.fy, scene.cx, scene.cy);
+
+  vector<unsigned char> status;
+  const int inliers = solver.solve(&scene.P[0], &scene.x2[0], n, 2., 0.99,
+    500, R, t, &status);
+
+  int n_good = 0, found = 0, flagged = 0;
+  for(int k = 0; k < n; ++k)
+  {
+    if(status[k]) ++flagged;
+    if(scene.good[k]) ++n_good;
+    if(scene.good[k] && status[k]) ++found;
+  }
+  CHECK(flagged == inliers);
+  CHECK(found >= n_good * 95 / 100);
+  CHECK(inliers - found <= (n - n_good) / 10);
+  CHECK(poseDifference(R, t, scene.R, scene.t) < 0.02);
+
+  // too few correspondences
+  CHECK(solver.solve(&scene.P[0], &scene.x2[0], PoseSolver::SAMPLE - 1, 2.,
+    0.99, 500, R, t, &status) == 0);
+}
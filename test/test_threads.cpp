@@ -0,0 +1,118 @@
+/**
+ * File: test_threads.cpp
+ * Date: October 2026
+ * Author: agent
+ * Description: checks of the thread utilities
+ * License: see the LICENSE.txt file
+ */
+
+#include <vector>
+#include <atomic>
+#include <thread>
+
+#include "WorkerPool.h"
+#include "SpscQueue.h"
+
+#include "test.h"
+
+using namespace DLoopDetector;
+using namespace std;
+
+// ----------------------------------------------------------------------------
+
+void testWorkerPool()
+{
+  WorkerPool pool;
+  CHECK(pool.size() == 1);
+
+  const int sizes[] = { 1, 4, 2, 8 };
+  for(int s = 0; s < 4; ++s)
+  {
+    pool.resize(sizes[s]);
+    CHECK(pool.size() == sizes[s]);
+
+    for(int job = 0; job < 20; ++job)
+    {
+      const int n = job * 7;
+
+      // each task runs once, and each worker runs its tasks in order
+      vector<atomic<int> > runs(n);
+      for(int i = 0; i < n; ++i) runs[i] = 0;
+      vector<int> last(pool.size(), -1);
+      atomic<int> bad(0);
+
+      pool.run(n, [&](int i, int w)
+      {
+        if(w < 0 || w >= pool.size() || i <= last[w]) ++bad;
+        else last[w] = i;
+        ++runs[i];
+      });
+
+      CHECK(bad == 0);
+      for(int i = 0; i < n; ++i) CHECK(runs[i] == 1);
+    }
+  }
+
+  // the calling thread alone
+  pool.resize(1);
+  int sum = 0;
+  pool.run(10, [&](int i, int w) { if(w == 0) sum += i; });
+  CHECK(sum == 45);
+}
+
+// ----------------------------------------------------------------------------
+
+void testSpscQueue()
+{
+  SpscQueue<vector<int> > queue(5);
+  CHECK(queue.capacity() == 8);
+  CHECK(queue.empty() && !queue.full());
+
+  // items are moved in and out in order
+  vector<int> item;
+  for(int i = 0; i < 8; ++i)
+  {
+    item.assign(1, i);
+    CHECK(queue.tryPush(item));
+    CHECK(item.empty());
+  }
+  CHECK(queue.full());
+  item.assign(1, 8);
+  CHECK(!queue.tryPush(item) && item.size() == 1);
+
+  for(int i = 0; i < 8; ++i)
+  {
+    CHECK(queue.tryPop(item));
+    CHECK(item.size() == 1 && item[0] == i);
+  }
+  CHECK(queue.empty() && !queue.tryPop(item));
+
+  // one producer and one consumer that sleep on doorbells
+  const int N = 100000;
+  Doorbell room, items;
+  int bad = 0;
+
+  thread consumer([&]()
+  {
+    vector<int> v;
+    for(int i = 0; i < N; ++i)
+    {
+      items.wait([&]() { return !queue.empty(); });
+      queue.tryPop(v);
+      room.ring();
+      if(v.size() != 1 || v[0] != i) ++bad;
+    }
+  });
+
+  for(int i = 0; i < N; ++i)
+  {
+    vector<int> v(1, i);
+    room.wait([&]() { return !queue.full(); });
+    queue.tryPush(v);
+    items.ring();
+  }
+
+  consumer.join();
+  CHECK(bad == 0);
+  CHECK(queue.empty());
+}